@@ -0,0 +1,236 @@
+// Benchmark of the hashtables in this directory against std::unordered_map
+// Build: g++ -std=c++17 -O2 -DNDEBUG -o benchmark benchmark.cpp
+// Usage: ./benchmark [table size ...]     (default: 1000 100000 1000000, up to 100000000)
+//
+// For every table, key type and size it reports ns/op of insert, hit lookup, miss lookup,
+// erase, mixed churn and full iteration, heap bytes per entry, and the distribution of
+// single insert latencies, whose tail is dominated by rehash pauses.
+
+#include "compact_hashtable.hpp"
+#include "cow_hashtable.hpp"
+#include "hash_functions.hpp"
+#include "hashtable.hpp"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// ---- heap accounting ----
+
+static size_t liveBytes = 0;
+
+void *operator new(size_t size) {
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    liveBytes += malloc_usable_size(p);
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    if (p != nullptr) {
+        liveBytes -= malloc_usable_size(p);
+        free(p);
+    }
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+void *operator new(size_t size, align_val_t alignment) {
+    size_t align = (size_t) alignment;
+    void *p = aligned_alloc(align, (size + align - 1) / align * align);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    liveBytes += malloc_usable_size(p);
+    return p;
+}
+
+void operator delete(void *p, align_val_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t, align_val_t) noexcept {
+    operator delete(p);
+}
+
+// ---- table adapters ----
+
+template<typename Table>
+struct Adapter {
+    template<typename Key, typename Value>
+    static void insert(Table &table, const Key &key, const Value &value) { table.try_emplace(key, value); }
+
+    template<typename Key>
+    static bool contains(Table &table, const Key &key) { return table.find(key) != table.end(); }
+
+    template<typename Key>
+    static void erase(Table &table, const Key &key) { table.erase(key); }
+};
+
+template<typename Key, typename Value>
+struct Adapter<CowHashTable<Key, Value>> {
+    static void insert(CowHashTable<Key, Value> &table, const Key &key, const Value &value) { table.insert(key, value); }
+
+    static bool contains(CowHashTable<Key, Value> &table, const Key &key) { return table.find(key) != nullptr; }
+
+    static void erase(CowHashTable<Key, Value> &table, const Key &key) { table.erase(key); }
+};
+
+/**
+ * A HashTable with the Bloom filter enabled from the start
+ */
+template<typename Key, typename Value>
+struct FilteredHashTable : public HashTable<Key, Value> {
+    FilteredHashTable() { this->enableFilter(); }
+};
+
+// ---- keys ----
+
+void makeKeys(vector<int64_t> &keys, size_t count, mt19937_64 &rng) {
+    keys.resize(count);
+    for (auto &key : keys) {
+        key = (int64_t) (rng() >> 1);
+    }
+}
+
+void makeKeys(vector<string> &keys, size_t count, mt19937_64 &rng) {
+    keys.resize(count);
+    for (auto &key : keys) {
+        key = "benchmark-key-" + to_string(rng());
+    }
+}
+
+// ---- measurement ----
+
+using Clock = chrono::steady_clock;
+
+static uint64_t sink = 0;
+
+double nanosecondsPerOp(Clock::time_point start, size_t ops) {
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+    return ops == 0 ? 0.0 : (double) elapsed / (double) ops;
+}
+
+template<typename Table, typename Key>
+void run(const char *name, const char *keyName, size_t size, uint64_t seed) {
+    using Ops = Adapter<Table>;
+    mt19937_64 rng(seed);
+    vector<Key> keys, missing;
+    makeKeys(keys, size, rng);
+    makeKeys(missing, size, rng);
+    vector<size_t> order(size);
+    for (size_t i = 0; i < size; i++) {
+        order[i] = i;
+    }
+    shuffle(order.begin(), order.end(), rng);
+
+    // insert, and heap usage of the full table
+    size_t baseline = liveBytes;
+    auto *table = new Table();
+    auto start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        Ops::insert(*table, keys[i], (uint64_t) i);
+    }
+    double insertNs = nanosecondsPerOp(start, size);
+    double bytesPerEntry = (double) (liveBytes - baseline) / (double) size;
+
+    start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        sink += Ops::contains(*table, keys[order[i]]);
+    }
+    double hitNs = nanosecondsPerOp(start, size);
+
+    start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        sink += Ops::contains(*table, missing[i]);
+    }
+    double missNs = nanosecondsPerOp(start, size);
+
+    start = Clock::now();
+    for (auto &item : *table) {
+        sink += item.second;
+    }
+    double iterateNs = nanosecondsPerOp(start, size);
+
+    // mixed churn at constant size: every step erases a present key, inserts a missing one,
+    // and looks up two keys; by the end the table holds exactly the missing keys
+    start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        Ops::erase(*table, keys[order[i]]);
+        Ops::insert(*table, missing[order[i]], (uint64_t) i);
+        sink += Ops::contains(*table, keys[order[(i * 7) % size]]);
+        sink += Ops::contains(*table, missing[order[i]]);
+    }
+    double churnNs = nanosecondsPerOp(start, size * 4);
+
+    start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        Ops::erase(*table, missing[order[i]]);
+    }
+    double eraseNs = nanosecondsPerOp(start, size);
+    delete table;
+
+    // single insert latency into a fresh table, so that every rehash is observed
+    vector<uint32_t> latencies(size);
+    table = new Table();
+    for (size_t i = 0; i < size; i++) {
+        auto before = Clock::now();
+        Ops::insert(*table, keys[i], (uint64_t) i);
+        latencies[i] = (uint32_t) min<int64_t>(
+                chrono::duration_cast<chrono::nanoseconds>(Clock::now() - before).count(), UINT32_MAX);
+    }
+    delete table;
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[min(size - 1, (size_t) (p * (double) size))]; };
+
+    printf("%-32s %-6s %10zu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %9u %9u %11u\n",
+           name, keyName, size, insertNs, hitNs, missNs, eraseNs, churnNs, iterateNs, bytesPerEntry,
+           percentile(0.99), percentile(0.999), latencies.back());
+    fflush(stdout);
+}
+
+template<typename Key>
+void runAll(const char *keyName, size_t size, uint64_t seed) {
+    run<unordered_map<Key, uint64_t>, Key>("std::unordered_map", keyName, size, seed);
+    run<HashTable<Key, uint64_t>, Key>("HashTable", keyName, size, seed);
+    run<HashTable<Key, uint64_t, SeededHash<Key>>, Key>("HashTable<SeededHash>", keyName, size, seed);
+    run<FilteredHashTable<Key, uint64_t>, Key>("HashTable+filter", keyName, size, seed);
+    run<CompactHashTable<Key, uint64_t>, Key>("CompactHashTable", keyName, size, seed);
+    run<CowHashTable<Key, uint64_t>, Key>("CowHashTable", keyName, size, seed);
+}
+
+int main(int argc, char *argv[]) {
+    vector<size_t> sizes;
+    for (int i = 1; i < argc; i++) {
+        sizes.push_back((size_t) strtoull(argv[i], nullptr, 10));
+    }
+    if (sizes.empty()) {
+        sizes = {1000, 100000, 1000000};
+    }
+
+    printf("%-32s %-6s %10s %8s %8s %8s %8s %8s %8s %8s %9s %9s %11s\n",
+           "table", "key", "size", "insert", "hit", "miss", "erase", "churn", "iterate", "B/entry",
+           "p99(ns)", "p99.9(ns)", "max(ns)");
+    for (size_t size : sizes) {
+        if (size == 0) {
+            continue;
+        }
+        runAll<int64_t>("int64", size, 281);
+        runAll<string>("string", size, 281);
+    }
+    return sink == 42 ? 1 : 0;
+}
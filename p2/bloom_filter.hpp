@@ -0,0 +1,131 @@
+#ifndef VE281P2_BLOOM_FILTER_HPP
+#define VE281P2_BLOOM_FILTER_HPP
+
+#include "hash_functions.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A cache-line blocked Bloom filter over 64 bit hash values
+ * Every key sets WORDS_PER_BLOCK bits inside a single 64 byte block, one bit in each
+ * 64 bit word of the block (a "split block" filter), so a query reads one cache line
+ * The filter stores hash values only and never touches the keys; it cannot remove a key,
+ * the owner rebuilds it (clear + add) when too many keys are stale
+ * With 10 bits per key the false positive rate is about 1%, with 16 about 0.1%
+ */
+class BlockedBloomFilter {
+public:
+    static constexpr size_t WORDS_PER_BLOCK = 8;
+    static constexpr size_t DEFAULT_BITS_PER_KEY = 10;
+
+private:
+    struct alignas(64) Block {
+        uint64_t words[WORDS_PER_BLOCK];
+    };
+
+    std::vector<Block> blocks;
+    size_t keyCount = 0;
+
+    /**
+     * Time Complexity: O(1)
+     * @return the index of the block a mixed hash value falls into
+     *         (multiply-shift range reduction of the high bits)
+     */
+    size_t blockIndex(uint64_t mixed) const {
+        return (size_t) (((mixed >> 32) * (uint64_t) blocks.size()) >> 32);
+    }
+
+    /**
+     * Time Complexity: O(1)
+     * @return the bit to set in word i for a mixed hash value (one multiply per word)
+     */
+    static uint64_t bitOf(uint64_t mixed, size_t i) {
+        // odd multipliers of the Parquet split block filter
+        static constexpr uint32_t SALT[WORDS_PER_BLOCK] = {
+                0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+                0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+        return (uint64_t) 1 << (((uint32_t) mixed * SALT[i]) >> 26);
+    }
+
+    /**
+     * Spread the hash value, std::hash is the identity for integers
+     */
+    static uint64_t mix(uint64_t hashValue) {
+        return HashFunctions::hashInteger(hashValue, 0);
+    }
+
+public:
+    BlockedBloomFilter() = default;
+
+    /**
+     * Drop all keys and resize the filter for a number of keys
+     * Time Complexity: O(capacity)
+     * @param capacity number of keys the filter is sized for
+     * @param bitsPerKey bits of filter per key, at least 1
+     */
+    void reset(size_t capacity, size_t bitsPerKey = DEFAULT_BITS_PER_KEY) {
+        size_t bits = (capacity > 0 ? capacity : 1) * (bitsPerKey > 0 ? bitsPerKey : 1);
+        size_t blockCount = (bits + WORDS_PER_BLOCK * 64 - 1) / (WORDS_PER_BLOCK * 64);
+        blocks.assign(blockCount, Block());
+        keyCount = 0;
+    }
+
+    /**
+     * Drop all keys without resizing
+     * Time Complexity: O(size of the filter)
+     */
+    void clear() {
+        blocks.assign(blocks.size(), Block());
+        keyCount = 0;
+    }
+
+    /**
+     * Add a hash value, the filter must not be empty (call reset first)
+     * Time Complexity: O(1)
+     * @param hashValue
+     */
+    void add(uint64_t hashValue) {
+        uint64_t mixed = mix(hashValue);
+        Block &block = blocks[blockIndex(mixed)];
+        for (size_t i = 0; i < WORDS_PER_BLOCK; i++) {
+            block.words[i] |= bitOf(mixed, i);
+        }
+        keyCount++;
+    }
+
+    /**
+     * Time Complexity: O(1), a single cache line is read
+     * @param hashValue
+     * @return false if the hash value was never added, true if it may have been
+     */
+    bool mayContain(uint64_t hashValue) const {
+        if (blocks.empty()) {
+            return true;
+        }
+        uint64_t mixed = mix(hashValue);
+        const Block &block = blocks[blockIndex(mixed)];
+        uint64_t missing = 0;
+        for (size_t i = 0; i < WORDS_PER_BLOCK; i++) {
+            missing |= bitOf(mixed, i) & ~block.words[i];
+        }
+        return missing == 0;
+    }
+
+    /**
+     * @return the number of hash values added since the last reset or clear
+     */
+    size_t size() const { return keyCount; }
+
+    /**
+     * @return whether the filter has been sized by reset
+     */
+    bool empty() const { return blocks.empty(); }
+
+    /**
+     * @return the memory used by the filter in bytes
+     */
+    size_t bytes() const { return blocks.size() * sizeof(Block); }
+};
+
+#endif //VE281P2_BLOOM_FILTER_HPP
@@ -0,0 +1,417 @@
+#ifndef VE281P2_BOUNDED_CACHE_HPP
+#define VE281P2_BOUNDED_CACHE_HPP
+
+#include "hashtable.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+/**
+ * Eviction policies of BoundedCache
+ * LRU      evict the least recently used entry, a hit moves the entry to the front
+ * CLOCK    second chance FIFO, a hit only sets a reference bit
+ * S3FIFO   a small FIFO (10% of the capacity) filters one-hit entries before they reach
+ *          the main FIFO, with a ghost FIFO of recently evicted keys (Yang et al., SOSP'23)
+ */
+enum class CachePolicy {
+    LRU, CLOCK, S3FIFO
+};
+
+/**
+ * Unit of the capacity of BoundedCache
+ * ENTRIES  the capacity is a number of entries
+ * BYTES    the capacity is a byte budget, each entry weighs what the Sizer returns
+ */
+enum class CacheCapacity {
+    ENTRIES, BYTES
+};
+
+/**
+ * Default Sizer of BoundedCache, the shallow size of an entry
+ */
+template<typename Key, typename Value>
+struct CacheEntrySize {
+    size_t operator()(const Key &, const Value &) const {
+        return sizeof(Key) + sizeof(Value);
+    }
+};
+
+/**
+ * Counters of BoundedCache
+ */
+struct CacheStats {
+    size_t hits = 0;        // get found the key
+    size_t misses = 0;      // get did not find the key
+    size_t insertions = 0;  // put added a new key (entries heavier than the capacity are not counted)
+    size_t evictions = 0;   // entries evicted to stay within the capacity
+
+    double hitRatio() const {
+        return hits + misses ? (double) hits / (double) (hits + misses) : 0.0;
+    }
+};
+
+/**
+ * A bounded cache built on HashTable
+ * The recency links of the policy live inside the values of the hashtable nodes (intrusive),
+ * so there is one allocation per entry and a hit is a single find.
+ * Node addresses are stable because HashTable relinks nodes on rehash instead of copying them.
+ * The time complexity of functions are based on k, the length of Key
+ * @tparam Key          key type
+ * @tparam Value        data type
+ * @tparam Policy       eviction policy
+ * @tparam Hash         function object, return the hash value of a key
+ * @tparam KeyEqual     function object, return whether two keys are the same
+ * @tparam Sizer        function object, return the weight of an entry in CacheCapacity::BYTES mode
+ */
+template<
+        typename Key, typename Value,
+        CachePolicy Policy = CachePolicy::LRU,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>,
+        typename Sizer = CacheEntrySize<Key, Value>
+>
+class BoundedCache {
+protected:
+    static constexpr uint8_t MAX_FREQUENCY = 3;     // S3-FIFO saturating access counter
+    static constexpr size_t SMALL_QUEUE_PERCENT = 10;
+
+    /**
+     * Links of an intrusive circular doubly linked list
+     */
+    struct Link {
+        Link *prev = this;
+        Link *next = this;
+
+        bool empty() const { return next == this; }
+
+        void unlink() {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = this;
+        }
+
+        // insert node right after this link (at the front of a list whose sentinel is this)
+        void pushFront(Link *node) {
+            node->prev = this;
+            node->next = next;
+            next->prev = node;
+            next = node;
+        }
+    };
+
+    struct Entry : Link {
+        Value value;
+        const Key *key = nullptr;   // the key of the hashtable node holding this entry
+        size_t weight = 0;          // 1, or the Sizer result in CacheCapacity::BYTES mode
+        uint8_t frequency = 0;      // reference bit (CLOCK) or access counter (S3FIFO)
+        bool inMain = false;        // which queue holds the entry (S3FIFO)
+
+        template<typename... Args>
+        explicit Entry(Args &&... args) : value(std::forward<Args>(args)...) {}
+
+        Entry(const Entry &) = delete;
+
+        Entry &operator=(const Entry &) = delete;
+    };
+
+    typedef HashTable<Key, Entry, Hash, KeyEqual> EntryTable;
+
+    EntryTable table;
+    Link mainQueue;                 // LRU list, CLOCK ring or S3FIFO main queue; front is the newest
+    Link smallQueue;                // S3FIFO small queue
+    size_t capacity;
+    CacheCapacity unit;
+    size_t usedWeight = 0;          // total weight of all entries
+    size_t smallWeight = 0;         // total weight of the entries in smallQueue
+    Sizer sizer;
+    CacheStats stats;
+
+    // S3FIFO ghost queue: recently evicted keys, stamped so that stale queue items can be skipped
+    HashTable<Key, uint64_t, Hash, KeyEqual> ghostTable;
+    std::deque<std::pair<Key, uint64_t>> ghostQueue;
+    uint64_t ghostStamp = 0;
+
+    static Entry *entryOf(Link *link) { return static_cast<Entry *>(link); }
+
+    size_t weigh(const Key &key, const Value &value) const {
+        return unit == CacheCapacity::ENTRIES ? 1 : sizer(key, value);
+    }
+
+    /**
+     * Update the policy state on a hit
+     * Time Complexity: O(1)
+     */
+    void touch(Entry &entry) {
+        if constexpr (Policy == CachePolicy::LRU) {
+            entry.unlink();
+            mainQueue.pushFront(&entry);
+        } else if constexpr (Policy == CachePolicy::CLOCK) {
+            entry.frequency = 1;
+        } else {
+            if (entry.frequency < MAX_FREQUENCY) {
+                entry.frequency++;
+            }
+        }
+    }
+
+    /**
+     * Unlink an entry from its queue and take its weight out of the accounting
+     * Time Complexity: O(1)
+     */
+    void detach(Entry &entry) {
+        entry.unlink();
+        usedWeight -= entry.weight;
+        if (Policy == CachePolicy::S3FIFO && !entry.inMain) {
+            smallWeight -= entry.weight;
+        }
+    }
+
+    /**
+     * Link a detached entry to the front of its queue and add its weight back
+     * Time Complexity: O(1)
+     */
+    void attach(Entry &entry) {
+        usedWeight += entry.weight;
+        if (Policy == CachePolicy::S3FIFO && !entry.inMain) {
+            smallWeight += entry.weight;
+            smallQueue.pushFront(&entry);
+        } else {
+            mainQueue.pushFront(&entry);
+        }
+    }
+
+    /**
+     * Remove an entry from the policy lists and the hashtable
+     * Time Complexity: O(k)
+     */
+    void remove(Entry &entry) {
+        detach(entry);
+        table.erase(*entry.key);
+    }
+
+    void evict(Entry &entry) {
+        stats.evictions++;
+        remove(entry);
+    }
+
+    /**
+     * Remember an evicted key in the S3FIFO ghost queue, bounded by the main queue capacity
+     * Time Complexity: Amortized O(k)
+     */
+    void rememberGhost(const Key &key) {
+        size_t ghostCapacity = capacity - capacity * SMALL_QUEUE_PERCENT / 100;
+        if (unit == CacheCapacity::BYTES) {
+            ghostCapacity = table.size() > 0 ? table.size() : 1;
+        }
+        ghostTable[key] = ++ghostStamp;
+        ghostQueue.emplace_back(key, ghostStamp);
+        while (ghostTable.size() > ghostCapacity || ghostQueue.size() > 2 * ghostCapacity) {
+            auto &oldest = ghostQueue.front();
+            auto it = ghostTable.find(oldest.first);
+            if (it != ghostTable.end() && it->second == oldest.second) {
+                ghostTable.erase(it);
+            }
+            ghostQueue.pop_front();
+        }
+    }
+
+    /**
+     * Evict one entry according to the policy
+     * Time Complexity: Amortized O(k)
+     */
+    void evictOne() {
+        if constexpr (Policy == CachePolicy::LRU) {
+            evict(*entryOf(mainQueue.prev));
+        } else if constexpr (Policy == CachePolicy::CLOCK) {
+            // give referenced entries a second chance until an unreferenced one is found
+            while (true) {
+                Entry &oldest = *entryOf(mainQueue.prev);
+                if (oldest.frequency == 0) {
+                    evict(oldest);
+                    return;
+                }
+                oldest.frequency = 0;
+                oldest.unlink();
+                mainQueue.pushFront(&oldest);
+            }
+        } else {
+            while (true) {
+                bool fromSmall = !smallQueue.empty() &&
+                                 (smallWeight * 100 >= capacity * SMALL_QUEUE_PERCENT || mainQueue.empty());
+                if (fromSmall) {
+                    Entry &oldest = *entryOf(smallQueue.prev);
+                    if (oldest.frequency > 0) {
+                        // accessed again while in the small queue, promote it
+                        detach(oldest);
+                        oldest.frequency = 0;
+                        oldest.inMain = true;
+                        attach(oldest);
+                        continue;
+                    }
+                    Key key = *oldest.key;
+                    evict(oldest);
+                    rememberGhost(key);
+                    return;
+                }
+                Entry &oldest = *entryOf(mainQueue.prev);
+                if (oldest.frequency > 0) {
+                    oldest.frequency--;
+                    oldest.unlink();
+                    mainQueue.pushFront(&oldest);
+                    continue;
+                }
+                evict(oldest);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Link a new entry into the policy lists
+     * Time Complexity: Amortized O(k)
+     */
+    void admit(Entry &entry) {
+        if constexpr (Policy == CachePolicy::S3FIFO) {
+            auto ghost = ghostTable.find(*entry.key);
+            if (ghost != ghostTable.end()) {
+                // evicted recently from the small queue, go straight to the main queue
+                ghostTable.erase(ghost);
+                entry.inMain = true;
+            }
+        }
+        attach(entry);
+    }
+
+    /**
+     * Evict until an entry of the given weight fits, the entry itself is not linked yet
+     */
+    void makeRoom(size_t weight) {
+        while (usedWeight + weight > capacity && usedWeight > 0) {
+            evictOne();
+        }
+    }
+
+public:
+    /**
+     * @throw std::range_error if the capacity is 0
+     * @param capacity maximum number of entries, or byte budget
+     * @param unit unit of capacity
+     * @param sizer weight of an entry in CacheCapacity::BYTES mode
+     */
+    explicit BoundedCache(size_t capacity, CacheCapacity unit = CacheCapacity::ENTRIES, const Sizer &sizer = Sizer()) :
+            capacity(capacity), unit(unit), sizer(sizer) {
+        if (capacity == 0) {
+            throw std::range_error("invalid cache capacity!");
+        }
+    }
+
+    // entries link to each other by address, so the cache can not be copied
+    BoundedCache(const BoundedCache &) = delete;
+
+    BoundedCache &operator=(const BoundedCache &) = delete;
+
+    ~BoundedCache() = default;
+
+    /**
+     * Look up a key and record a hit or a miss
+     * Time Complexity: Amortized O(k), a single find
+     * @param key
+     * @return pointer to the cached value (valid until the entry is evicted), or nullptr on a miss
+     */
+    Value *get(const Key &key) {
+        auto it = table.find(key);
+        if (it == table.end()) {
+            stats.misses++;
+            return nullptr;
+        }
+        stats.hits++;
+        touch(it->second);
+        return &it->second.value;
+    }
+
+    /**
+     * @param key
+     * @return whether the key is cached, without touching its recency or the counters
+     */
+    bool contains(const Key &key) {
+        return table.contains(key);
+    }
+
+    /**
+     * Insert or overwrite a key, evicting other entries until it fits
+     * An entry heavier than the whole capacity is not cached
+     * Time Complexity: Amortized O(k)
+     * @param key
+     * @param value
+     * @return whether the key is cached after the call
+     */
+    template<typename V>
+    bool put(const Key &key, V &&value) {
+        auto result = table.try_emplace(key, std::forward<V>(value));
+        Entry &entry = result.first->second;
+        if (!result.second) {
+            // overwrite: this counts as an access, and the weight may change
+            entry.value = std::forward<V>(value);
+            touch(entry);
+            size_t weight = weigh(key, entry.value);
+            if (weight == entry.weight) {
+                return true;
+            }
+            detach(entry);
+            entry.weight = weight;
+            if (weight > capacity) {
+                table.erase(key);
+                return false;
+            }
+            makeRoom(weight);
+            attach(entry);
+            return true;
+        }
+
+        entry.key = &result.first->first;
+        entry.weight = weigh(key, entry.value);
+        if (entry.weight > capacity) {
+            table.erase(key);
+            return false;
+        }
+        stats.insertions++;
+        makeRoom(entry.weight);
+        admit(entry);
+        return true;
+    }
+
+    /**
+     * Erase the key if it is cached
+     * Time Complexity: Amortized O(k)
+     * @return whether the key was cached
+     */
+    bool erase(const Key &key) {
+        auto it = table.find(key);
+        if (it == table.end()) {
+            return false;
+        }
+        remove(it->second);
+        return true;
+    }
+
+    /**
+     * @return the number of cached entries
+     */
+    size_t size() const { return table.size(); }
+
+    /**
+     * @return the total weight of the cached entries (entries or bytes depending on the unit)
+     */
+    size_t weight() const { return usedWeight; }
+
+    size_t getCapacity() const { return capacity; }
+
+    const CacheStats &getStats() const { return stats; }
+
+    void resetStats() { stats = CacheStats(); }
+};
+
+#endif //VE281P2_BOUNDED_CACHE_HPP
@@ -0,0 +1,513 @@
+#ifndef VE281P2_COMPACT_HASHTABLE_HPP
+#define VE281P2_COMPACT_HASHTABLE_HPP
+
+#include "hash_prime.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * An insertion ordered hashtable with dense entry storage (the "compact dict" layout)
+ * Entries live in one vector in insertion order, and the buckets are a linear probing
+ * array of 32 bit indices into that vector, so a full scan is a linear walk of the entries
+ * and a node costs its key, value and cached hash instead of a list node per element.
+ * Erased entries are left as tombstones and removed when the index is rebuilt
+ * (on growth, when they make up most of the entries, or explicitly through compact()),
+ * which keeps the insertion order.
+ * The time complexity of functions are based on n and k
+ * n is the size of the hashtable
+ * k is the length of Key
+ * @tparam Key          key type
+ * @tparam Value        data type
+ * @tparam Hash         function object, return the hash value of a key
+ * @tparam KeyEqual     function object, return whether two keys are the same
+ */
+template<
+        typename Key, typename Value,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>
+>
+class CompactHashTable {
+public:
+    typedef std::pair<Key, Value> HashNode;     // the key of a node must not be modified through an iterator
+    typedef uint32_t IndexType;                 // type of the indices stored in the buckets
+
+    /**
+     * A single directional iterator for the hashtable, in insertion order
+     * It holds a position in the entries, and every rebuild of the index drops the tombstones before it
+     * So it is invalidated by rehash, compact and shrink_to_fit, and by any insertion after an erase
+     * (an insertion may rebuild the index, see reserveBucket and reserveEntry)
+     * While there are no tombstones (tombstones() == 0), it stays valid across insertions
+     * Pointers and references to the nodes are invalidated by every insertion
+     */
+    class Iterator {
+    private:
+        CompactHashTable *hashTable;
+        size_t position;    // index in the entries vector
+
+        /**
+         * Skip tombstones from position
+         * Time Complexity: Amortized O(1)
+         */
+        void skipDead() {
+            while (position < hashTable->entries.size() && !hashTable->entries[position].live) {
+                ++position;
+            }
+        }
+
+        Iterator(CompactHashTable *hashTable, size_t position) : hashTable(hashTable), position(position) {
+            skipDead();
+        }
+
+    public:
+        friend class CompactHashTable;
+
+        Iterator() = delete;
+
+        Iterator(const Iterator &) = default;
+
+        Iterator &operator=(const Iterator &) = default;
+
+        Iterator &operator++() {
+            ++position;
+            skipDead();
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator temp = *this;
+            ++(*this);
+            return temp;
+        }
+
+        bool operator==(const Iterator &that) const {
+            return position == that.position;
+        }
+
+        bool operator!=(const Iterator &that) const {
+            return position != that.position;
+        }
+
+        HashNode *operator->() {
+            return &hashTable->entries[position].node;
+        }
+
+        HashNode &operator*() {
+            return hashTable->entries[position].node;
+        }
+    };
+
+protected:                                                                  // DO NOT USE private HERE!
+    static constexpr double DEFAULT_LOAD_FACTOR = 0.5;                      // default maximum load factor is 0.5
+    static constexpr size_t DEFAULT_BUCKET_SIZE = HashPrime::g_a_sizes[0];  // default number of buckets is 5
+    static constexpr IndexType EMPTY = std::numeric_limits<IndexType>::max();          // never used bucket
+    static constexpr IndexType DELETED = std::numeric_limits<IndexType>::max() - 1;    // bucket of an erased entry
+
+    struct Entry {
+        HashNode node;
+        size_t hashValue;   // cached full hash value, so rebuilding the index never rehashes keys
+        bool live;          // false for tombstones
+
+        template<typename... Args>
+        Entry(size_t hashValue, Args &&... args) : node(std::forward<Args>(args)...), hashValue(hashValue), live(true) {}
+    };
+
+    std::vector<Entry> entries;     // entries in insertion order, including tombstones
+    std::vector<IndexType> buckets; // linear probing array of indices into entries
+    size_t tableSize = 0;           // number of live entries
+    size_t usedBuckets = 0;         // number of buckets that are not EMPTY
+    double maxLoadFactor = DEFAULT_LOAD_FACTOR;
+    Hash hash;
+    KeyEqual keyEqual;
+
+    /**
+     * Find the minimum bucket size
+     * - It is not less than the parameter bucketSize
+     * - It can hold elementCount used buckets within maxLoadFactor
+     * - It is a (prime) number defined in HashPrime (hash_prime.hpp)
+     * Time Complexity: O(1)
+     * @throw std::range_error if no such bucket size can be found
+     */
+    size_t findMinimumBucketSize(size_t bucketSize, size_t elementCount) const {
+        int i = 0;
+        while (i < HashPrime::num_distinct_sizes_64_bit &&
+               (HashPrime::g_a_sizes[i] < bucketSize ||
+                (double) elementCount > maxLoadFactor * (double) HashPrime::g_a_sizes[i])) {
+            i++;
+        }
+        if (i >= HashPrime::num_distinct_sizes_64_bit) {
+            throw std::range_error("range error!");
+        }
+        return HashPrime::g_a_sizes[i];
+    }
+
+    /**
+     * Probe for a key
+     * Time Complexity: Amortized O(k)
+     * @param key
+     * @param hashValue full hash value of key
+     * @param found set to whether the key exists
+     * @return the bucket holding the key, or the bucket to insert it into
+     */
+    size_t findBucket(const Key &key, size_t hashValue, bool &found) const {
+        size_t bucket = hashValue % buckets.size();
+        size_t firstDeleted = buckets.size();
+        while (true) {
+            IndexType i = buckets[bucket];
+            if (i == EMPTY) {
+                found = false;
+                return firstDeleted != buckets.size() ? firstDeleted : bucket;
+            }
+            if (i == DELETED) {
+                if (firstDeleted == buckets.size()) {
+                    firstDeleted = bucket;
+                }
+            } else if (entries[i].hashValue == hashValue && keyEqual(entries[i].node.first, key)) {
+                found = true;
+                return bucket;
+            }
+            if (++bucket == buckets.size()) {
+                bucket = 0;
+            }
+        }
+    }
+
+    /**
+     * Find the bucket pointing to the entry at position
+     * Time Complexity: Amortized O(1)
+     */
+    size_t findBucketOf(size_t position) const {
+        size_t bucket = entries[position].hashValue % buckets.size();
+        while (buckets[bucket] != position) {
+            if (++bucket == buckets.size()) {
+                bucket = 0;
+            }
+        }
+        return bucket;
+    }
+
+    /**
+     * Drop all tombstones (keeping the insertion order) and rebuild the buckets with a new size
+     * Keys are not rehashed, the cached hash values are used
+     * Time Complexity: O(n + number of buckets + number of tombstones)
+     * @param bucketSize the new number of buckets
+     */
+    void rebuild(size_t bucketSize) {
+        size_t live = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].live) {
+                if (live != i) {
+                    entries[live] = std::move(entries[i]);
+                }
+                live++;
+            }
+        }
+        while (entries.size() > live) {
+            entries.pop_back();
+        }
+
+        buckets.assign(bucketSize, EMPTY);
+        for (size_t i = 0; i < entries.size(); i++) {
+            size_t bucket = entries[i].hashValue % bucketSize;
+            while (buckets[bucket] != EMPTY) {
+                if (++bucket == bucketSize) {
+                    bucket = 0;
+                }
+            }
+            buckets[bucket] = (IndexType) i;
+        }
+        usedBuckets = entries.size();
+    }
+
+    /**
+     * Make room for one more used bucket, compacting or growing the buckets if needed
+     * Tombstones are dropped at the same size if at least half of the used buckets are tombstones,
+     * otherwise the buckets grow to the next size in HashPrime
+     * Time Complexity: Amortized O(1)
+     * @return whether the buckets were rebuilt (previous bucket positions are invalid)
+     */
+    bool reserveBucket() {
+        if ((double) (usedBuckets + 1) <= maxLoadFactor * (double) buckets.size()) {
+            return false;
+        }
+        if (2 * (tableSize + 1) <= usedBuckets) {
+            rebuild(buckets.size());
+        } else {
+            rebuild(findMinimumBucketSize(buckets.size() + 1, tableSize + 1));
+        }
+        return true;
+    }
+
+    /**
+     * Make room for one more entry, dropping the tombstones at the same bucket size if they are more than
+     * half of the entries (and at least a quarter of the number of buckets, so the rebuild is amortized)
+     * An insert into the bucket of a tombstone does not use a new bucket, so reserveBucket alone would never
+     * drop the tombstones of insert / erase churn on the same keys
+     * Time Complexity: Amortized O(1)
+     * @throw std::range_error if the entries would not fit in IndexType
+     * @return whether the buckets were rebuilt (previous bucket positions are invalid)
+     */
+    bool reserveEntry() {
+        size_t dead = entries.size() - tableSize;
+        bool rebuilt = false;
+        if (2 * dead > entries.size() && 4 * dead >= buckets.size()) {
+            rebuild(buckets.size());
+            rebuilt = true;
+        }
+        if (entries.size() + 1 >= (size_t) DELETED) {
+            throw std::range_error("too many entries for the index type!");
+        }
+        return rebuilt;
+    }
+
+    /**
+     * Append a new entry and point a bucket to it
+     * Time Complexity: Amortized O(1) (plus the construction of the node)
+     * @param bucket the bucket returned by findBucket
+     * @param hashValue full hash value of the key
+     * @param key the key (read before the node is constructed)
+     * @param args arguments forwarded to the constructor of HashNode
+     * @return iterator of the new entry
+     */
+    template<typename... Args>
+    Iterator emplaceAt(size_t bucket, size_t hashValue, const Key &key, Args &&... args) {
+        bool found;
+        if (reserveEntry()) {
+            bucket = findBucket(key, hashValue, found);
+        }
+        if (buckets[bucket] == EMPTY && reserveBucket()) {
+            bucket = findBucket(key, hashValue, found);
+        }
+        if (buckets[bucket] == EMPTY) {
+            usedBuckets++;
+        }
+        entries.emplace_back(hashValue, std::forward<Args>(args)...);
+        buckets[bucket] = (IndexType) (entries.size() - 1);
+        tableSize++;
+        return Iterator(this, entries.size() - 1);
+    }
+
+    template<typename K, typename... Args>
+    std::pair<Iterator, bool> tryEmplaceImpl(K &&key, Args &&... args) {
+        size_t hashValue = hash(key);
+        bool found;
+        size_t bucket = findBucket(key, hashValue, found);
+        if (found) {
+            return {Iterator(this, buckets[bucket]), false};
+        }
+        const Key &keyRef = key;
+        return {emplaceAt(bucket, hashValue, keyRef, std::piecewise_construct,
+                          std::forward_as_tuple(std::forward<K>(key)),
+                          std::forward_as_tuple(std::forward<Args>(args)...)), true};
+    }
+
+    template<typename K, typename V>
+    std::pair<Iterator, bool> insertOrAssignImpl(K &&key, V &&value) {
+        size_t hashValue = hash(key);
+        bool found;
+        size_t bucket = findBucket(key, hashValue, found);
+        if (found) {
+            entries[buckets[bucket]].node.second = std::forward<V>(value);
+            return {Iterator(this, buckets[bucket]), false};
+        }
+        const Key &keyRef = key;
+        return {emplaceAt(bucket, hashValue, keyRef, std::forward<K>(key), std::forward<V>(value)), true};
+    }
+
+    /**
+     * Turn the entry at position into a tombstone
+     * Time Complexity: O(1)
+     */
+    void eraseAt(size_t bucket, size_t position) {
+        buckets[bucket] = DELETED;
+        entries[position].live = false;
+        tableSize--;
+    }
+
+public:
+    CompactHashTable() : buckets(DEFAULT_BUCKET_SIZE, EMPTY), hash(Hash()), keyEqual(KeyEqual()) {}
+
+    explicit CompactHashTable(size_t bucketSize, const Hash &hash = Hash(), const KeyEqual &keyEqual = KeyEqual()) :
+            hash(hash), keyEqual(keyEqual) {
+        buckets.assign(findMinimumBucketSize(bucketSize, 0), EMPTY);
+    }
+
+    CompactHashTable(const CompactHashTable &) = default;
+
+    CompactHashTable &operator=(const CompactHashTable &) = default;
+
+    ~CompactHashTable() = default;
+
+    Iterator begin() { return Iterator(this, 0); }
+
+    Iterator end() { return Iterator(this, entries.size()); }
+
+    /**
+     * Time Complexity: Amortized O(k)
+     * @param key
+     * @return whether the key exists in the hashtable
+     */
+    bool contains(const Key &key) const {
+        bool found;
+        findBucket(key, hash(key), found);
+        return found;
+    }
+
+    /**
+     * Find the value in hashtable by key
+     * Time Complexity: Amortized O(k)
+     * @param key
+     * @return iterator of the key, or end() if it does not exist
+     */
+    Iterator find(const Key &key) {
+        bool found;
+        size_t bucket = findBucket(key, hash(key), found);
+        return found ? Iterator(this, buckets[bucket]) : end();
+    }
+
+    /**
+     * Insert <key, value> into the hashtable
+     * If the key already exists, overwrite its value (the insertion order is kept)
+     * Time Complexity: Amortized O(k)
+     * @return whether insertion took place (return false if the key already exists)
+     */
+    bool insert(const Key &key, const Value &value) {
+        return insertOrAssignImpl(key, value).second;
+    }
+
+    bool insert(Key &&key, Value &&value) {
+        return insertOrAssignImpl(std::move(key), std::move(value)).second;
+    }
+
+    template<typename V>
+    std::pair<Iterator, bool> insert_or_assign(const Key &key, V &&value) {
+        return insertOrAssignImpl(key, std::forward<V>(value));
+    }
+
+    template<typename V>
+    std::pair<Iterator, bool> insert_or_assign(Key &&key, V &&value) {
+        return insertOrAssignImpl(std::move(key), std::forward<V>(value));
+    }
+
+    template<typename... Args>
+    std::pair<Iterator, bool> try_emplace(const Key &key, Args &&... args) {
+        return tryEmplaceImpl(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    std::pair<Iterator, bool> try_emplace(Key &&key, Args &&... args) {
+        return tryEmplaceImpl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Get the reference of value by key, create it first if it doesn't exist
+     * Time Complexity: Amortized O(k)
+     */
+    Value &operator[](const Key &key) {
+        return tryEmplaceImpl(key).first->second;
+    }
+
+    Value &operator[](Key &&key) {
+        return tryEmplaceImpl(std::move(key)).first->second;
+    }
+
+    /**
+     * Erase the key if it exists in the hashtable, otherwise, do nothing
+     * The entry becomes a tombstone, no rebuild happens in this function
+     * Time Complexity: Amortized O(k)
+     * @return whether the key exists
+     */
+    bool erase(const Key &key) {
+        bool found;
+        size_t bucket = findBucket(key, hash(key), found);
+        if (!found) {
+            return false;
+        }
+        eraseAt(bucket, buckets[bucket]);
+        return true;
+    }
+
+    /**
+     * Erase the entry at the input iterator
+     * Time Complexity: Amortized O(1)
+     * @return the iterator after the input iterator before the erase
+     */
+    Iterator erase(const Iterator &it) {
+        if (it.position >= entries.size()) {
+            return it;
+        }
+        eraseAt(findBucketOf(it.position), it.position);
+        return Iterator(this, it.position + 1);
+    }
+
+    /**
+     * Rebuild the buckets with the (hinted) number of buckets, dropping all tombstones
+     * Time Complexity: O(n + number of buckets)
+     * @param bucketSize lower bound of the new number of buckets
+     */
+    void rehash(size_t bucketSize) {
+        rebuild(findMinimumBucketSize(bucketSize, tableSize));
+    }
+
+    /**
+     * Drop all tombstones and rebuild the buckets with the minimum size satisfying the maximum load factor
+     * Time Complexity: O(n + number of buckets)
+     */
+    void shrink_to_fit() {
+        rebuild(findMinimumBucketSize(DEFAULT_BUCKET_SIZE, tableSize));
+        entries.shrink_to_fit();
+    }
+
+    /**
+     * Drop all tombstones without changing the number of buckets
+     * Time Complexity: O(n + number of buckets)
+     */
+    void compact() {
+        rebuild(buckets.size());
+    }
+
+    /**
+     * @return the number of elements in the hashtable
+     */
+    size_t size() const { return tableSize; }
+
+    /**
+     * @return the number of buckets in the hashtable
+     */
+    size_t bucketSize() const { return buckets.size(); }
+
+    /**
+     * @return the number of tombstones waiting for compaction
+     */
+    size_t tombstones() const { return entries.size() - tableSize; }
+
+    /**
+     * @return the current load factor of the hashtable
+     */
+    double loadFactor() const { return (double) tableSize / (double) buckets.size(); }
+
+    /**
+     * @return the maximum load factor of the hashtable
+     */
+    double getMaxLoadFactor() const { return maxLoadFactor; }
+
+    /**
+     * Set the max load factor, it must be less than 1 for linear probing
+     * @throw std::range_error if the load factor is too small or not less than 1
+     * @param loadFactor
+     */
+    void setMaxLoadFactor(double loadFactor) {
+        if (loadFactor <= 1e-9 || loadFactor >= 1) {
+            throw std::range_error("invalid load factor!");
+        }
+        maxLoadFactor = loadFactor;
+        rebuild(findMinimumBucketSize(buckets.size(), tableSize));
+    }
+};
+
+#endif //VE281P2_COMPACT_HASHTABLE_HPP
@@ -0,0 +1,407 @@
+#ifndef VE281P2_COW_HASHTABLE_HPP
+#define VE281P2_COW_HASHTABLE_HPP
+
+#include "hash_prime.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <forward_list>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * A hashtable with O(1) copy-on-write snapshots
+ * The buckets are split into fixed size chunks held by reference counted pointers,
+ * and the directory of chunks is reference counted as well.
+ * snapshot() (or the copy constructor) only shares the directory; the first write after it
+ * copies the directory (one pointer per chunk), and every write copies the chunk it modifies
+ * if that chunk is still shared. So a write costs time proportional to what it modifies,
+ * not to the size of the table, and a snapshot is a frozen consistent view.
+ *
+ * Thread safety: snapshot() and all writes must be done by one writer (or under a lock),
+ * while any number of snapshots can be read and destroyed concurrently by other threads.
+ * A snapshot is never modified by the writer; do not write to the snapshot itself while
+ * other threads read it.
+ *
+ * The time complexity of functions are based on n and k
+ * n is the size of the hashtable
+ * k is the length of Key
+ * @tparam Key          key type
+ * @tparam Value        data type
+ * @tparam Hash         function object, return the hash value of a key
+ * @tparam KeyEqual     function object, return whether two keys are the same
+ */
+template<
+        typename Key, typename Value,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>
+>
+class CowHashTable {
+public:
+    typedef std::pair<const Key, Value> HashNode;
+    typedef std::forward_list<HashNode> HashNodeList;
+    static constexpr size_t CHUNK_BUCKETS = 256;        // number of buckets in a chunk
+
+protected:
+    typedef std::vector<HashNodeList> Chunk;
+    typedef std::vector<std::shared_ptr<Chunk>> Directory;
+
+public:
+    /**
+     * A single directional read-only iterator for the hashtable
+     * It is invalidated by any write to the same table (not by writes to other snapshots)
+     */
+    class ConstIterator {
+    private:
+        const CowHashTable *hashTable;
+        size_t bucket;                                  // index of the current bucket
+        typename HashNodeList::const_iterator listIt;   // current node in the bucket
+
+        /**
+         * Move to the first node of the first non-empty bucket from bucket
+         * Time Complexity: Amortized O(1)
+         */
+        void skipEmpty() {
+            while (bucket < hashTable->bucketCount) {
+                const HashNodeList &list = hashTable->bucketAt(bucket);
+                if (!list.empty()) {
+                    listIt = list.begin();
+                    return;
+                }
+                ++bucket;
+            }
+        }
+
+        ConstIterator(const CowHashTable *hashTable, size_t bucket) : hashTable(hashTable), bucket(bucket) {
+            skipEmpty();
+        }
+
+    public:
+        friend class CowHashTable;
+
+        ConstIterator() = delete;
+
+        ConstIterator(const ConstIterator &) = default;
+
+        ConstIterator &operator=(const ConstIterator &) = default;
+
+        ConstIterator &operator++() {
+            if (++listIt == hashTable->bucketAt(bucket).end()) {
+                ++bucket;
+                skipEmpty();
+            }
+            return *this;
+        }
+
+        ConstIterator operator++(int) {
+            ConstIterator temp = *this;
+            ++(*this);
+            return temp;
+        }
+
+        bool operator==(const ConstIterator &that) const {
+            if (bucket != that.bucket) return false;
+            return bucket == hashTable->bucketCount || listIt == that.listIt;
+        }
+
+        bool operator!=(const ConstIterator &that) const {
+            return !(*this == that);
+        }
+
+        const HashNode *operator->() const {
+            return &(*listIt);
+        }
+
+        const HashNode &operator*() const {
+            return *listIt;
+        }
+    };
+
+protected:                                                                  // DO NOT USE private HERE!
+    static constexpr double DEFAULT_LOAD_FACTOR = 0.5;                      // default maximum load factor is 0.5
+    static constexpr size_t DEFAULT_BUCKET_SIZE = HashPrime::g_a_sizes[0];  // default number of buckets is 5
+
+    std::shared_ptr<Directory> directory;   // chunks of buckets, shared between snapshots
+    size_t bucketCount;                     // number of buckets
+    size_t tableSize;                       // number of elements
+    double maxLoadFactor;                   // maximum load factor
+    Hash hash;                              // hash function instance
+    KeyEqual keyEqual;                      // key equal function instance
+
+    /**
+     * Whether this table is the only owner of a shared object
+     * The acquire fence orders our writes after the last reads of a snapshot released concurrently
+     */
+    template<typename T>
+    static bool isUnique(const std::shared_ptr<T> &pointer) {
+        if (pointer.use_count() != 1) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    static std::shared_ptr<Directory> makeDirectory(size_t bucketCount) {
+        auto result = std::make_shared<Directory>((bucketCount + CHUNK_BUCKETS - 1) / CHUNK_BUCKETS);
+        for (size_t i = 0; i < result->size(); i++) {
+            size_t chunkSize = std::min(CHUNK_BUCKETS, bucketCount - i * CHUNK_BUCKETS);
+            (*result)[i] = std::make_shared<Chunk>(chunkSize);
+        }
+        return result;
+    }
+
+    const HashNodeList &bucketAt(size_t bucket) const {
+        return (*(*directory)[bucket / CHUNK_BUCKETS])[bucket % CHUNK_BUCKETS];
+    }
+
+    /**
+     * Get a bucket for writing, copying the directory and the chunk first if they are shared
+     * Time Complexity: O(1) if nothing is shared, otherwise O(number of chunks + size of the chunk)
+     */
+    HashNodeList &mutableBucket(size_t bucket) {
+        if (!isUnique(directory)) {
+            directory = std::make_shared<Directory>(*directory);
+        }
+        std::shared_ptr<Chunk> &chunk = (*directory)[bucket / CHUNK_BUCKETS];
+        if (!isUnique(chunk)) {
+            chunk = std::make_shared<Chunk>(*chunk);
+        }
+        return (*chunk)[bucket % CHUNK_BUCKETS];
+    }
+
+    /**
+     * Same as HashTable::findMinimumBucketSize
+     * @throw std::range_error if no such bucket size can be found
+     */
+    size_t findMinimumBucketSize(size_t bucketSize, size_t elementCount) const {
+        size_t desired_tablesize = (size_t) ((double) elementCount / maxLoadFactor);
+        size_t lower_bound = (bucketSize > desired_tablesize) ? bucketSize : desired_tablesize;
+        int i = 0;
+        while (i < HashPrime::num_distinct_sizes_64_bit && HashPrime::g_a_sizes[i] < lower_bound) {
+            i++;
+        }
+        if (i >= HashPrime::num_distinct_sizes_64_bit) {
+            throw std::range_error("range error!");
+        }
+        return HashPrime::g_a_sizes[i];
+    }
+
+    const HashNode *findNode(const Key &key) const {
+        for (const auto &node : bucketAt(hash(key) % bucketCount)) {
+            if (keyEqual(node.first, key)) {
+                return &node;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Find the key for writing, or create it with a value constructed from args
+     * Time Complexity: Amortized O(k)
+     * @return a pair (reference of the value, whether insertion took place)
+     */
+    template<typename K, typename... Args>
+    std::pair<Value &, bool> findOrEmplace(K &&key, Args &&... args) {
+        size_t hashValue = hash(key);
+        // look up in the shared bucket first, so that a write to an existing value
+        // does not copy anything if its chunk is not shared
+        if (findNode(key) == nullptr && (double) (tableSize + 1) / (double) bucketCount > maxLoadFactor) {
+            rehash(findMinimumBucketSize(bucketCount + 1, tableSize + 1));
+        }
+        HashNodeList &list = mutableBucket(hashValue % bucketCount);
+        for (auto &node : list) {
+            if (keyEqual(node.first, key)) {
+                return {node.second, false};
+            }
+        }
+        list.emplace_front(std::piecewise_construct,
+                           std::forward_as_tuple(std::forward<K>(key)),
+                           std::forward_as_tuple(std::forward<Args>(args)...));
+        tableSize++;
+        return {list.front().second, true};
+    }
+
+public:
+    CowHashTable() :
+            directory(makeDirectory(DEFAULT_BUCKET_SIZE)), bucketCount(DEFAULT_BUCKET_SIZE), tableSize(0),
+            maxLoadFactor(DEFAULT_LOAD_FACTOR), hash(Hash()), keyEqual(KeyEqual()) {}
+
+    explicit CowHashTable(size_t bucketSize, const Hash &hash = Hash(), const KeyEqual &keyEqual = KeyEqual()) :
+            tableSize(0), maxLoadFactor(DEFAULT_LOAD_FACTOR), hash(hash), keyEqual(keyEqual) {
+        bucketCount = findMinimumBucketSize(bucketSize, 0);
+        directory = makeDirectory(bucketCount);
+    }
+
+    /**
+     * Copying shares all chunks, see snapshot
+     * Time Complexity: O(1)
+     */
+    CowHashTable(const CowHashTable &) = default;
+
+    CowHashTable &operator=(const CowHashTable &) = default;
+
+    ~CowHashTable() = default;
+
+    /**
+     * Take a frozen view of the current content
+     * Later writes to this table copy the chunks they touch and never affect the snapshot
+     * Time Complexity: O(1)
+     * @return the snapshot
+     */
+    CowHashTable snapshot() const {
+        return *this;
+    }
+
+    ConstIterator begin() const { return ConstIterator(this, 0); }
+
+    ConstIterator end() const { return ConstIterator(this, bucketCount); }
+
+    /**
+     * Time Complexity: Amortized O(k)
+     * @return whether the key exists in the hashtable
+     */
+    bool contains(const Key &key) const {
+        return findNode(key) != nullptr;
+    }
+
+    /**
+     * Find the value in hashtable by key
+     * Time Complexity: Amortized O(k)
+     * @return pointer to the value, or nullptr if the key does not exist
+     */
+    const Value *find(const Key &key) const {
+        const HashNode *node = findNode(key);
+        return node ? &node->second : nullptr;
+    }
+
+    /**
+     * Insert <key, value> into the hashtable
+     * If the key already exists, overwrite its value
+     * Time Complexity: Amortized O(k) plus the copy of a shared chunk
+     * @return whether insertion took place (return false if the key already exists)
+     */
+    template<typename V>
+    bool insert(const Key &key, V &&value) {
+        auto result = findOrEmplace(key, std::forward<V>(value));
+        if (!result.second) {
+            result.first = std::forward<V>(value);
+        }
+        return result.second;
+    }
+
+    /**
+     * Get the reference of value by key for writing, create it first if it doesn't exist
+     * The reference is invalidated by the next write to this table
+     * Time Complexity: Amortized O(k) plus the copy of a shared chunk
+     */
+    Value &operator[](const Key &key) {
+        return findOrEmplace(key).first;
+    }
+
+    /**
+     * Erase the key if it exists in the hashtable, otherwise, do nothing
+     * DO NOT rehash in this function
+     * Time Complexity: Amortized O(k) plus the copy of a shared chunk if the key exists
+     * @return whether the key exists
+     */
+    bool erase(const Key &key) {
+        if (findNode(key) == nullptr) {
+            return false;
+        }
+        HashNodeList &list = mutableBucket(hash(key) % bucketCount);
+        for (auto before = list.before_begin(), it = list.begin(); it != list.end(); before = it++) {
+            if (keyEqual(it->first, key)) {
+                list.erase_after(before);
+                tableSize--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Rehash the hashtable according to the (hinted) number of buckets
+     * Nodes of chunks owned only by this table are relinked, nodes of shared chunks are copied
+     * Time Complexity: O(nk)
+     * @param bucketSize lower bound of the new number of buckets
+     */
+    void rehash(size_t bucketSize) {
+        size_t desiredsize = findMinimumBucketSize(bucketSize, tableSize);
+        if (desiredsize == bucketCount) {
+            return;
+        }
+        std::shared_ptr<Directory> newDirectory = makeDirectory(desiredsize);
+        bool ownDirectory = isUnique(directory);
+        for (auto &chunk : *directory) {
+            bool own = ownDirectory && isUnique(chunk);
+            for (auto &list : *chunk) {
+                if (own) {
+                    while (!list.empty()) {
+                        size_t bucket = hash(list.front().first) % desiredsize;
+                        auto &target = (*(*newDirectory)[bucket / CHUNK_BUCKETS])[bucket % CHUNK_BUCKETS];
+                        target.splice_after(target.before_begin(), list, list.before_begin());
+                    }
+                } else {
+                    for (const auto &node : list) {
+                        size_t bucket = hash(node.first) % desiredsize;
+                        (*(*newDirectory)[bucket / CHUNK_BUCKETS])[bucket % CHUNK_BUCKETS].push_front(node);
+                    }
+                }
+            }
+        }
+        directory = newDirectory;
+        bucketCount = desiredsize;
+    }
+
+    /**
+     * @return the number of elements in the hashtable
+     */
+    size_t size() const { return tableSize; }
+
+    /**
+     * @return the number of buckets in the hashtable
+     */
+    size_t bucketSize() const { return bucketCount; }
+
+    /**
+     * @return the current load factor of the hashtable
+     */
+    double loadFactor() const { return (double) tableSize / (double) bucketCount; }
+
+    /**
+     * @return the maximum load factor of the hashtable
+     */
+    double getMaxLoadFactor() const { return maxLoadFactor; }
+
+    /**
+     * Set the max load factor
+     * @throw std::range_error if the load factor is too small
+     * @param loadFactor
+     */
+    void setMaxLoadFactor(double loadFactor) {
+        if (loadFactor <= 1e-9) {
+            throw std::range_error("invalid load factor!");
+        }
+        maxLoadFactor = loadFactor;
+        rehash(bucketCount);
+    }
+
+    /**
+     * @return the number of chunks shared with other snapshots (for monitoring the copy-on-write cost)
+     */
+    size_t sharedChunks() const {
+        size_t shared = 0;
+        for (const auto &chunk : *directory) {
+            if (directory.use_count() != 1 || chunk.use_count() != 1) {
+                shared++;
+            }
+        }
+        return shared;
+    }
+};
+
+#endif //VE281P2_COW_HASHTABLE_HPP
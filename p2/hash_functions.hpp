@@ -0,0 +1,211 @@
+#ifndef VE281P2_HASH_FUNCTIONS_HPP
+#define VE281P2_HASH_FUNCTIONS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Seeded hash functions that can be used as the Hash parameter of HashTable
+ * std::hash is the identity for integers in libstdc++, so sequential or strided keys
+ * cluster modulo the bucket size, and its string hash is not seeded at all.
+ * Every hash here takes a 64 bit seed; a default constructed hash uses a random
+ * per-process seed, so colliding keys can not be crafted offline.
+ * A hash is "seeded" if it has a seed() member and a constructor taking the seed,
+ * HashTable uses that to reseed itself when a bucket grows too long.
+ */
+namespace HashFunctions {
+    // the constants of wyhash (final version 4.2), public domain
+    constexpr uint64_t P0 = 0x2d358dccaa6c78a5ull;
+    constexpr uint64_t P1 = 0x8bb84b93962eacc9ull;
+    constexpr uint64_t P2 = 0x4b33a62ed433d4a3ull;
+    constexpr uint64_t P3 = 0x4d5a2da51de1aa47ull;
+
+    /**
+     * 64 x 64 -> 128 bit multiplication, folded back to 64 bits
+     */
+    inline uint64_t mix(uint64_t a, uint64_t b) {
+        __uint128_t r = (__uint128_t) a * b;
+        return (uint64_t) r ^ (uint64_t) (r >> 64);
+    }
+
+    inline uint64_t read8(const uint8_t *p) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    }
+
+    inline uint64_t read4(const uint8_t *p) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+    inline uint64_t read3(const uint8_t *p, size_t len) {
+        return ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+    }
+
+    /**
+     * wyhash of a byte string
+     * Time Complexity: O(len)
+     * @param data
+     * @param len
+     * @param seed
+     * @return the hash value
+     */
+    inline uint64_t hashBytes(const void *data, size_t len, uint64_t seed) {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        seed ^= mix(seed ^ P0, P1);
+        uint64_t a, b;
+        if (len <= 16) {
+            if (len >= 4) {
+                a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+                b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+            } else if (len > 0) {
+                a = read3(p, len);
+                b = 0;
+            } else {
+                a = b = 0;
+            }
+        } else {
+            size_t i = len;
+            if (i > 48) {
+                uint64_t see1 = seed, see2 = seed;
+                do {
+                    seed = mix(read8(p) ^ P1, read8(p + 8) ^ seed);
+                    see1 = mix(read8(p + 16) ^ P2, read8(p + 24) ^ see1);
+                    see2 = mix(read8(p + 32) ^ P3, read8(p + 40) ^ see2);
+                    p += 48;
+                    i -= 48;
+                } while (i > 48);
+                seed ^= see1 ^ see2;
+            }
+            while (i > 16) {
+                seed = mix(read8(p) ^ P1, read8(p + 8) ^ seed);
+                i -= 16;
+                p += 16;
+            }
+            a = read8(p + i - 16);
+            b = read8(p + i - 8);
+        }
+        a ^= P1;
+        b ^= seed;
+        __uint128_t r = (__uint128_t) a * b;
+        a = (uint64_t) r;
+        b = (uint64_t) (r >> 64);
+        return mix(a ^ P0 ^ len, b ^ P1);
+    }
+
+    /**
+     * Strong bijective mixer of a 64 bit integer (splitmix64 finalizer)
+     * Time Complexity: O(1)
+     */
+    inline uint64_t hashInteger(uint64_t x, uint64_t seed) {
+        x += seed + 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    /**
+     * @return a fresh random seed
+     */
+    inline uint64_t randomSeed() {
+        std::random_device device;
+        return ((uint64_t) device() << 32) ^ device();
+    }
+
+    /**
+     * @return a random seed chosen once per process
+     */
+    inline uint64_t processSeed() {
+        static const uint64_t seed = randomSeed();
+        return seed;
+    }
+}
+
+/**
+ * Seeded hash of a key, selected by key type:
+ * - integers and enums use HashFunctions::hashInteger
+ * - std::string and std::string_view use HashFunctions::hashBytes (wyhash)
+ * - other types mix the result of std::hash with the seed (only as strong as std::hash)
+ * @tparam Key key type
+ */
+template<typename Key, typename = void>
+class SeededHash {
+protected:
+    uint64_t hashSeed;
+    std::hash<Key> base;
+
+public:
+    explicit SeededHash(uint64_t seed = HashFunctions::processSeed()) : hashSeed(seed) {}
+
+    uint64_t seed() const { return hashSeed; }
+
+    size_t operator()(const Key &key) const {
+        return (size_t) HashFunctions::hashInteger((uint64_t) base(key), hashSeed);
+    }
+};
+
+template<typename Key>
+class SeededHash<Key, std::enable_if_t<std::is_integral<Key>::value || std::is_enum<Key>::value>> {
+protected:
+    uint64_t hashSeed;
+
+public:
+    explicit SeededHash(uint64_t seed = HashFunctions::processSeed()) : hashSeed(seed) {}
+
+    uint64_t seed() const { return hashSeed; }
+
+    size_t operator()(Key key) const {
+        return (size_t) HashFunctions::hashInteger((uint64_t) key, hashSeed);
+    }
+};
+
+template<typename Key>
+class SeededHash<Key, std::enable_if_t<std::is_same<Key, std::string>::value ||
+                                       std::is_same<Key, std::string_view>::value>> {
+protected:
+    uint64_t hashSeed;
+
+public:
+    explicit SeededHash(uint64_t seed = HashFunctions::processSeed()) : hashSeed(seed) {}
+
+    uint64_t seed() const { return hashSeed; }
+
+    size_t operator()(std::string_view key) const {
+        return (size_t) HashFunctions::hashBytes(key.data(), key.size(), hashSeed);
+    }
+};
+
+/**
+ * Detect whether a hash function is seeded
+ * seeded: whether it has seed() and can be constructed from a seed
+ * get: read the seed (0 if not seeded)
+ * make: build the hash function from a seed (default constructed if not seeded)
+ */
+template<typename Hash, typename = void>
+struct HashSeedTraits {
+    static constexpr bool seeded = false;
+
+    static uint64_t get(const Hash &) { return 0; }
+
+    static Hash make(uint64_t) { return Hash(); }
+};
+
+template<typename Hash>
+struct HashSeedTraits<Hash, std::void_t<decltype(std::declval<const Hash &>().seed()),
+        decltype(Hash(std::declval<uint64_t>()))>> {
+    static constexpr bool seeded = true;
+
+    static uint64_t get(const Hash &hash) { return (uint64_t) hash.seed(); }
+
+    static Hash make(uint64_t seed) { return Hash(seed); }
+};
+
+#endif //VE281P2_HASH_FUNCTIONS_HPP
@@ -1,5 +1,8 @@
 // adopted from /usr/include/c++/10.2.0/ext/pb_ds/detail/resize_policy/hash_prime_size_policy_imp.hpp
 
+#ifndef VE281P2_HASH_PRIME_HPP
+#define VE281P2_HASH_PRIME_HPP
+
 #include <utility>
 
 namespace HashPrime {
@@ -78,3 +81,5 @@ namespace HashPrime {
     };
 
 }
+
+#endif //VE281P2_HASH_PRIME_HPP
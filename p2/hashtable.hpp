@@ -1,10 +1,24 @@
+#ifndef VE281P2_HASHTABLE_HPP
+#define VE281P2_HASHTABLE_HPP
+
+#include "bloom_filter.hpp"
+#include "hash_functions.hpp"
 #include "hash_prime.hpp"
+#include "hashtable_stats.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <exception>
 #include <functional>
 #include <vector>
 #include <forward_list>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 /**
  * The Hashtable class
@@ -14,12 +28,15 @@
  * @tparam Key          key type
  * @tparam Value        data type
  * @tparam Hash         function object, return the hash value of a key
+ *                      (see hash_functions.hpp for seeded hashes, e.g. SeededHash<Key>)
  * @tparam KeyEqual     function object, return whether two keys are the same
+ * @tparam Stats        stats policy, see hashtable_stats.hpp (HashTableNoStats records nothing)
  */
 template<
         typename Key, typename Value,
         typename Hash = std::hash<Key>,
-        typename KeyEqual = std::equal_to<Key>
+        typename KeyEqual = std::equal_to<Key>,
+        typename Stats = HashTableNoStats
 >
 class HashTable {
 public:
@@ -129,15 +146,43 @@ public:
 protected:                                                                  // DO NOT USE private HERE!
     static constexpr double DEFAULT_LOAD_FACTOR = 0.5;                      // default maximum load factor is 0.5
     static constexpr size_t DEFAULT_BUCKET_SIZE = HashPrime::g_a_sizes[0];  // default number of buckets is 5
+    static constexpr size_t DEFAULT_MAX_CHAIN_LENGTH = 16;                  // reseed a seeded hash beyond this
+    static constexpr double DEFAULT_MIN_LOAD_FACTOR = 0.0;                  // automatic shrink is disabled by default
 
     HashTableData buckets;                                                  // buckets, of singly linked lists
     typename HashTableData::iterator firstBucketIt;                         // help get begin iterator in O(1) time
 
     size_t tableSize;                                                       // number of elements
     double maxLoadFactor;                                                   // maximum load factor
+    double minLoadFactor = DEFAULT_MIN_LOAD_FACTOR;                         // minimum load factor, 0 to disable
     Hash hash;                                                              // hash function instance
     KeyEqual keyEqual;                                                      // key equal function instance
 
+    /**
+     * The stats policy as a base of an always present member, so an empty policy
+     * (HashTableNoStats) is an empty base and takes no space in the table
+     */
+    struct StatsAndChainLength : Stats {
+        size_t maxChainLength = DEFAULT_MAX_CHAIN_LENGTH;                   // chain length guard, 0 to disable
+    };
+
+    static_assert(!std::is_empty_v<Stats> || sizeof(StatsAndChainLength) == sizeof(size_t),
+                  "an empty stats policy must not take space");
+
+    StatsAndChainLength stats;                                              // stats policy instance
+    size_t reseedBucketSize = 0;                                            // bucket size of the last reseed
+    BlockedBloomFilter filter;                                              // Bloom filter front of find
+    size_t filterBitsPerKey = 0;                                            // 0 if the filter is disabled
+    size_t filterStaleKeys = 0;                                             // keys erased since the last rebuild
+
+    /**
+     * Approximate layout of a node of HashNodeList, used to report memory usage
+     */
+    struct NodeLayout {
+        void *next;
+        HashNode node;
+    };
+
     /**
      * Time Complexity: O(k)
      * @param key
@@ -169,7 +214,19 @@ protected:                                                                  // D
      * @param bucketSize lower bound of the new number of buckets
      */
     size_t findMinimumBucketSize(size_t bucketSize) const {
-        size_t desired_tablesize = (size_t)((double)tableSize / maxLoadFactor); //floor (tablesize / maxLoadFactor)
+        return findMinimumBucketSize(bucketSize, tableSize);
+    }
+
+    /**
+     * Same as above, but sized for elementCount elements instead of tableSize
+     * Used to grow the table before an insertion instead of after it
+     * Time Complexity: O(1)
+     * @throw std::range_error if no such bucket size can be found
+     * @param bucketSize lower bound of the new number of buckets
+     * @param elementCount number of elements the buckets should hold
+     */
+    size_t findMinimumBucketSize(size_t bucketSize, size_t elementCount) const {
+        size_t desired_tablesize = (size_t)((double)elementCount / maxLoadFactor); //floor (elementCount / maxLoadFactor)
         size_t lower_bound = (bucketSize > desired_tablesize) ? bucketSize : desired_tablesize;
         int i = 0;
         while (HashPrime::g_a_sizes[i] < lower_bound && i < HashPrime::num_distinct_sizes_64_bit) {
@@ -186,6 +243,231 @@ protected:                                                                  // D
 
     // TODO: define your helper functions here if necessary
 
+    /**
+     * Find the key in a given bucket
+     * Same contract as find, but the caller has already hashed the key
+     * Time Complexity: O(length of the bucket)
+     * @param bucketIt the bucket the key hashes to
+     * @param key
+     * @param probes set to the number of nodes skipped (the chain length if not found)
+     * @return iterator of the key, or of the insertion place with endFlag = true
+     */
+    Iterator findInBucket(typename HashTableData::iterator bucketIt, const Key &key, size_t &probes) {
+        Iterator result(this, bucketIt, bucketIt->before_begin());
+        auto list_it = bucketIt->begin();
+        probes = 0;
+        while (list_it != bucketIt->end() && !keyEqual(list_it->first, key)) {
+            ++result.listItBefore;
+            ++list_it;
+            ++probes;
+        }
+        result.endFlag = list_it == bucketIt->end();
+        if constexpr (Stats::enabled) {
+            stats.recordLookup(!result.endFlag, result.endFlag ? probes : probes + 1);
+        }
+        return result;
+    }
+
+    Iterator findInBucket(typename HashTableData::iterator bucketIt, const Key &key) {
+        size_t probes;
+        return findInBucket(bucketIt, key, probes);
+    }
+
+    /**
+     * Rebuild the Bloom filter from all keys, sized for the capacity of the current buckets
+     * Do nothing if the filter is disabled
+     * Time Complexity: O(nk + number of buckets)
+     */
+    void rebuildFilter() {
+        if (filterBitsPerKey == 0) {
+            return;
+        }
+        size_t capacity = (size_t) ((double) buckets.size() * maxLoadFactor);
+        filter.reset(capacity > tableSize ? capacity : tableSize, filterBitsPerKey);
+        for (auto &list : buckets) {
+            for (auto &node : list) {
+                filter.add(hash(node.first));
+            }
+        }
+        filterStaleKeys = 0;
+    }
+
+    /**
+     * Move every node into a new vector of buckets by relinking it, no node is copied or reallocated
+     * Nodes are pushed to the front of their new bucket in iteration order
+     * firstBucketIt is updated, and the Bloom filter is rebuilt
+     * Time Complexity: O(nk)
+     * @param desiredsize the new number of buckets
+     */
+    void relinkNodes(size_t desiredsize) {
+        HashTableData newBuckets(desiredsize);
+        for (auto &list : buckets) {
+            while (!list.empty()) {
+                auto &target = newBuckets[hashKey(list.front().first, desiredsize)];
+                target.splice_after(target.before_begin(), list, list.before_begin());
+            }
+        }
+        this->buckets.swap(newBuckets);
+
+        this->firstBucketIt = this->buckets.end();
+        for (typename HashTableData::iterator it = this->buckets.begin(); it < this->buckets.end(); it++) {
+            if (!it->empty()) {
+                this->firstBucketIt = it;
+                break;
+            }
+        }
+        rebuildFilter();
+    }
+
+    /**
+     * The bucket size to shrink to for elementCount elements
+     * It leaves the load factor at about half of the maximum load factor,
+     * so that neither the next insertions nor the next erasures rehash again right away
+     * (with minLoadFactor < maxLoadFactor / 2 there is a gap of about 2x on both sides)
+     * Time Complexity: O(1)
+     * @param elementCount
+     * @return the new bucket size, not less than DEFAULT_BUCKET_SIZE
+     */
+    size_t shrinkBucketSize(size_t elementCount) const {
+        size_t lower_bound = (size_t) (2.0 * (double) elementCount / maxLoadFactor);
+        return findMinimumBucketSize(lower_bound > DEFAULT_BUCKET_SIZE ? lower_bound : DEFAULT_BUCKET_SIZE,
+                                     elementCount);
+    }
+
+    /**
+     * Link a staged node (the only node of staging) to the front of its bucket
+     * If the new node would exceed the maximum load factor, the table is rehashed
+     * BEFORE the node is linked, so the returned iterator is always valid
+     * If the load factor has dropped below the minimum load factor (after erasing),
+     * the table is shrunk BEFORE the node is linked as well, see shrinkBucketSize
+     * Otherwise, if the bucket already holds maxChainLength nodes and Hash is seeded,
+     * the hash is reseeded and the table is rehashed (at most once per bucket size)
+     * firstBucketIt and the Bloom filter are updated
+     * Time Complexity: Amortized O(1)
+     * The key is not hashed again unless the hash is reseeded
+     * @param bucketIt the bucket the key hashes to in the current table
+     * @param chainLength number of nodes in that bucket
+     * @param hashValue hash(key) of the new node
+     * @param staging a list holding the new node
+     * @return iterator of the new node
+     */
+    Iterator linkNode(typename HashTableData::iterator bucketIt, size_t chainLength, size_t hashValue,
+                      HashNodeList &staging) {
+        bool rehashed = false;
+        if ((double) (tableSize + 1) / (double) buckets.size() > maxLoadFactor) {
+            rehash(findMinimumBucketSize(bucketSize() + 1, tableSize + 1));
+            rehashed = true;
+        } else if ((double) (tableSize + 1) / (double) buckets.size() < minLoadFactor) {
+            size_t shrunk = shrinkBucketSize(tableSize + 1);
+            if (shrunk < buckets.size()) {
+                rehash(shrunk);
+                rehashed = true;
+            }
+        }
+        if constexpr (HashSeedTraits<Hash>::seeded) {
+            if (!rehashed && stats.maxChainLength != 0 && chainLength >= stats.maxChainLength &&
+                reseedBucketSize != buckets.size()) {
+                reseed(HashFunctions::randomSeed());
+                hashValue = hash(staging.front().first);
+                rehashed = true;
+            }
+        }
+        if (rehashed) {
+            bucketIt = buckets.begin() + hashValue % buckets.size();
+        }
+        bucketIt->splice_after(bucketIt->before_begin(), staging);
+        tableSize++;
+        if (filterBitsPerKey != 0) {
+            // erased keys stay in the filter, drop them once they outnumber the live keys
+            if (filterStaleKeys > tableSize) {
+                rebuildFilter();
+            } else {
+                filter.add(hashValue);
+            }
+        }
+
+        if (firstBucketIt == buckets.end() || bucketIt < firstBucketIt) {
+            firstBucketIt = bucketIt;
+        }
+        return Iterator(this, bucketIt, bucketIt->before_begin());
+    }
+
+    /**
+     * Construct a new node in place and link it to the front of a bucket, see linkNode
+     * Time Complexity: Amortized O(1) (plus the construction of the node)
+     * @param bucketIt the bucket the key hashes to in the current table
+     * @param chainLength number of nodes in that bucket
+     * @param hashValue hash(key) of the new node
+     * @param args arguments forwarded to the constructor of HashNode
+     * @return iterator of the new node
+     */
+    template<typename... Args>
+    Iterator emplaceInBucket(typename HashTableData::iterator bucketIt, size_t chainLength, size_t hashValue,
+                             Args &&... args) {
+        HashNodeList staging;
+        staging.emplace_front(std::forward<Args>(args)...);
+        return linkNode(bucketIt, chainLength, hashValue, staging);
+    }
+
+    /**
+     * Shared implementation of both try_emplace overloads
+     * The key is hashed exactly once (twice if the insertion reseeds the hash)
+     * Time Complexity: Amortized O(k)
+     */
+    template<typename K, typename... Args>
+    std::pair<Iterator, bool> tryEmplaceImpl(K &&key, Args &&... args) {
+        size_t hashValue = hash(key);
+        auto bucketIt = buckets.begin() + hashValue % buckets.size();
+        size_t chainLength;
+        Iterator it = findInBucket(bucketIt, key, chainLength);
+        if (!it.endFlag) {
+            return {it, false};
+        }
+        it = emplaceInBucket(bucketIt, chainLength, hashValue, std::piecewise_construct,
+                             std::forward_as_tuple(std::forward<K>(key)),
+                             std::forward_as_tuple(std::forward<Args>(args)...));
+        return {it, true};
+    }
+
+    /**
+     * Shared implementation of both insert_or_assign overloads
+     * The key is hashed exactly once (twice if the insertion reseeds the hash)
+     * Time Complexity: Amortized O(k)
+     */
+    template<typename K, typename V>
+    std::pair<Iterator, bool> insertOrAssignImpl(K &&key, V &&value) {
+        size_t hashValue = hash(key);
+        auto bucketIt = buckets.begin() + hashValue % buckets.size();
+        size_t chainLength;
+        Iterator it = findInBucket(bucketIt, key, chainLength);
+        if (!it.endFlag) {
+            it->second = std::forward<V>(value);
+            return {it, false};
+        }
+        it = emplaceInBucket(bucketIt, chainLength, hashValue, std::forward<K>(key), std::forward<V>(value));
+        return {it, true};
+    }
+
+    /**
+     * Shared implementation of both insert(it, key, value) overloads
+     * The iterator does not carry the hash of the key, so a new key is hashed once more here
+     * Time Complexity: Amortized O(k)
+     */
+    template<typename K, typename V>
+    bool insertAt(const Iterator &it, K &&key, V &&value) {
+        //else we find the key already in the list, we update the value
+        if (!it.endFlag) {
+            auto ptr = it;
+            ptr->second = std::forward<V>(value);
+            return false;
+        }
+        //If the key does not exists, we insert it at the beginning
+        //the chain length is unknown here, so the chain length guard is not checked
+        size_t hashValue = hash(key);
+        emplaceInBucket(it.bucketIt, 0, hashValue, std::forward<K>(key), std::forward<V>(value));
+        return true;
+    }
+
 
 public:
     HashTable() :
@@ -202,22 +484,47 @@ public:
         firstBucketIt = buckets.end();
     }
 
+    /**
+     * @param bucketSize lower bound of the number of buckets
+     * @param hash hash function instance, e.g. a SeededHash with a fixed seed
+     * @param keyEqual key equal function instance
+     */
+    HashTable(size_t bucketSize, const Hash &hash, const KeyEqual &keyEqual = KeyEqual()) :
+            tableSize(0), maxLoadFactor(DEFAULT_LOAD_FACTOR),
+            hash(hash), keyEqual(keyEqual) {
+        bucketSize = findMinimumBucketSize(bucketSize);
+        buckets.resize(bucketSize);
+        firstBucketIt = buckets.end();
+    }
+
     HashTable(const HashTable &that) {
         this->buckets = that.buckets;
-        this->firstBucketIt = that.firstBucketIt;
+        this->firstBucketIt = this->buckets.begin() + (that.firstBucketIt - that.buckets.begin());
         this->tableSize = that.tableSize;
         this->maxLoadFactor = that.maxLoadFactor;
+        this->minLoadFactor = that.minLoadFactor;
         this->hash = that.hash;
         this->keyEqual = that.keyEqual;
+        this->stats = that.stats;
+        this->reseedBucketSize = that.reseedBucketSize;
+        this->filter = that.filter;
+        this->filterBitsPerKey = that.filterBitsPerKey;
+        this->filterStaleKeys = that.filterStaleKeys;
     }
 
     HashTable &operator=(const HashTable &that) {
         this->buckets = that.buckets;
-        this->firstBucketIt = that.firstBucketIt;
+        this->firstBucketIt = this->buckets.begin() + (that.firstBucketIt - that.buckets.begin());
         this->tableSize = that.tableSize;
         this->maxLoadFactor = that.maxLoadFactor;
+        this->minLoadFactor = that.minLoadFactor;
         this->hash = that.hash;
         this->keyEqual = that.keyEqual;
+        this->stats = that.stats;
+        this->reseedBucketSize = that.reseedBucketSize;
+        this->filter = that.filter;
+        this->filterBitsPerKey = that.filterBitsPerKey;
+        this->filterStaleKeys = that.filterStaleKeys;
         return *this;
     };
 
@@ -248,34 +555,33 @@ public:
      * Find the value in hashtable by key
      * If the key exists, iterator points to the corresponding value, and it.endFlag = false
      * Otherwise, iterator points to the place that the key were to be inserted, and it.endFlag = true
+     * If the Bloom filter is enabled, most absent keys are rejected without reading the bucket
      * Time Complexity: Amortized O(k)
      * @param key
      * @return a pair (success, iterator of the value)
      */
     Iterator find(const Key &key) {
-        size_t hashcode = hashKey(key);
-        Iterator new_iterator(this, buckets.begin()+hashcode, (buckets.begin()+hashcode)->before_begin());
-        Iterator probe = new_iterator;
-
-        //here we should declare a list iterator, because the Iterator will ignore the end() and jump to next line, which causes problem
-        typename Iterator::ListIterator list_it = (buckets.begin()+hashcode)->begin();
-        while(list_it != (new_iterator.bucketIt)->end() && list_it->first != key) {
-            ++probe;
-            ++list_it;
+        size_t hashValue = hash(key);
+        auto bucketIt = buckets.begin() + hashValue % buckets.size();
+        if (filterBitsPerKey == 0) {
+            return findInBucket(bucketIt, key);
         }
-        
-        //if the iterator reaches the end of the linked list, the key does not exists
-        if(list_it == (new_iterator.bucketIt)->end()) {
-            new_iterator.endFlag = true;
-            return new_iterator;
+        if (!filter.mayContain(hashValue)) {
+            if constexpr (Stats::enabled) {
+                stats.recordLookup(false, 0);
+                stats.recordFilterRejection();
+            }
+            Iterator result(this, bucketIt, bucketIt->before_begin());
+            result.endFlag = true;
+            return result;
         }
-
-        //else the iterator reaches a same key
-        else {
-            new_iterator.endFlag = false;
-            new_iterator.listItBefore = probe.listItBefore;
-            return new_iterator;
+        Iterator result = findInBucket(bucketIt, key);
+        if constexpr (Stats::enabled) {
+            if (result.endFlag) {
+                stats.recordFilterFalsePositive();
+            }
         }
+        return result;
     }
 
     /**
@@ -291,30 +597,11 @@ public:
      * @return whether insertion took place (return false if the key already exists)
      */
     bool insert(const Iterator &it, const Key &key, const Value &value) {
-        //If the key does not exists, we insert it at the beginning
-        if(it.endFlag == true) {
-            (it.bucketIt)->insert_after((it.bucketIt)->before_begin(), std::pair<const Key, Value>(key, value));
-            tableSize++;
-
-            //update the firstBucketIt
-            if(it.bucketIt < firstBucketIt && !(it.bucketIt)->empty()) {
-                firstBucketIt = it.bucketIt;
-            }
-
-            //check whether the table needs to be rehashed
-            if(loadFactor() > maxLoadFactor) {
-                rehash(bucketSize()+1);
-            }
-
-            return true;
-        }
+        return insertAt(it, key, value);
+    }
 
-        //else we find the key already in the list, we update the value
-        else {
-            auto ptr = it;
-            ptr->second = value;
-            return false;
-        }
+    bool insert(const Iterator &it, Key &&key, Value &&value) {
+        return insertAt(it, std::move(key), std::move(value));
     }
 
     /**
@@ -328,7 +615,70 @@ public:
      * @return whether insertion took place (return false if the key already exists)
      */
     bool insert(const Key &key, const Value &value) {
-        return insert(find(key), key, value);
+        return insertOrAssignImpl(key, value).second;
+    }
+
+    bool insert(Key &&key, Value &&value) {
+        return insertOrAssignImpl(std::move(key), std::move(value)).second;
+    }
+
+    /**
+     * Insert <key, value> into the hashtable, or assign value if the key already exists
+     * Same as insert, but returns the iterator of the key as well
+     * Time Complexity: Amortized O(k)
+     * @param key
+     * @param value
+     * @return a pair (iterator of the key, whether insertion took place)
+     */
+    template<typename V>
+    std::pair<Iterator, bool> insert_or_assign(const Key &key, V &&value) {
+        return insertOrAssignImpl(key, std::forward<V>(value));
+    }
+
+    template<typename V>
+    std::pair<Iterator, bool> insert_or_assign(Key &&key, V &&value) {
+        return insertOrAssignImpl(std::move(key), std::forward<V>(value));
+    }
+
+    /**
+     * Insert a value constructed from args if the key does not exist
+     * If the key already exists, nothing is constructed and args are left untouched
+     * The key is hashed once (twice if the insertion reseeds the hash) and the node is constructed in place
+     * Time Complexity: Amortized O(k)
+     * @param key
+     * @param args arguments forwarded to the constructor of Value
+     * @return a pair (iterator of the key, whether insertion took place)
+     */
+    template<typename... Args>
+    std::pair<Iterator, bool> try_emplace(const Key &key, Args &&... args) {
+        return tryEmplaceImpl(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    std::pair<Iterator, bool> try_emplace(Key &&key, Args &&... args) {
+        return tryEmplaceImpl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Construct a node from args and insert it if its key does not exist
+     * The node is always constructed (the key is not known before that),
+     * then it is spliced into its bucket without any copy, or dropped if the key exists
+     * Time Complexity: Amortized O(k)
+     * @param args arguments forwarded to the constructor of HashNode
+     * @return a pair (iterator of the key, whether insertion took place)
+     */
+    template<typename... Args>
+    std::pair<Iterator, bool> emplace(Args &&... args) {
+        HashNodeList staging;
+        staging.emplace_front(std::forward<Args>(args)...);
+        size_t hashValue = hash(staging.front().first);
+        auto bucketIt = buckets.begin() + hashValue % buckets.size();
+        size_t chainLength;
+        Iterator it = findInBucket(bucketIt, staging.front().first, chainLength);
+        if (!it.endFlag) {
+            return {it, false};
+        }
+        return {linkNode(bucketIt, chainLength, hashValue, staging), true};
     }
 
     /**
@@ -364,10 +714,19 @@ public:
             return it;
         }
         else {
+            //if the victim has a successor in the same bucket, the "before" iterator of that successor
+            //becomes it.listItBefore after the erase; otherwise move on to the next non-empty bucket
             Iterator after_victim = it;
-            after_victim++;
+            auto successor = it.listItBefore;
+            ++successor;
+            if (++successor == (it.bucketIt)->end()) {
+                after_victim++;
+            }
             (it.bucketIt)->erase_after(it.listItBefore);
             tableSize--;
+            if (filterBitsPerKey != 0) {
+                filterStaleKeys++;
+            }
 
             //If the linked list is totally deleted, then we set the firstBucketIt to be the iterator after it, which starts a new line
             if(it.bucketIt->empty() && it.bucketIt == firstBucketIt) {
@@ -387,17 +746,12 @@ public:
      * @param key
      * @return reference of value
      */
-    Value &operator[](const Key &key) { 
-        Iterator result = find(key);
-
-        //If the iterator does not exists, create it and insert it
-        if(result.endFlag == true) {
-            insert(result, key, Value());
-
-            result = find(key);
-        }
+    Value &operator[](const Key &key) {
+        return tryEmplaceImpl(key).first->second;
+    }
 
-        return result->second;
+    Value &operator[](Key &&key) {
+        return tryEmplaceImpl(std::move(key)).first->second;
     }
 
     /**
@@ -418,29 +772,16 @@ public:
             return;
         }
         // std::cout<<"desiredsize: "<<desiredsize<<std::endl;
-        std::vector<HashNode> Node_list; 
-
-        for(auto &i : buckets) {
-            for(auto &j : i) {
-                Node_list.push_back(j);
-            }
+        std::chrono::steady_clock::time_point rehashStart;
+        if constexpr (Stats::enabled) {
+            rehashStart = std::chrono::steady_clock::now();
         }
-        this->buckets.clear();
-        tableSize = 0;
-
-        //resize the table
-        this->buckets.resize(desiredsize);
+        relinkNodes(desiredsize);
 
-
-        for(auto &i: Node_list) {
-            this->insert(i.first, i.second);
-        }
-
-        for (typename HashTableData::iterator it = this->buckets.begin(); it < this->buckets.end(); it++) {
-            if (!it->empty()) {
-                this->firstBucketIt = it;
-                break;
-            }
+        if constexpr (Stats::enabled) {
+            auto elapsed = std::chrono::steady_clock::now() - rehashStart;
+            stats.recordRehash(tableSize * sizeof(NodeLayout),
+                               std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
         }
         return;
     }
@@ -471,12 +812,179 @@ public:
      * @param loadFactor
      */
     void setMaxLoadFactor(double loadFactor) {
-        if (loadFactor <= 1e-9) {
+        if (loadFactor <= 1e-9 || loadFactor <= 2 * minLoadFactor) {
             throw std::range_error("invalid load factor!");
         }
         maxLoadFactor = loadFactor;
         rehash(buckets.size());
     }
 
+    /**
+     * @return the minimum load factor of the hashtable (0 if automatic shrink is disabled)
+     */
+    double getMinLoadFactor() const { return minLoadFactor; }
+
+    /**
+     * Set the min load factor
+     * When an insertion finds the load factor below it, the table is shrunk down the
+     * HashPrime sizes first, to about half of the maximum load factor (see shrinkBucketSize)
+     * erase never rehashes, call shrink_to_fit to release the buckets right away
+     * @throw std::range_error if the load factor is negative or not less than half of the maximum
+     * @param loadFactor the minimum load factor, 0 to disable automatic shrink
+     */
+    void setMinLoadFactor(double loadFactor) {
+        if (loadFactor < 0 || 2 * loadFactor >= maxLoadFactor) {
+            throw std::range_error("invalid load factor!");
+        }
+        minLoadFactor = loadFactor;
+    }
+
+    /**
+     * Rehash the hashtable to the minimum bucket size that satisfies the maximum load factor
+     * firstBucketIt should be updated
+     * Time Complexity: O(nk)
+     */
+    void shrink_to_fit() {
+        rehash(DEFAULT_BUCKET_SIZE);
+    }
+
+    /**
+     * @return the hash function instance
+     */
+    const Hash &getHash() const { return hash; }
+
+    /**
+     * Replace the hash function with a new seed and rehash all nodes (without changing the bucket size)
+     * Only available if Hash is seeded (see HashSeedTraits in hash_functions.hpp)
+     * firstBucketIt should be updated
+     * Time Complexity: O(nk)
+     * @param seed
+     */
+    void reseed(uint64_t seed) {
+        static_assert(HashSeedTraits<Hash>::seeded, "reseed requires a seeded hash function");
+        hash = HashSeedTraits<Hash>::make(seed);
+        reseedBucketSize = buckets.size();
+        relinkNodes(buckets.size());
+        if constexpr (Stats::enabled) {
+            stats.recordReseed();
+        }
+    }
+
+    /**
+     * Put a cache-line blocked Bloom filter in front of find, contains and erase
+     * An absent key is then usually rejected after reading one cache line of the filter,
+     * without the modulo or any read of buckets (see bloom_filter.hpp)
+     * The filter is updated on insertion and rebuilt on rehash; erased keys stay in it
+     * until they outnumber the live keys, then it is rebuilt on the next insertion
+     * Calling it again rebuilds the filter with the new number of bits
+     * Time Complexity: O(nk + number of buckets)
+     * @throw std::range_error if bitsPerKey is 0
+     * @param bitsPerKey bits of filter per element of capacity, 10 gives about 1% false positives
+     */
+    void enableFilter(size_t bitsPerKey = BlockedBloomFilter::DEFAULT_BITS_PER_KEY) {
+        if (bitsPerKey == 0) {
+            throw std::range_error("invalid bits per key!");
+        }
+        filterBitsPerKey = bitsPerKey;
+        rebuildFilter();
+    }
+
+    /**
+     * Drop the Bloom filter and release its memory
+     */
+    void disableFilter() {
+        filter = BlockedBloomFilter();
+        filterBitsPerKey = 0;
+        filterStaleKeys = 0;
+    }
+
+    /**
+     * @return whether the Bloom filter is enabled
+     */
+    bool filterEnabled() const { return filterBitsPerKey != 0; }
+
+    /**
+     * @return the chain length guard (0 if disabled)
+     */
+    size_t getMaxChainLength() const { return stats.maxChainLength; }
+
+    /**
+     * Set the chain length guard
+     * When an insertion finds a bucket already holding maxChainLength nodes,
+     * a seeded hash is reseeded with a random seed and the table is rehashed
+     * This is done at most once per bucket size, and never for unseeded hash functions
+     * @param length the maximum chain length, 0 to disable the guard
+     */
+    void setMaxChainLength(size_t length) { stats.maxChainLength = length; }
+
+    /**
+     * @return the stats policy instance (counters are only recorded when Stats::enabled)
+     */
+    const Stats &getStats() const { return stats; }
+
+    void resetStats() { stats.reset(); }
+
+    /**
+     * Dump the distribution of the hashtable and the recorded stats as a JSON object
+     * The chain length histogram and the memory usage are computed by scanning all buckets
+     * histogram[i] is the number of buckets holding exactly i nodes
+     * p99 is the 99th percentile chain length among non-empty buckets
+     * Time Complexity: O(n + number of buckets)
+     * @return the JSON string
+     */
+    std::string dumpStats() const {
+        std::vector<size_t> histogram(1, 0);
+        for (const auto &list : buckets) {
+            size_t length = (size_t) std::distance(list.begin(), list.end());
+            if (length >= histogram.size()) {
+                histogram.resize(length + 1, 0);
+            }
+            histogram[length]++;
+        }
+
+        size_t nonEmpty = buckets.size() - histogram[0];
+        size_t p99 = 0;
+        if (nonEmpty > 0) {
+            // smallest length such that at least 99% of the non-empty buckets are not longer
+            size_t threshold = nonEmpty - nonEmpty / 100;
+            size_t seen = 0;
+            for (size_t length = 1; length < histogram.size(); length++) {
+                seen += histogram[length];
+                if (seen >= threshold) {
+                    p99 = length;
+                    break;
+                }
+            }
+        }
+
+        size_t bucketBytes = buckets.capacity() * sizeof(HashNodeList);
+        size_t nodeBytes = tableSize * sizeof(NodeLayout);
+        size_t filterBytes = filter.bytes();
+
+        std::ostringstream out;
+        out << "{\"size\":" << tableSize
+            << ",\"buckets\":" << buckets.size()
+            << ",\"loadFactor\":" << loadFactor()
+            << ",\"maxLoadFactor\":" << maxLoadFactor
+            << ",\"chains\":{"
+            << "\"empty\":" << histogram[0]
+            << ",\"max\":" << histogram.size() - 1
+            << ",\"p99\":" << p99
+            << ",\"histogram\":[";
+        for (size_t length = 0; length < histogram.size(); length++) {
+            out << (length ? "," : "") << histogram[length];
+        }
+        out << "]},\"memory\":{"
+            << "\"bucketBytes\":" << bucketBytes
+            << ",\"nodeBytes\":" << nodeBytes
+            << ",\"filterBytes\":" << filterBytes
+            << ",\"totalBytes\":" << bucketBytes + nodeBytes + filterBytes + sizeof(*this)
+            << "}";
+        stats.writeJson(out);
+        out << "}";
+        return out.str();
+    }
+
 };
 
+#endif //VE281P2_HASHTABLE_HPP
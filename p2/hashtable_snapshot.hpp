@@ -0,0 +1,348 @@
+#ifndef VE281P2_HASHTABLE_SNAPSHOT_HPP
+#define VE281P2_HASHTABLE_SNAPSHOT_HPP
+
+#include "hash_functions.hpp"
+#include "hashtable.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * On-disk snapshot of a HashTable with trivially copyable Key and Value
+ *
+ * The image is flat and position independent (host byte order):
+ *   HashTableSnapshot::Header
+ *   uint64_t offsets[bucketCount + 1]                 (at header.offsetsOffset)
+ *   HashTableSnapshot::Entry entries[entryCount]      (at header.entriesOffset)
+ * The entries of bucket b are entries[offsets[b]] ... entries[offsets[b + 1] - 1]
+ *
+ * saveSnapshot writes an image, loadSnapshot rebuilds a mutable HashTable from it,
+ * and HashTableView maps it read-only and serves lookups without deserialization
+ */
+
+namespace HashTableSnapshot {
+    constexpr char MAGIC[8] = {'V', 'E', '2', '8', '1', 'H', 'T', '\0'};
+    constexpr uint32_t VERSION = 1;
+    constexpr uint64_t ALIGNMENT = 64;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t sizeIndex;         // index of bucketCount in HashPrime::g_a_sizes
+        uint64_t bucketCount;
+        uint64_t entryCount;
+        double maxLoadFactor;
+        uint64_t hashSeed;          // seed of the hash function, 0 if it is not seeded
+        uint64_t keySize;           // sizeof(Key), checked on open
+        uint64_t valueSize;         // sizeof(Value), checked on open
+        uint64_t entrySize;         // sizeof(Entry), checked on open
+        uint64_t offsetsOffset;     // byte offset of the offsets array
+        uint64_t entriesOffset;     // byte offset of the entries array
+        uint64_t fileSize;
+    };
+
+    template<typename Key, typename Value>
+    struct Entry {
+        Key key;
+        Value value;
+    };
+
+    inline uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+}
+
+/**
+ * Write a snapshot image of the hashtable
+ * Entries are grouped by bucket with a counting sort, the table itself is not modified
+ * The image is written next to path and renamed over it, so views that mapped the old image keep it
+ * Time Complexity: O(nk + number of buckets)
+ * @throw std::runtime_error if the file can not be written
+ * @param table
+ * @param path
+ */
+template<typename Key, typename Value, typename Hash, typename KeyEqual, typename Stats>
+void saveSnapshot(HashTable<Key, Value, Hash, KeyEqual, Stats> &table, const std::string &path) {
+    static_assert(std::is_trivially_copyable<Key>::value, "snapshot requires a trivially copyable Key");
+    static_assert(std::is_trivially_copyable<Value>::value, "snapshot requires a trivially copyable Value");
+    typedef HashTableSnapshot::Entry<Key, Value> Entry;
+
+    const size_t bucketCount = table.bucketSize();
+    const Hash &hash = table.getHash();
+
+    //count the entries of every bucket, then turn the counts into offsets
+    std::vector<uint64_t> offsets(bucketCount + 1, 0);
+    for (auto &node : table) {
+        offsets[hash(node.first) % bucketCount + 1]++;
+    }
+    for (size_t i = 1; i <= bucketCount; i++) {
+        offsets[i] += offsets[i - 1];
+    }
+    std::vector<Entry> entries(table.size());
+    std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+    for (auto &node : table) {
+        Entry &entry = entries[next[hash(node.first) % bucketCount]++];
+        std::memcpy(&entry.key, &node.first, sizeof(Key));
+        std::memcpy(&entry.value, &node.second, sizeof(Value));
+    }
+
+    HashTableSnapshot::Header header{};
+    std::memcpy(header.magic, HashTableSnapshot::MAGIC, sizeof(header.magic));
+    header.version = HashTableSnapshot::VERSION;
+    header.sizeIndex = 0;
+    while (header.sizeIndex < HashPrime::num_distinct_sizes_64_bit &&
+           HashPrime::g_a_sizes[header.sizeIndex] != bucketCount) {
+        header.sizeIndex++;
+    }
+    header.bucketCount = bucketCount;
+    header.entryCount = entries.size();
+    header.maxLoadFactor = table.getMaxLoadFactor();
+    header.hashSeed = HashSeedTraits<Hash>::get(hash);
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.entrySize = sizeof(Entry);
+    header.offsetsOffset = HashTableSnapshot::alignUp(sizeof(header), HashTableSnapshot::ALIGNMENT);
+    header.entriesOffset = HashTableSnapshot::alignUp(header.offsetsOffset + offsets.size() * sizeof(uint64_t),
+                                                      HashTableSnapshot::ALIGNMENT);
+    header.fileSize = header.entriesOffset + entries.size() * sizeof(Entry);
+
+    std::string temporary = path + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("can not open snapshot file for writing: " + path);
+    }
+    const char padding[HashTableSnapshot::ALIGNMENT] = {};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(padding, (std::streamsize) (header.offsetsOffset - sizeof(header)));
+    out.write(reinterpret_cast<const char *>(offsets.data()), (std::streamsize) (offsets.size() * sizeof(uint64_t)));
+    out.write(padding, (std::streamsize) (header.entriesOffset - header.offsetsOffset - offsets.size() * sizeof(uint64_t)));
+    out.write(reinterpret_cast<const char *>(entries.data()), (std::streamsize) (entries.size() * sizeof(Entry)));
+    out.close();
+    if (!out || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("failed to write snapshot file: " + path);
+    }
+}
+
+/**
+ * A read-only hashtable served directly from a memory mapped snapshot image
+ * Nothing is deserialized: find hashes the key and scans the entries of one bucket in the mapping
+ * The hash function must produce the same values as the one used by saveSnapshot
+ * (it is rebuilt from the seed stored in the header if it is seeded)
+ * @tparam Key          key type, trivially copyable
+ * @tparam Value        data type, trivially copyable
+ * @tparam Hash         function object, return the hash value of a key
+ * @tparam KeyEqual     function object, return whether two keys are the same
+ */
+template<
+        typename Key, typename Value,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>
+>
+class HashTableView {
+public:
+    typedef HashTableSnapshot::Entry<Key, Value> Entry;
+
+    static_assert(std::is_trivially_copyable<Key>::value, "snapshot requires a trivially copyable Key");
+    static_assert(std::is_trivially_copyable<Value>::value, "snapshot requires a trivially copyable Value");
+
+protected:
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    const HashTableSnapshot::Header *header = nullptr;
+    const uint64_t *offsets = nullptr;
+    const Entry *entries = nullptr;
+    Hash hash;
+    KeyEqual keyEqual;
+
+    void unmap() {
+        if (mapping != nullptr) {
+            munmap(mapping, mappingSize);
+        }
+        mapping = nullptr;
+        mappingSize = 0;
+        header = nullptr;
+        offsets = nullptr;
+        entries = nullptr;
+    }
+
+    /**
+     * Check that the mapped image is a valid snapshot of this Key / Value layout
+     * The offsets are scanned as well, since find trusts them to stay inside the entries
+     * Time Complexity: O(number of buckets)
+     * @throw std::runtime_error if it is not
+     */
+    void validate(const std::string &path) const {
+        if (mappingSize < sizeof(HashTableSnapshot::Header) ||
+            std::memcmp(header->magic, HashTableSnapshot::MAGIC, sizeof(header->magic)) != 0) {
+            throw std::runtime_error("not a hashtable snapshot: " + path);
+        }
+        if (header->version != HashTableSnapshot::VERSION) {
+            throw std::runtime_error("unsupported hashtable snapshot version: " + path);
+        }
+        if (header->keySize != sizeof(Key) || header->valueSize != sizeof(Value) ||
+            header->entrySize != sizeof(Entry)) {
+            throw std::runtime_error("hashtable snapshot has a different key / value layout: " + path);
+        }
+        //compare sizes by division, so that huge counts in a corrupt header can not overflow
+        if (header->bucketCount == 0 || header->fileSize != mappingSize ||
+            header->offsetsOffset % alignof(uint64_t) != 0 || header->entriesOffset % alignof(Entry) != 0 ||
+            header->offsetsOffset > header->entriesOffset || header->entriesOffset > mappingSize ||
+            header->bucketCount >= (header->entriesOffset - header->offsetsOffset) / sizeof(uint64_t) ||
+            header->entryCount > (mappingSize - header->entriesOffset) / sizeof(Entry)) {
+            throw std::runtime_error("truncated or corrupted hashtable snapshot: " + path);
+        }
+        const uint64_t *bucketOffsets = reinterpret_cast<const uint64_t *>(
+                static_cast<const char *>(mapping) + header->offsetsOffset);
+        if (bucketOffsets[0] != 0 || bucketOffsets[header->bucketCount] != header->entryCount) {
+            throw std::runtime_error("corrupted hashtable snapshot offsets: " + path);
+        }
+        for (uint64_t b = 0; b < header->bucketCount; b++) {
+            if (bucketOffsets[b] > bucketOffsets[b + 1]) {
+                throw std::runtime_error("corrupted hashtable snapshot offsets: " + path);
+            }
+        }
+    }
+
+public:
+    /**
+     * Map a snapshot image read-only
+     * Time Complexity: O(number of buckets) to validate the offsets (the entries are faulted in lazily by lookups)
+     * @throw std::runtime_error if the file can not be mapped or is not a valid snapshot
+     * @param path
+     */
+    explicit HashTableView(const std::string &path) : keyEqual(KeyEqual()) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can not open snapshot file: " + path);
+        }
+        struct stat fileStat{};
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0) {
+            close(fd);
+            throw std::runtime_error("can not stat snapshot file: " + path);
+        }
+        mappingSize = (size_t) fileStat.st_size;
+        mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            throw std::runtime_error("can not map snapshot file: " + path);
+        }
+
+        const char *base = static_cast<const char *>(mapping);
+        header = reinterpret_cast<const HashTableSnapshot::Header *>(base);
+        try {
+            validate(path);
+        } catch (...) {
+            unmap();
+            throw;
+        }
+        offsets = reinterpret_cast<const uint64_t *>(base + header->offsetsOffset);
+        entries = reinterpret_cast<const Entry *>(base + header->entriesOffset);
+        hash = HashSeedTraits<Hash>::make(header->hashSeed);
+    }
+
+    HashTableView(const HashTableView &) = delete;
+
+    HashTableView &operator=(const HashTableView &) = delete;
+
+    HashTableView(HashTableView &&that) noexcept :
+            mapping(that.mapping), mappingSize(that.mappingSize), header(that.header),
+            offsets(that.offsets), entries(that.entries), hash(std::move(that.hash)),
+            keyEqual(std::move(that.keyEqual)) {
+        that.mapping = nullptr;
+        that.unmap();
+    }
+
+    HashTableView &operator=(HashTableView &&that) noexcept {
+        if (this != &that) {
+            unmap();
+            mapping = that.mapping;
+            mappingSize = that.mappingSize;
+            header = that.header;
+            offsets = that.offsets;
+            entries = that.entries;
+            hash = std::move(that.hash);
+            keyEqual = std::move(that.keyEqual);
+            that.mapping = nullptr;
+            that.unmap();
+        }
+        return *this;
+    }
+
+    ~HashTableView() { unmap(); }
+
+    /**
+     * Find the value in the mapping by key
+     * Time Complexity: Amortized O(k)
+     * @param key
+     * @return pointer to the value inside the mapping, or nullptr if the key does not exist
+     */
+    const Value *find(const Key &key) const {
+        size_t bucket = hash(key) % header->bucketCount;
+        for (uint64_t i = offsets[bucket]; i < offsets[bucket + 1]; i++) {
+            if (keyEqual(entries[i].key, key)) {
+                return &entries[i].value;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Time Complexity: Amortized O(k)
+     * @param key
+     * @return whether the key exists in the snapshot
+     */
+    bool contains(const Key &key) const {
+        return find(key) != nullptr;
+    }
+
+    /**
+     * Entries in bucket order, for full scans of the snapshot
+     */
+    const Entry *begin() const { return entries; }
+
+    const Entry *end() const { return entries + header->entryCount; }
+
+    size_t size() const { return header->entryCount; }
+
+    size_t bucketSize() const { return header->bucketCount; }
+
+    double getMaxLoadFactor() const { return header->maxLoadFactor; }
+
+    uint64_t hashSeed() const { return header->hashSeed; }
+};
+
+/**
+ * Rebuild a mutable hashtable from a snapshot image
+ * The table is created with the bucket size and load factor of the image, so no rehash happens
+ * Time Complexity: O(nk)
+ * @throw std::runtime_error if the file is not a valid snapshot
+ * @param path
+ * @return the hashtable
+ */
+template<typename Key, typename Value, typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>, typename Stats = HashTableNoStats>
+HashTable<Key, Value, Hash, KeyEqual, Stats> loadSnapshot(const std::string &path) {
+    HashTableView<Key, Value, Hash, KeyEqual> view(path);
+    HashTable<Key, Value, Hash, KeyEqual, Stats> table(view.bucketSize(), HashSeedTraits<Hash>::make(view.hashSeed()));
+    table.setMaxLoadFactor(view.getMaxLoadFactor());
+    for (const auto &entry : view) {
+        table.try_emplace(entry.key, entry.value);
+    }
+    return table;
+}
+
+#endif //VE281P2_HASHTABLE_SNAPSHOT_HPP
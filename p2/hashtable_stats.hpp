@@ -0,0 +1,144 @@
+#ifndef VE281P2_HASHTABLE_STATS_HPP
+#define VE281P2_HASHTABLE_STATS_HPP
+
+#include <cstdint>
+#include <ostream>
+
+/**
+ * Stats policies of the HashTable class (the Stats template parameter)
+ * A policy receives callbacks from the hashtable and keeps its own counters
+ * Every callback is guarded by `if constexpr (Stats::enabled)` in the hashtable,
+ * so the default HashTableNoStats costs nothing at runtime
+ * The hashtable stores the policy as an empty base (a policy must not be final),
+ * so the empty HashTableNoStats takes no space either
+ */
+
+/**
+ * The default policy, records nothing
+ */
+struct HashTableNoStats {
+    static constexpr bool enabled = false;
+
+    void recordLookup(bool, size_t) {}
+
+    void recordRehash(size_t, uint64_t) {}
+
+    void recordReseed() {}
+
+    void recordFilterRejection() {}
+
+    void recordFilterFalsePositive() {}
+
+    void reset() {}
+
+    void writeJson(std::ostream &) const {}
+};
+
+/**
+ * Count lookups, probes and rehashes of a hashtable
+ * A probe is one key comparison in a bucket
+ * Lookups rejected by the Bloom filter (see HashTable::enableFilter) are failed lookups with 0 probes
+ */
+struct HashTableStats {
+    static constexpr bool enabled = true;
+
+    size_t successfulLookups = 0;   // lookups that found the key
+    size_t successfulProbes = 0;    // total probes of successful lookups
+    size_t failedLookups = 0;       // lookups that did not find the key
+    size_t failedProbes = 0;        // total probes of failed lookups
+    size_t rehashCount = 0;         // number of rehashes that changed the bucket size
+    uint64_t rehashNanoseconds = 0; // total time spent in rehash
+    size_t rehashBytesMoved = 0;    // total bytes of nodes relinked into new buckets
+    size_t reseedCount = 0;         // number of reseeds triggered by the chain length guard
+    size_t filterRejections = 0;    // failed lookups answered by the Bloom filter alone
+    size_t filterFalsePositives = 0; // failed lookups the Bloom filter let through to the bucket
+
+    /**
+     * Time Complexity: O(1)
+     * @param found whether the lookup found the key
+     * @param probes number of key comparisons done by the lookup
+     */
+    void recordLookup(bool found, size_t probes) {
+        if (found) {
+            successfulLookups++;
+            successfulProbes += probes;
+        } else {
+            failedLookups++;
+            failedProbes += probes;
+        }
+    }
+
+    /**
+     * Time Complexity: O(1)
+     * @param bytesMoved bytes of nodes relinked by the rehash
+     * @param nanoseconds duration of the rehash
+     */
+    void recordRehash(size_t bytesMoved, uint64_t nanoseconds) {
+        rehashCount++;
+        rehashBytesMoved += bytesMoved;
+        rehashNanoseconds += nanoseconds;
+    }
+
+    /**
+     * Time Complexity: O(1)
+     */
+    void recordReseed() {
+        reseedCount++;
+    }
+
+    /**
+     * Time Complexity: O(1)
+     */
+    void recordFilterRejection() {
+        filterRejections++;
+    }
+
+    /**
+     * Time Complexity: O(1)
+     */
+    void recordFilterFalsePositive() {
+        filterFalsePositives++;
+    }
+
+    void reset() { *this = HashTableStats(); }
+
+    double averageSuccessfulProbes() const {
+        return successfulLookups ? (double) successfulProbes / (double) successfulLookups : 0.0;
+    }
+
+    double averageFailedProbes() const {
+        return failedLookups ? (double) failedProbes / (double) failedLookups : 0.0;
+    }
+
+    /**
+     * @return the fraction of absent keys the Bloom filter did not reject
+     */
+    double filterFalsePositiveRate() const {
+        size_t negatives = filterRejections + filterFalsePositives;
+        return negatives ? (double) filterFalsePositives / (double) negatives : 0.0;
+    }
+
+    /**
+     * Write the counters as JSON members (without the enclosing braces)
+     * The output starts with a comma so it can be appended to another object
+     */
+    void writeJson(std::ostream &out) const {
+        out << ",\"lookups\":{"
+            << "\"successful\":" << successfulLookups
+            << ",\"failed\":" << failedLookups
+            << ",\"avgProbesSuccessful\":" << averageSuccessfulProbes()
+            << ",\"avgProbesFailed\":" << averageFailedProbes()
+            << "},\"rehash\":{"
+            << "\"count\":" << rehashCount
+            << ",\"totalNanoseconds\":" << rehashNanoseconds
+            << ",\"bytesMoved\":" << rehashBytesMoved
+            << ",\"reseeds\":" << reseedCount
+            << "},\"filter\":{"
+            << "\"rejections\":" << filterRejections
+            << ",\"falsePositives\":" << filterFalsePositives
+            << ",\"falsePositiveRate\":" << filterFalsePositiveRate()
+            << "}";
+    }
+};
+
+#endif //VE281P2_HASHTABLE_STATS_HPP
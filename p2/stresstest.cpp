@@ -0,0 +1,774 @@
+// Randomized differential stress test of the hashtables in this directory against std::unordered_map
+// Build: g++ -std=c++17 -O2 -o stresstest stresstest.cpp
+// Usage: ./stresstest [operations per table] [seed]
+
+#include "bounded_cache.hpp"
+#include "compact_hashtable.hpp"
+#include "cow_hashtable.hpp"
+#include "hash_functions.hpp"
+#include "hashtable.hpp"
+#include "hashtable_snapshot.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+static size_t failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { failures++; cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << endl; } } while (0)
+
+template<typename Table, typename Key, typename Value>
+void checkSame(Table &table, unordered_map<Key, Value> &reference) {
+    CHECK(table.size() == reference.size());
+    size_t count = 0;
+    for (auto &item : table) {
+        auto it = reference.find(item.first);
+        CHECK(it != reference.end() && it->second == item.second);
+        count++;
+    }
+    CHECK(count == reference.size());
+}
+
+int64_t makeKey(mt19937_64 &rng, int64_t range, int64_t) {
+    return (int64_t) (rng() % (uint64_t) range) * 7;
+}
+
+string makeKey(mt19937_64 &rng, int64_t range, string) {
+    return "key-" + to_string(rng() % (uint64_t) range);
+}
+
+/**
+ * A HashTable with the Bloom filter enabled from the start
+ */
+template<typename Key, typename Value, typename Stats = HashTableNoStats>
+struct FilteredHashTable : public HashTable<Key, Value, std::hash<Key>, std::equal_to<Key>, Stats> {
+    FilteredHashTable() { this->enableFilter(); }
+};
+
+/**
+ * Run random operations on a HashTable-like table (HashTable or CompactHashTable)
+ */
+template<typename Table, typename Key>
+void stressTable(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    Table table;
+    unordered_map<Key, uint64_t> reference;
+    size_t before = failures;
+    int64_t range = 64;
+    for (size_t step = 0; step < operations; step++) {
+        if (step % 10000 == 0) {
+            range = (int64_t) 1 << (rng() % 16 + 4);    // change the key range to grow and shrink the table
+        }
+        Key key = makeKey(rng, range, Key());
+        uint64_t value = rng();
+        switch (rng() % 12) {
+            case 0:
+            case 1:
+                CHECK(table.insert(key, value) == (reference.count(key) == 0));
+                reference[key] = value;
+                break;
+            case 2: {
+                auto result = table.try_emplace(key, value);
+                CHECK(result.second == (reference.count(key) == 0));
+                reference.emplace(key, value);
+                CHECK(result.first->second == reference[key]);
+                break;
+            }
+            case 3: {
+                auto result = table.insert_or_assign(key, value);
+                CHECK(result.second == (reference.count(key) == 0));
+                reference[key] = value;
+                break;
+            }
+            case 4:
+                table[key] += value;
+                reference[key] += value;
+                break;
+            case 5:
+            case 6:
+                CHECK(table.erase(key) == (reference.erase(key) > 0));
+                break;
+            case 7:
+            case 8: {
+                auto it = table.find(key);
+                auto expected = reference.find(key);
+                CHECK((it != table.end()) == (expected != reference.end()));
+                if (it != table.end() && expected != reference.end()) {
+                    CHECK(it->first == key && it->second == expected->second);
+                }
+                CHECK(table.contains(key) == (expected != reference.end()));
+                break;
+            }
+            case 9:
+                // erase every other element through iterators
+                if (rng() % 50 == 0) {
+                    bool erase = false;
+                    for (auto it = table.begin(); it != table.end();) {
+                        if (erase) {
+                            reference.erase(it->first);
+                            it = table.erase(it);
+                        } else {
+                            ++it;
+                        }
+                        erase = !erase;
+                    }
+                }
+                break;
+            case 10:
+                if (rng() % 100 == 0) {
+                    table.rehash((size_t) (rng() % 4096));
+                }
+                break;
+            case 11:
+                if (rng() % 200 == 0) {
+                    Table copy(table);
+                    checkSame(copy, reference);
+                    table = copy;
+                }
+                break;
+        }
+        CHECK(table.size() == reference.size());
+        if (step % 5000 == 0) {
+            checkSame(table, reference);
+        }
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    checkSame(table, reference);
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Insert and erase the same key over and over, the tombstones must not pile up
+ */
+template<typename Table, typename Key>
+void stressChurn(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    Table table;
+    size_t before = failures;
+    Key kept = makeKey(rng, 1 << 20, Key());
+    Key churned = makeKey(rng, 1 << 20, Key());
+    while (churned == kept) {
+        churned = makeKey(rng, 1 << 20, Key());
+    }
+    table.insert(kept, 1);
+    for (size_t step = 0; step < operations; step++) {
+        CHECK(table.insert(churned, step));
+        CHECK(table.erase(churned));
+    }
+    CHECK(table.size() == 1 && table.contains(kept) && !table.contains(churned));
+    CHECK(table.tombstones() <= 2 * table.bucketSize());
+    size_t count = 0;
+    for (auto &item : table) {
+        CHECK(item.first == kept);
+        count++;
+    }
+    CHECK(count == 1);
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * std::hash that counts its calls
+ */
+struct CountingHash {
+    static size_t calls;
+
+    size_t operator()(int64_t key) const {
+        calls++;
+        return std::hash<int64_t>()(key);
+    }
+};
+
+size_t CountingHash::calls = 0;
+
+/**
+ * Every insertion path of HashTable must hash the key exactly once when the table does not rehash
+ */
+void stressHashOnce(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    HashTable<int64_t, uint64_t, CountingHash> table;
+    table.enableFilter();
+    size_t before = failures;
+    size_t count = min(operations, (size_t) 10000);
+    table.rehash(4 * count);
+    size_t bucketSize = table.bucketSize();
+    for (size_t step = 0; step < count; step++) {
+        int64_t key = makeKey(rng, 1 << 20, int64_t());
+        size_t calls = CountingHash::calls;
+        switch (rng() % 5) {
+            case 0:
+                table.insert(key, step);
+                break;
+            case 1:
+                table.insert_or_assign(key, step);
+                break;
+            case 2:
+                table.try_emplace(key, step);
+                break;
+            case 3:
+                table[key] = step;
+                break;
+            default:
+                table.emplace(key, step);
+                break;
+        }
+        CHECK(CountingHash::calls == calls + 1);
+        CHECK(table.find(key) != table.end() && CountingHash::calls == calls + 2);
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    CHECK(table.bucketSize() == bucketSize);
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Insert count new keys that all fall into one bucket under the current hash and bucket size of the table
+ */
+template<typename Table>
+void insertColliding(Table &table, unordered_map<int64_t, uint64_t> &reference, size_t count, mt19937_64 &rng) {
+    size_t bucketSize = table.bucketSize();
+    size_t target = rng() % bucketSize;
+    while (count > 0) {
+        auto key = (int64_t) (rng() >> 1);
+        if (table.getHash()(key) % bucketSize != target || reference.count(key)) {
+            continue;
+        }
+        reference[key] = (uint64_t) key;
+        table.insert(key, (uint64_t) key);
+        count--;
+    }
+}
+
+/**
+ * Flood one bucket of a HashTable with a fixed seed with adversarial keys
+ * The chain length guard must reseed exactly once per bucket size and keep every key
+ */
+void stressReseed(const char *name, uint64_t seed) {
+    mt19937_64 rng(seed);
+    HashTable<int64_t, uint64_t, SeededHash<int64_t>, equal_to<int64_t>, HashTableStats> table(
+            1000, SeededHash<int64_t>(seed));
+    unordered_map<int64_t, uint64_t> reference;
+    size_t before = failures;
+    size_t bucketSize = table.bucketSize();
+    size_t flood = 3 * table.getMaxChainLength();
+
+    insertColliding(table, reference, flood, rng);
+    CHECK(table.getStats().reseedCount == 1);
+    CHECK(table.getHash().seed() != seed);
+    // the guard has fired at this bucket size, a second flood only makes a long chain
+    insertColliding(table, reference, flood, rng);
+    CHECK(table.getStats().reseedCount == 1);
+    CHECK(table.bucketSize() == bucketSize);
+    checkSame(table, reference);
+
+    table.rehash(4 * bucketSize);
+    CHECK(table.bucketSize() != bucketSize);
+    insertColliding(table, reference, flood, rng);
+    CHECK(table.getStats().reseedCount == 2);
+    insertColliding(table, reference, flood, rng);
+    CHECK(table.getStats().reseedCount == 2);
+    checkSame(table, reference);
+    for (auto &item : reference) {
+        auto it = table.find(item.first);
+        CHECK(it != table.end() && it->second == item.second);
+        CHECK(!table.contains(item.first + 1) || reference.count(item.first + 1));
+    }
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * A table that shrinks must never shrink below the bucket size its elements need
+ */
+template<typename Table>
+void checkLoad(Table &table) {
+    CHECK(table.loadFactor() <= table.getMaxLoadFactor());
+}
+
+/**
+ * Shrink a HashTable with a minimum load factor by erasing, then churn at each size
+ * The churn must rehash at most once (the first insertion may shrink), so the bucket size
+ * does not oscillate at the boundary, and shrink_to_fit must keep the contents
+ */
+void stressShrink(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    FilteredHashTable<int64_t, uint64_t, HashTableStats> table;
+    unordered_map<int64_t, uint64_t> reference;
+    vector<int64_t> keys;
+    size_t before = failures;
+    bool thrown = false;
+    try {
+        table.setMinLoadFactor(table.getMaxLoadFactor() / 2);
+    } catch (const range_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    table.setMinLoadFactor(table.getMaxLoadFactor() / 5);
+
+    auto insertKey = [&]() {
+        int64_t key = makeKey(rng, 1 << 30, int64_t());
+        if (table.insert(key, (uint64_t) key)) {
+            reference[key] = (uint64_t) key;
+            keys.push_back(key);
+        }
+    };
+    auto eraseKey = [&]() {
+        size_t i = rng() % keys.size();
+        CHECK(table.erase(keys[i]));
+        reference.erase(keys[i]);
+        keys[i] = keys.back();
+        keys.pop_back();
+    };
+
+    size_t count = max(min(operations / 4, (size_t) 50000), (size_t) 1000);
+    while (keys.size() < count) {
+        insertKey();
+    }
+    size_t largest = table.bucketSize();
+    for (size_t target = count / 2; target >= 4; target /= 2) {
+        while (keys.size() > target) {
+            eraseKey();
+        }
+        size_t bucketSize = table.bucketSize();
+        size_t rehashes = table.getStats().rehashCount;
+        for (size_t step = 0; step < 1000; step++) {
+            insertKey();
+            checkLoad(table);
+            eraseKey();
+        }
+        CHECK(table.getStats().rehashCount <= rehashes + 1);
+        CHECK(table.bucketSize() <= bucketSize);
+        checkSame(table, reference);
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    CHECK(table.bucketSize() < largest);
+
+    while (keys.size() < count / 8) {
+        insertKey();
+    }
+    for (size_t i = 0; i < count / 4; i++) {
+        eraseKey();
+        insertKey();
+    }
+    table.shrink_to_fit();
+    checkLoad(table);
+    checkSame(table, reference);
+    for (auto key : keys) {
+        CHECK(table.contains(key));
+    }
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Hold CompactHashTable iterators across insertions that grow and rebuild the index
+ * Without tombstones they must keep pointing at the same entries, in insertion order
+ */
+template<typename Key>
+void stressCompactIterators(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    CompactHashTable<Key, uint64_t> table;
+    vector<Key> order;
+    size_t before = failures;
+    size_t count = min(operations, (size_t) 100000);
+    while (order.size() < 16) {
+        Key key = makeKey(rng, 1 << 30, Key());
+        if (table.insert(key, order.size())) {
+            order.push_back(key);
+        }
+    }
+    vector<typename CompactHashTable<Key, uint64_t>::Iterator> held;
+    for (auto it = table.begin(); it != table.end(); ++it) {
+        held.push_back(it);
+    }
+    size_t bucketSize = table.bucketSize();
+    while (order.size() < count) {
+        Key key = makeKey(rng, 1 << 30, Key());
+        if (table.insert(key, order.size())) {
+            order.push_back(key);
+        }
+    }
+    CHECK(table.bucketSize() > bucketSize && table.tombstones() == 0);
+    for (size_t i = 0; i < held.size(); i++) {
+        CHECK(held[i]->first == order[i] && held[i]->second == i);
+    }
+    size_t i = held.size() - 1;
+    for (auto it = held.back(); it != table.end(); ++it, ++i) {
+        CHECK(i < order.size() && it->first == order[i]);
+    }
+    CHECK(i == order.size());
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * A straightforward model of BoundedCache in CacheCapacity::ENTRIES mode, one std::list per queue
+ * The front of a queue is the newest entry, as in BoundedCache
+ */
+template<CachePolicy Policy>
+struct CacheModel {
+    struct Entry {
+        uint64_t value;
+        uint8_t frequency = 0;
+        bool inMain = false;
+    };
+
+    size_t capacity;
+    unordered_map<int64_t, Entry> entries;
+    list<int64_t> mainQueue;
+    list<int64_t> smallQueue;
+    unordered_map<int64_t, uint64_t> ghosts;    // key -> stamp of its latest eviction
+    list<pair<int64_t, uint64_t>> ghostQueue;
+    uint64_t ghostStamp = 0;
+    CacheStats stats;
+
+    explicit CacheModel(size_t capacity) : capacity(capacity) {}
+
+    list<int64_t> &queueOf(int64_t key) {
+        return Policy == CachePolicy::S3FIFO && !entries[key].inMain ? smallQueue : mainQueue;
+    }
+
+    void moveToFront(list<int64_t> &queue, int64_t key) {
+        queue.remove(key);
+        queue.push_front(key);
+    }
+
+    void touch(int64_t key) {
+        Entry &entry = entries[key];
+        if (Policy == CachePolicy::LRU) {
+            moveToFront(mainQueue, key);
+        } else if (Policy == CachePolicy::CLOCK) {
+            entry.frequency = 1;
+        } else if (entry.frequency < 3) {
+            entry.frequency++;
+        }
+    }
+
+    void evict(list<int64_t> &queue) {
+        int64_t key = queue.back();
+        queue.pop_back();
+        entries.erase(key);
+        stats.evictions++;
+        if (Policy == CachePolicy::S3FIFO && &queue == &smallQueue) {
+            size_t ghostCapacity = capacity - capacity * 10 / 100;
+            ghosts[key] = ++ghostStamp;
+            ghostQueue.emplace_back(key, ghostStamp);
+            while (ghosts.size() > ghostCapacity || ghostQueue.size() > 2 * ghostCapacity) {
+                auto it = ghosts.find(ghostQueue.front().first);
+                if (it != ghosts.end() && it->second == ghostQueue.front().second) {
+                    ghosts.erase(it);
+                }
+                ghostQueue.pop_front();
+            }
+        }
+    }
+
+    void evictOne() {
+        while (true) {
+            bool fromSmall = !smallQueue.empty() && (smallQueue.size() * 100 >= capacity * 10 || mainQueue.empty());
+            auto &queue = fromSmall ? smallQueue : mainQueue;
+            Entry &oldest = entries[queue.back()];
+            if (Policy == CachePolicy::LRU || oldest.frequency == 0) {
+                evict(queue);
+                return;
+            }
+            if (fromSmall) {
+                oldest.frequency = 0;
+                oldest.inMain = true;
+                mainQueue.push_front(queue.back());
+            } else {
+                oldest.frequency = Policy == CachePolicy::CLOCK ? 0 : oldest.frequency - 1;
+                mainQueue.push_front(queue.back());
+            }
+            queue.pop_back();
+        }
+    }
+
+    uint64_t *get(int64_t key) {
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            stats.misses++;
+            return nullptr;
+        }
+        stats.hits++;
+        touch(key);
+        return &it->second.value;
+    }
+
+    void put(int64_t key, uint64_t value) {
+        if (entries.count(key)) {
+            entries[key].value = value;
+            touch(key);
+            return;
+        }
+        stats.insertions++;
+        while (entries.size() >= capacity) {
+            evictOne();
+        }
+        Entry &entry = entries[key];
+        entry.value = value;
+        auto ghost = ghosts.find(key);
+        if (Policy == CachePolicy::S3FIFO && ghost != ghosts.end()) {
+            ghosts.erase(ghost);
+            entry.inMain = true;
+        }
+        queueOf(key).push_front(key);
+    }
+
+    bool erase(int64_t key) {
+        if (!entries.count(key)) {
+            return false;
+        }
+        queueOf(key).remove(key);
+        entries.erase(key);
+        return true;
+    }
+};
+
+/**
+ * Sizer of the BYTES mode test, the weight of an entry is its value
+ */
+struct ValueWeight {
+    size_t operator()(const int64_t &, const uint64_t &value) const { return (size_t) value; }
+};
+
+/**
+ * Run random get / put / erase on a BoundedCache and its model
+ * After every operation the cached keys must be the same (so the same entries were evicted, in the same order),
+ * and so must the counters
+ */
+template<CachePolicy Policy>
+void stressCache(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    const size_t capacity = 50;
+    const int64_t range = 150;
+    BoundedCache<int64_t, uint64_t, Policy> cache(capacity);
+    CacheModel<Policy> model(capacity);
+    size_t before = failures;
+    size_t count = min(operations, (size_t) 50000);
+    for (size_t step = 0; step < count; step++) {
+        // a skewed key distribution, so that some keys are hit again while cached
+        auto key = (int64_t) (rng() % 2 ? rng() % (range / 5) : rng() % range);
+        switch (rng() % 10) {
+            case 0:
+                CHECK(cache.erase(key) == model.erase(key));
+                break;
+            case 1:
+            case 2:
+            case 3:
+            case 4:
+                CHECK(cache.put(key, step));
+                model.put(key, step);
+                break;
+            default: {
+                uint64_t *value = cache.get(key);
+                uint64_t *expected = model.get(key);
+                CHECK((value == nullptr) == (expected == nullptr));
+                CHECK(value == nullptr || expected == nullptr || *value == *expected);
+                break;
+            }
+        }
+        CHECK(cache.size() == model.entries.size() && cache.size() <= capacity);
+        CHECK(cache.weight() == cache.size());
+        for (int64_t i = 0; i < range; i++) {
+            CHECK(cache.contains(i) == (model.entries.count(i) > 0));
+        }
+        const CacheStats &stats = cache.getStats();
+        CHECK(stats.hits == model.stats.hits && stats.misses == model.stats.misses);
+        CHECK(stats.insertions == model.stats.insertions && stats.evictions == model.stats.evictions);
+        if (failures > before + 10) {
+            break;
+        }
+    }
+
+    // an entry heavier than the capacity is rejected and not counted as an insertion
+    BoundedCache<int64_t, uint64_t, Policy, std::hash<int64_t>, equal_to<int64_t>, ValueWeight> bytes(
+            100, CacheCapacity::BYTES);
+    CHECK(bytes.put(1, 60) && bytes.put(2, 30));
+    CHECK(!bytes.put(3, 101) && !bytes.contains(3));
+    CHECK(bytes.put(4, 40) && bytes.weight() <= 100 && bytes.contains(4));
+    CHECK(bytes.getStats().insertions == 3 && bytes.getStats().evictions >= 1);
+    CHECK(!bytes.put(4, 200) && !bytes.contains(4) && bytes.getStats().insertions == 3);
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Check a view against the reference, by lookups and by a full scan
+ */
+template<typename View, typename Key>
+void checkView(const View &view, unordered_map<Key, uint64_t> &reference) {
+    CHECK(view.size() == reference.size());
+    for (auto &item : reference) {
+        const uint64_t *found = view.find(item.first);
+        CHECK(found != nullptr && *found == item.second);
+    }
+    size_t count = 0;
+    for (auto &entry : view) {
+        CHECK(reference.count(entry.key) == 1);
+        count++;
+    }
+    CHECK(count == reference.size());
+}
+
+/**
+ * Save snapshots of a random HashTable: a view opened before the table is saved again keeps the old image,
+ * and images with corrupt bucket offsets are rejected when they are opened
+ */
+void stressSnapshot(const char *name, size_t operations, uint64_t seed) {
+    typedef HashTable<int64_t, uint64_t, SeededHash<int64_t>> Table;
+    typedef HashTableView<int64_t, uint64_t, SeededHash<int64_t>> View;
+    mt19937_64 rng(seed);
+    size_t before = failures;
+    string path = (filesystem::temp_directory_path() / ("stresstest-" + to_string(seed) + ".snapshot")).string();
+    Table table;
+    unordered_map<int64_t, uint64_t> reference;
+    for (size_t round = 0; round * 10000 < operations; round++) {
+        unordered_map<int64_t, uint64_t> saved = reference;
+        saveSnapshot(table, path);
+        View view(path);
+        checkView(view, saved);
+        for (size_t step = 0; step < 10000; step++) {
+            int64_t key = makeKey(rng, 1 << 14, int64_t());
+            if (rng() % 3 == 0) {
+                table.erase(key);
+                reference.erase(key);
+            } else {
+                table.insert_or_assign(key, step);
+                reference[key] = step;
+            }
+        }
+        saveSnapshot(table, path);
+        checkView(view, saved);
+        checkView(View(path), reference);
+        Table loaded = loadSnapshot<int64_t, uint64_t, SeededHash<int64_t>>(path);
+        checkSame(loaded, reference);
+    }
+
+    //corrupt the offsets of the last image: out of range, decreasing, and not ending at the entry count
+    HashTableSnapshot::Header header{};
+    {
+        ifstream in(path, ios::binary);
+        in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    }
+    auto corrupt = [&](uint64_t bucket, uint64_t offset) {
+        saveSnapshot(table, path);
+        fstream file(path, ios::binary | ios::in | ios::out);
+        file.seekp((streamoff) (header.offsetsOffset + bucket * sizeof(uint64_t)));
+        file.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+        file.close();
+        bool rejected = false;
+        try {
+            View view(path);
+        } catch (runtime_error &) {
+            rejected = true;
+        }
+        CHECK(rejected);
+    };
+    corrupt(header.bucketCount / 2, header.entryCount + 1000);
+    corrupt(header.bucketCount / 2, 0);
+    corrupt(0, 1);
+    corrupt(header.bucketCount, header.entryCount - 1);
+    remove(path.c_str());
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Run random operations on a CowHashTable and check that snapshots never change
+ */
+template<typename Key>
+void stressCow(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    CowHashTable<Key, uint64_t> table;
+    unordered_map<Key, uint64_t> reference;
+    vector<pair<CowHashTable<Key, uint64_t>, unordered_map<Key, uint64_t>>> snapshots;
+    size_t before = failures;
+    for (size_t step = 0; step < operations; step++) {
+        Key key = makeKey(rng, 4096, Key());
+        uint64_t value = rng();
+        switch (rng() % 5) {
+            case 0:
+                CHECK(table.insert(key, value) == (reference.count(key) == 0));
+                reference[key] = value;
+                break;
+            case 1:
+                table[key] += value;
+                reference[key] += value;
+                break;
+            case 2:
+                CHECK(table.erase(key) == (reference.erase(key) > 0));
+                break;
+            case 3: {
+                const uint64_t *found = table.find(key);
+                auto expected = reference.find(key);
+                CHECK((found != nullptr) == (expected != reference.end()));
+                if (found != nullptr && expected != reference.end()) {
+                    CHECK(*found == expected->second);
+                }
+                break;
+            }
+            case 4:
+                if (rng() % 500 == 0) {
+                    snapshots.emplace_back(table.snapshot(), reference);
+                    if (snapshots.size() > 8) {
+                        snapshots.erase(snapshots.begin());
+                    }
+                }
+                break;
+        }
+        if (step % 5000 == 0) {
+            checkSame(table, reference);
+            for (auto &snapshot : snapshots) {
+                checkSame(snapshot.first, snapshot.second);
+            }
+        }
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+int main(int argc, char *argv[]) {
+    size_t operations = argc > 1 ? (size_t) strtoull(argv[1], nullptr, 10) : 200000;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 281;
+
+    stressTable<HashTable<int64_t, uint64_t>, int64_t>("HashTable<int64>", operations, seed);
+    stressTable<HashTable<string, uint64_t>, string>("HashTable<string>", operations, seed);
+    stressTable<HashTable<int64_t, uint64_t, SeededHash<int64_t>>, int64_t>("HashTable<int64, SeededHash>", operations, seed);
+    stressTable<HashTable<string, uint64_t, SeededHash<string>, equal_to<string>, HashTableStats>, string>(
+            "HashTable<string, SeededHash, HashTableStats>", operations, seed);
+    stressTable<FilteredHashTable<int64_t, uint64_t>, int64_t>("HashTable<int64> with filter", operations, seed);
+    stressTable<FilteredHashTable<string, uint64_t, HashTableStats>, string>(
+            "HashTable<string, HashTableStats> with filter", operations, seed);
+    stressTable<CompactHashTable<int64_t, uint64_t>, int64_t>("CompactHashTable<int64>", operations, seed);
+    stressTable<CompactHashTable<string, uint64_t>, string>("CompactHashTable<string>", operations, seed);
+    stressHashOnce("HashTable hashes once", operations, seed);
+    stressReseed("HashTable reseed", seed);
+    stressShrink("HashTable shrink", operations, seed);
+    stressChurn<CompactHashTable<int64_t, uint64_t>, int64_t>("CompactHashTable<int64> churn", operations, seed);
+    stressChurn<CompactHashTable<string, uint64_t>, string>("CompactHashTable<string> churn", operations, seed);
+    stressCompactIterators<int64_t>("CompactHashTable<int64> iterators", operations, seed);
+    stressCompactIterators<string>("CompactHashTable<string> iterators", operations, seed);
+    stressCache<CachePolicy::LRU>("BoundedCache<LRU>", operations, seed);
+    stressCache<CachePolicy::CLOCK>("BoundedCache<CLOCK>", operations, seed);
+    stressCache<CachePolicy::S3FIFO>("BoundedCache<S3FIFO>", operations, seed);
+    stressSnapshot("HashTable snapshots", operations, seed);
+    stressCow<int64_t>("CowHashTable<int64>", operations, seed);
+    stressCow<string>("CowHashTable<string>", operations, seed);
+
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    return 0;
+}
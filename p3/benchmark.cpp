@@ -0,0 +1,484 @@
+// Benchmark of KDTree and its variants under several key distributions, with the query counters of KDTree::setStats
+// Build: g++ -std=c++17 -O2 -DNDEBUG -pthread -mavx2 -o benchmark benchmark.cpp
+// Usage: ./benchmark [--distributions uniform,clustered,sorted] [--queries N] [--unbalanced] [tree size ...]
+//        (default: all distributions, 10000 queries, 1000 100000 1000000, up to 100000000,
+//         which takes about 12GB for the two KDTrees, the other trees are built one at a time after them)
+//
+// The keys are three doubles in [0, 1), drawn uniformly, from 16 tight gaussian clusters, or uniformly
+// and then sorted on the first dimension, the worst insert order for a KDTree.
+// For every distribution and size it builds a tree with the vector constructor and another one by
+// inserting the keys one by one (scapegoat balanced unless --unbalanced, which is quadratic for sorted keys),
+// then reports ns/op of every operation, the shape of both trees (see KDTree::dumpStats) and, for the
+// queries, the nodes and leaves they visit and the deepest node they reach.
+// The same keys then go to StaticKDTree, BucketKDTree, PersistentKDTree, LogStructuredKDTree, MappedKDTree
+// (saved to benchmark.kdt in the working directory and removed afterwards) and VectorKDTree (as floats),
+// which report ns/op of the operations they have, without counters (-mavx2 turns on their SIMD leaf scans).
+// The output is one JSON object on stdout, so that runs can be compared by a script.
+
+#include "bucket_kdtree.hpp"
+#include "kdtree.hpp"
+#include "log_structured_kdtree.hpp"
+#include "mapped_kdtree.hpp"
+#include "persistent_kdtree.hpp"
+#include "static_kdtree.hpp"
+#include "vector_kdtree.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+typedef tuple<double, double, double> Key;
+typedef KDTree<Key, uint64_t> Tree;
+
+// ---- keys ----
+
+const char *const DISTRIBUTIONS[] = {"uniform", "clustered", "sorted"};
+
+const size_t CLUSTERS = 16;
+const double CLUSTER_DEVIATION = 0.01;
+
+/**
+ * count keys of a distribution, sorted keys are drawn like uniform ones and sorted by the caller
+ */
+vector<Key> makeKeys(const string &distribution, size_t count, mt19937_64 &rng) {
+    uniform_real_distribution<double> uniform(0, 1);
+    vector<Key> keys(count);
+    if (distribution == "clustered") {
+        vector<Key> centers(CLUSTERS);
+        for (auto &center : centers) {
+            center = Key(uniform(rng), uniform(rng), uniform(rng));
+        }
+        normal_distribution<double> offset(0, CLUSTER_DEVIATION);
+        for (auto &key : keys) {
+            const Key &center = centers[rng() % CLUSTERS];
+            key = Key(get<0>(center) + offset(rng), get<1>(center) + offset(rng), get<2>(center) + offset(rng));
+        }
+    } else {
+        for (auto &key : keys) {
+            key = Key(uniform(rng), uniform(rng), uniform(rng));
+        }
+    }
+    return keys;
+}
+
+// ---- measurement ----
+
+using Clock = chrono::steady_clock;
+
+static uint64_t sink = 0;
+
+double nanosecondsPerOp(Clock::time_point start, size_t ops) {
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+    return ops == 0 ? 0.0 : (double) elapsed / (double) ops;
+}
+
+/**
+ * @return ns per key of calls of query(i), an op is one key of a call
+ */
+template<typename Query>
+double timeCalls(size_t calls, Query &query, size_t keysPerCall = 1) {
+    auto start = Clock::now();
+    for (size_t i = 0; i < calls; i++) {
+        query(i);
+    }
+    return nanosecondsPerOp(start, calls * keysPerCall);
+}
+
+/**
+ * Time calls of query(i) and print "name":{"nsPerOp":...}, for the trees without counters
+ */
+template<typename Query>
+void measureTime(const char *name, size_t calls, Query query, size_t keysPerCall = 1) {
+    printf(",\"%s\":{\"nsPerOp\":%.1f}", name, timeCalls(calls, query, keysPerCall));
+}
+
+/**
+ * Time calls of query(i) on tree, then call them again with the counters set and print
+ * "name":{"nsPerOp":..., "queries":{...}, "maxNodesVisited":...}
+ * An op is one key of a call, maxNodesVisited is per call
+ */
+template<typename Query>
+void measure(const char *name, Tree &tree, size_t calls, Query query, size_t keysPerCall = 1) {
+    double ns = timeCalls(calls, query, keysPerCall);
+
+    KDTreeStats stats;
+    size_t maxVisited = 0;
+    tree.setStats(&stats);
+    for (size_t i = 0; i < calls; i++) {
+        size_t before = stats.nodesVisited;
+        query(i);
+        maxVisited = max(maxVisited, stats.nodesVisited - before);
+    }
+    tree.setStats(nullptr);
+
+    ostringstream counters;
+    stats.writeJson(counters);
+    printf(",\"%s\":{\"nsPerOp\":%.1f%s,\"maxNodesVisited\":%zu}", name, ns, counters.str().c_str(), maxVisited);
+}
+
+/**
+ * The keys of a run: the trees hold keys, a hit looks up keys[order[i]], a miss and the other queries use probes[i],
+ * boxes of side (and balls of radius side / 2) around a probe hold about 64 keys
+ */
+struct Workload {
+    vector<Key> keys;
+    vector<Key> probes;
+    vector<size_t> order;
+    double side = 0;
+
+    size_t queries() const { return probes.size(); }
+
+    const Key &hit(size_t i) const { return keys[order[i % keys.size()]]; }
+
+    Key lo(size_t i) const {
+        const Key &center = probes[i];
+        return Key(get<0>(center) - side / 2, get<1>(center) - side / 2, get<2>(center) - side / 2);
+    }
+
+    Key hi(size_t i) const {
+        const Key &center = probes[i];
+        return Key(get<0>(center) + side / 2, get<1>(center) + side / 2, get<2>(center) + side / 2);
+    }
+
+    vector<pair<Key, uint64_t>> pairs() const {
+        vector<pair<Key, uint64_t>> result(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            result[i] = make_pair(keys[i], (uint64_t) i);
+        }
+        return result;
+    }
+};
+
+/**
+ * The queries StaticKDTree, BucketKDTree and MappedKDTree share, as in builtQueries
+ */
+template<typename StaticTree>
+void measureStatic(StaticTree &tree, const Workload &work) {
+    size_t queries = work.queries();
+    printf(",\"builtQueries\":{\"queries\":%zu", queries);
+    measureTime("findHit", queries, [&](size_t i) {
+        sink += tree.find(work.hit(i))->second;
+    });
+    measureTime("findMiss", queries, [&](size_t i) {
+        sink += tree.find(work.probes[i]) == tree.end();
+    });
+    measureTime("nearest", queries, [&](size_t i) {
+        sink += tree.nearest(work.probes[i])->second;
+    });
+    measureTime("kNearest10", queries, [&](size_t i) {
+        sink += tree.kNearest(work.probes[i], 10).size();
+    });
+    measureTime("withinRadius", queries, [&](size_t i) {
+        sink += tree.withinRadius(work.probes[i], work.side / 2).size();
+    });
+    measureTime("rangeCount", queries, [&](size_t i) {
+        sink += tree.rangeCount(work.lo(i), work.hi(i));
+    });
+}
+
+/**
+ * findMin and findMax of StaticKDTree and MappedKDTree, inside their builtQueries
+ */
+template<typename StaticTree>
+void measureExtremes(StaticTree &tree, const Workload &work) {
+    size_t extremes = min(work.queries(), (size_t) 1000);
+    measureTime("findMin", extremes, [&](size_t i) {
+        sink += tree.findMin(i % Tree::KeySize)->second;
+    });
+    measureTime("findMax", extremes, [&](size_t i) {
+        sink += tree.findMax(i % Tree::KeySize)->second;
+    });
+}
+
+void runStatic(const Workload &work) {
+    auto start = Clock::now();
+    StaticKDTree<Key, uint64_t> tree(work.pairs());
+    printf(",\"StaticKDTree\":{\"build\":{\"nsPerOp\":%.1f}", nanosecondsPerOp(start, work.keys.size()));
+    measureStatic(tree, work);
+    measureExtremes(tree, work);
+    printf("}}");
+}
+
+void runBucket(const Workload &work) {
+    auto start = Clock::now();
+    BucketKDTree<Key, uint64_t> tree(work.pairs());
+    printf(",\"BucketKDTree\":{\"build\":{\"nsPerOp\":%.1f}", nanosecondsPerOp(start, work.keys.size()));
+    measureStatic(tree, work);
+    printf("}}");
+}
+
+void runMapped(const Workload &work) {
+    const char *path = "benchmark.kdt";
+    auto start = Clock::now();
+    MappedKDTree<Key, uint64_t>::save(work.pairs(), path);
+    printf(",\"MappedKDTree\":{\"save\":{\"nsPerOp\":%.1f}", nanosecondsPerOp(start, work.keys.size()));
+    {
+        start = Clock::now();
+        auto tree = MappedKDTree<Key, uint64_t>::open(path);
+        // open unpacks the keys, an op is one key
+        printf(",\"open\":{\"nsPerOp\":%.1f}", nanosecondsPerOp(start, work.keys.size()));
+        measureStatic(tree, work);
+        measureExtremes(tree, work);
+        printf("}");
+    }
+    remove(path);
+    printf("}");
+}
+
+void runPersistent(const Workload &work) {
+    size_t queries = work.queries();
+    auto start = Clock::now();
+    PersistentKDTree<Key, uint64_t> tree(work.pairs());
+    printf(",\"PersistentKDTree\":{\"build\":{\"nsPerOp\":%.1f}", nanosecondsPerOp(start, work.keys.size()));
+    // every query pins its own snapshot, as a reader does
+    printf(",\"builtQueries\":{\"queries\":%zu", queries);
+    measureTime("findHit", queries, [&](size_t i) {
+        sink += *tree.snapshot().find(work.hit(i));
+    });
+    measureTime("findMiss", queries, [&](size_t i) {
+        sink += tree.snapshot().find(work.probes[i]) == nullptr;
+    });
+    measureTime("nearest", queries, [&](size_t i) {
+        sink += tree.snapshot().nearest(work.probes[i])->second;
+    });
+    measureTime("rangeCount", queries, [&](size_t i) {
+        sink += tree.snapshot().rangeCount(work.lo(i), work.hi(i));
+    });
+    printf("}");
+    // the probes go in and out again, so the updates copy paths of a tree of the full size
+    measureTime("insert", queries, [&](size_t i) {
+        sink += tree.insert(work.probes[i], (uint64_t) i);
+    });
+    measureTime("erase", queries, [&](size_t i) {
+        sink += tree.erase(work.probes[i]);
+    });
+    printf("}");
+}
+
+void runLogStructured(const Workload &work) {
+    size_t size = work.keys.size();
+    size_t queries = work.queries();
+    typedef LogStructuredKDTree<Key, uint64_t> LogTree;
+    double buildNs;
+    {
+        auto start = Clock::now();
+        LogTree built(work.pairs());
+        buildNs = nanosecondsPerOp(start, size);
+    }
+    printf(",\"LogStructuredKDTree\":{\"build\":{\"nsPerOp\":%.1f}", buildNs);
+
+    LogTree tree;
+    auto start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        tree.insert(work.keys[i], (uint64_t) i);
+    }
+    printf(",\"insert\":{\"nsPerOp\":%.1f,\"levels\":%zu}", nanosecondsPerOp(start, size), tree.levelCount());
+
+    // the queries run on the inserted tree, which has the levels a tree that grew by inserts has
+    printf(",\"insertedQueries\":{\"queries\":%zu", queries);
+    measureTime("findHit", queries, [&](size_t i) {
+        sink += *tree.find(work.hit(i));
+    });
+    measureTime("findMiss", queries, [&](size_t i) {
+        sink += tree.find(work.probes[i]) == nullptr;
+    });
+    measureTime("nearest", queries, [&](size_t i) {
+        sink += tree.nearest(work.probes[i])->second;
+    });
+    measureTime("kNearest10", queries, [&](size_t i) {
+        sink += tree.kNearest(work.probes[i], 10).size();
+    });
+    measureTime("rangeCount", queries, [&](size_t i) {
+        sink += tree.rangeCount(work.lo(i), work.hi(i));
+    });
+    printf("}");
+
+    start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        tree.erase(work.keys[work.order[i]]);
+    }
+    printf(",\"erase\":{\"nsPerOp\":%.1f}}", nanosecondsPerOp(start, size));
+}
+
+/**
+ * @return the coordinates of keys, a row of KeySize floats per key
+ */
+vector<float> toFloats(const vector<Key> &keys) {
+    vector<float> result;
+    result.reserve(keys.size() * Tree::KeySize);
+    for (auto &key : keys) {
+        result.insert(result.end(), {(float) get<0>(key), (float) get<1>(key), (float) get<2>(key)});
+    }
+    return result;
+}
+
+void runVector(const Workload &work) {
+    size_t queries = work.queries();
+    vector<float> points = toFloats(work.keys);
+    vector<float> probes = toFloats(work.probes);
+    vector<uint64_t> values(work.keys.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = i;
+    }
+    auto start = Clock::now();
+    VectorKDTree<uint64_t> tree(Tree::KeySize, points, std::move(values));
+    printf(",\"VectorKDTree\":{\"build\":{\"nsPerOp\":%.1f}", nanosecondsPerOp(start, work.keys.size()));
+    printf(",\"builtQueries\":{\"queries\":%zu", queries);
+    measureTime("nearest", queries, [&](size_t i) {
+        sink += tree.nearest(probes.data() + i * Tree::KeySize)->second;
+    });
+    measureTime("kNearest10", queries, [&](size_t i) {
+        sink += tree.kNearest(probes.data() + i * Tree::KeySize, 10).size();
+    });
+    printf("}}");
+}
+
+void run(const string &distribution, size_t size, size_t queries, bool balanced, uint64_t seed, bool first) {
+    mt19937_64 rng(seed);
+    Workload work;
+    // the queries are fresh keys of the same distribution (the same clusters), in random order
+    work.keys = makeKeys(distribution, size + queries, rng);
+    work.probes.assign(work.keys.begin() + (ptrdiff_t) size, work.keys.end());
+    work.keys.resize(size);
+    if (distribution == "sorted") {
+        sort(work.keys.begin(), work.keys.end());
+    }
+    work.order.resize(size);
+    for (size_t i = 0; i < size; i++) {
+        work.order[i] = i;
+    }
+    shuffle(work.order.begin(), work.order.end(), rng);
+    // boxes that hold about 64 keys, the clustered keys fill about CLUSTERS cubes of 4 deviations
+    double volume = distribution == "clustered" ? (double) CLUSTERS * pow(4 * CLUSTER_DEVIATION, 3) : 1.0;
+    work.side = cbrt(64.0 * volume / (double) size);
+    const vector<Key> &keys = work.keys;
+    const vector<Key> &probes = work.probes;
+
+    printf("%s{\"distribution\":\"%s\",\"size\":%zu", first ? "" : ",", distribution.c_str(), size);
+
+    auto start = Clock::now();
+    Tree built(work.pairs());
+    double buildNs = nanosecondsPerOp(start, size);
+    printf(",\"build\":{\"nsPerOp\":%.1f,\"tree\":%s}", buildNs, built.dumpStats().c_str());
+
+    Tree inserted;
+    if (balanced) {
+        inserted.enableBalance();
+    }
+    start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        inserted.insert(keys[i], (uint64_t) i);
+    }
+    double insertNs = nanosecondsPerOp(start, size);
+    printf(",\"insert\":{\"nsPerOp\":%.1f,\"tree\":%s}", insertNs, inserted.dumpStats().c_str());
+
+    // the queries run on both trees, so a degenerate insert order shows up as a gap between them
+    for (Tree *tree : {&built, &inserted}) {
+        printf(",\"%s\":{\"queries\":%zu", tree == &built ? "builtQueries" : "insertedQueries", queries);
+        measure("findHit", *tree, queries, [&](size_t i) {
+            sink += tree->find(work.hit(i))->second;
+        });
+        measure("findMiss", *tree, queries, [&](size_t i) {
+            sink += tree->find(probes[i]) == tree->end();
+        });
+        size_t extremes = min(queries, (size_t) 1000);
+        measure("findMin", *tree, extremes, [&](size_t i) {
+            sink += tree->findMin(i % Tree::KeySize)->second;
+        });
+        measure("findMax", *tree, extremes, [&](size_t i) {
+            sink += tree->findMax(i % Tree::KeySize)->second;
+        });
+        measure("nearest", *tree, queries, [&](size_t i) {
+            sink += tree->nearest(probes[i])->second;
+        });
+        measure("kNearest10", *tree, queries, [&](size_t i) {
+            sink += tree->kNearest(probes[i], 10).size();
+        });
+        measure("withinRadius", *tree, queries, [&](size_t i) {
+            sink += tree->withinRadius(probes[i], work.side / 2).size();
+        });
+        measure("rangeCount", *tree, queries, [&](size_t i) {
+            sink += tree->rangeCount(work.lo(i), work.hi(i));
+        });
+        // one call answers the whole batch, in one thread while the counters are set
+        vector<Tree::Iterator> found(queries, tree->end());
+        measure("nearestBatchGrouped", *tree, 1, [&](size_t) {
+            tree->nearestBatch(probes.begin(), probes.end(), found.begin(), 0, true);
+            sink += found[0]->second;
+        }, queries);
+        printf("}");
+    }
+
+    start = Clock::now();
+    for (size_t i = 0; i < size; i++) {
+        inserted.erase(keys[work.order[i]]);
+    }
+    double eraseNs = nanosecondsPerOp(start, size);
+    printf(",\"erase\":{\"nsPerOp\":%.1f}", eraseNs);
+    built.clear();
+
+    // every other tree is built, queried and freed in turn
+    runStatic(work);
+    runBucket(work);
+    runPersistent(work);
+    runLogStructured(work);
+    runMapped(work);
+    runVector(work);
+    printf("}");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    vector<string> distributions(begin(DISTRIBUTIONS), end(DISTRIBUTIONS));
+    vector<size_t> sizes;
+    size_t queries = 10000;
+    bool balanced = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--distributions") == 0 && i + 1 < argc) {
+            distributions.clear();
+            stringstream list(argv[++i]);
+            string name;
+            while (getline(list, name, ',')) {
+                if (find(begin(DISTRIBUTIONS), end(DISTRIBUTIONS), name) == end(DISTRIBUTIONS)) {
+                    fprintf(stderr, "unknown distribution %s\n", name.c_str());
+                    return 2;
+                }
+                distributions.push_back(name);
+            }
+        } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+            queries = max((size_t) 1, (size_t) strtoull(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--unbalanced") == 0) {
+            balanced = false;
+        } else {
+            sizes.push_back((size_t) strtoull(argv[i], nullptr, 10));
+        }
+    }
+    if (sizes.empty()) {
+        sizes = {1000, 100000, 1000000};
+    }
+
+    printf("{\"benchmark\":\"KDTree\",\"dimensions\":%zu,\"balancedInsert\":%s,\"results\":[",
+           Tree::KeySize, balanced ? "true" : "false");
+    bool first = true;
+    for (size_t size : sizes) {
+        if (size == 0) {
+            continue;
+        }
+        for (auto &distribution : distributions) {
+            run(distribution, size, queries, balanced, 281, first);
+            first = false;
+        }
+    }
+    printf("]}\n");
+    return sink == 42 ? 1 : 0;
+}
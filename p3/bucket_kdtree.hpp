@@ -0,0 +1,538 @@
+#ifndef VE281P3_BUCKET_KDTREE_HPP
+#define VE281P3_BUCKET_KDTREE_HPP
+
+#include "kdtree.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Scan kernels over the structure-of-arrays leaves of BucketKDTree
+ * A leaf is count consecutive entries of k coordinate columns, columns[d][i] is dimension d of point i
+ * With AVX2 the L2 distances and box tests of float, double and int32_t columns
+ * are computed 4 points at a time in double precision; otherwise plain loops are used
+ */
+namespace BucketKernels {
+    template<typename T>
+    constexpr bool vectorizable = std::is_same<T, float>::value || std::is_same<T, double>::value ||
+                                  std::is_same<T, int32_t>::value;
+
+#if defined(__AVX2__)
+    inline __m256d load4(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+
+    inline __m256d load4(const double *p) { return _mm256_loadu_pd(p); }
+
+    inline __m256d load4(const int32_t *p) {
+        return _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    }
+#endif
+
+    /**
+     * out[i] = squared L2 distance of point i to query
+     * Time Complexity: O(k count)
+     */
+    template<typename T, size_t K>
+    void squaredDistances(const std::array<const T *, K> &columns, size_t count,
+                          const std::array<double, K> &query, double *out) {
+        size_t i = 0;
+#if defined(__AVX2__)
+        if constexpr (vectorizable<T>) {
+            for (; i + 4 <= count; i += 4) {
+                __m256d sum = _mm256_setzero_pd();
+                for (size_t d = 0; d < K; d++) {
+                    __m256d diff = _mm256_sub_pd(load4(columns[d] + i), _mm256_set1_pd(query[d]));
+                    sum = _mm256_add_pd(sum, _mm256_mul_pd(diff, diff));
+                }
+                _mm256_storeu_pd(out + i, sum);
+            }
+        }
+#endif
+        for (; i < count; i++) {
+            double sum = 0;
+            for (size_t d = 0; d < K; d++) {
+                double diff = (double) columns[d][i] - query[d];
+                sum += diff * diff;
+            }
+            out[i] = sum;
+        }
+    }
+
+    /**
+     * Call visit(i) for every point i inside the box [lo, hi] (bounds included), in order
+     * Time Complexity: O(k count)
+     */
+    template<typename T, size_t K, typename Visit>
+    void boxScan(const std::array<const T *, K> &columns, size_t count,
+                 const std::array<double, K> &lo, const std::array<double, K> &hi, Visit &&visit) {
+        size_t i = 0;
+#if defined(__AVX2__)
+        if constexpr (vectorizable<T>) {
+            for (; i + 4 <= count; i += 4) {
+                __m256d inside = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+                for (size_t d = 0; d < K; d++) {
+                    __m256d v = load4(columns[d] + i);
+                    inside = _mm256_and_pd(inside, _mm256_cmp_pd(v, _mm256_set1_pd(lo[d]), _CMP_GE_OQ));
+                    inside = _mm256_and_pd(inside, _mm256_cmp_pd(v, _mm256_set1_pd(hi[d]), _CMP_LE_OQ));
+                }
+                for (int bits = _mm256_movemask_pd(inside); bits != 0; bits &= bits - 1) {
+                    visit(i + (size_t) __builtin_ctz((unsigned) bits));
+                }
+            }
+        }
+#endif
+        for (; i < count; i++) {
+            bool inside = true;
+            for (size_t d = 0; d < K; d++) {
+                double v = (double) columns[d][i];
+                inside = inside && v >= lo[d] && v <= hi[d];
+            }
+            if (inside) {
+                visit(i);
+            }
+        }
+    }
+}
+
+/**
+ * An abstract template base of the BucketKDTree class
+ */
+template<typename Key, typename Value, size_t LeafSize = 32>
+class BucketKDTree;
+
+/**
+ * A read-only KDTree with bucketed leaves, built from key-value pairs
+ * Internal nodes only hold a splitting key and are stored implicitly in BFS order
+ * (children of node i are 2i+1 and 2i+2); every point is in a leaf of at most LeafSize points,
+ * so the tree is about log2(LeafSize) levels shallower than KDTree
+ * Leaves are consecutive ranges of one structure-of-arrays buffer (a column per dimension),
+ * node (depth d, position p) covers the points [p n / 2^d, (p + 1) n / 2^d)
+ * The points left of a split are not greater and the points right of it are not less on its dimension
+ * When all KeyTypes are the same float, double or int32_t type, leaf scans use the SIMD kernels
+ * of BucketKernels (L2 distances and box tests); otherwise every dimension is scanned by a plain loop
+ * The time complexity of functions are based on n and k
+ * n is the size of the KDTree
+ * k is the number of dimensions
+ * @typedef Key         key type
+ * @typedef Value       value type
+ * @static  KeySize     k (number of dimensions)
+ */
+template<typename ValueType, typename... KeyTypes, size_t LeafSize>
+class BucketKDTree<std::tuple<KeyTypes...>, ValueType, LeafSize> {
+public:
+    typedef std::tuple<KeyTypes...> Key;
+    typedef ValueType Value;
+    static inline constexpr size_t KeySize = std::tuple_size<Key>::value;
+    static_assert(KeySize > 0, "Can not construct KDTree with zero dimension");
+    static_assert(LeafSize > 0, "LeafSize must be positive");
+
+    typedef std::tuple_element_t<0, Key> FirstKeyType;
+    // the kernels compute in double, which is exact for these types only (not for 64 bit integers)
+    static inline constexpr bool Vectorized =
+            (std::is_same<FirstKeyType, KeyTypes>::value && ...) && BucketKernels::vectorizable<FirstKeyType>;
+
+    /**
+     * A key-value reference to a point, it has first and second like the Data of KDTree
+     * The key is rebuilt from the columns, so it is a copy
+     */
+    struct Reference {
+        Key first;
+        Value &second;
+    };
+
+    /**
+     * A forward iterator of the points in leaf order (not sorted)
+     */
+    class Iterator {
+    private:
+        BucketKDTree *tree;
+        size_t index;
+
+        struct Pointer {
+            Reference reference;
+
+            Reference *operator->() { return &reference; }
+        };
+
+        Iterator(BucketKDTree *tree, size_t index) : tree(tree), index(index) {}
+
+    public:
+        friend class BucketKDTree;
+
+        Iterator() = delete;
+
+        Iterator &operator++() {
+            ++index;
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator temp = *this;
+            ++index;
+            return temp;
+        }
+
+        bool operator==(const Iterator &that) const { return index == that.index; }
+
+        bool operator!=(const Iterator &that) const { return index != that.index; }
+
+        Reference operator*() const { return {tree->keyAt(index), tree->values[index]}; }
+
+        Pointer operator->() const { return {**this}; }
+
+        Key key() const { return tree->keyAt(index); }
+
+        Value &value() const { return tree->values[index]; }
+    };
+
+protected:
+    std::tuple<std::vector<KeyTypes>...> columns;   // coordinates, a column per dimension
+    std::vector<Value> values;                      // values, in the same order
+    std::vector<Key> splits;                        // splitting key of the internal nodes, in BFS order
+    size_t treeSize = 0;
+    size_t depth = 0;                               // number of internal levels, there are 2^depth leaves
+
+    static size_t leftChild(size_t i) { return 2 * i + 1; }
+
+    static size_t rightChild(size_t i) { return 2 * i + 2; }
+
+    /**
+     * @return the first point of node (level, position), see the class comment
+     */
+    size_t rangeBegin(size_t level, size_t position) const {
+        return (size_t) (((unsigned __int128) position * treeSize) >> level);
+    }
+
+    template<size_t... DIMS>
+    Key keyAt(size_t i, std::index_sequence<DIMS...>) const {
+        return Key(std::get<DIMS>(columns)[i]...);
+    }
+
+    Key keyAt(size_t i) const {
+        return keyAt(i, std::make_index_sequence<KeySize>());
+    }
+
+    template<size_t... DIMS>
+    std::array<const FirstKeyType *, KeySize> columnPointers(size_t begin, std::index_sequence<DIMS...>) const {
+        return {std::get<DIMS>(columns).data() + begin...};
+    }
+
+    template<size_t... DIMS>
+    static std::array<double, KeySize> toArray(const Key &key, std::index_sequence<DIMS...>) {
+        return {(double) std::get<DIMS>(key)...};
+    }
+
+    /**
+     * Partition the buffer [first, last) of node (level, position), see the class comment
+     * Time Complexity: O(kn log n)
+     */
+    template<size_t DIM, typename RandomIt>
+    void buildRange(RandomIt buffer, size_t node, size_t level, size_t position) {
+        if (level == depth) {
+            return;
+        }
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        auto first = buffer + rangeBegin(level, position);
+        auto last = buffer + rangeBegin(level, position + 1);
+        auto median = buffer + rangeBegin(level + 1, 2 * position + 1);
+        std::nth_element(first, median, last, [](const auto &a, const auto &b) {
+            return std::get<DIM>(a.first) < std::get<DIM>(b.first);
+        });
+        splits[node] = median->first;
+        buildRange<DIM_NEXT>(buffer, leftChild(node), level + 1, 2 * position);
+        buildRange<DIM_NEXT>(buffer, rightChild(node), level + 1, 2 * position + 1);
+    }
+
+    template<size_t... DIMS>
+    void appendKey(const Key &key, std::index_sequence<DIMS...>) {
+        (std::get<DIMS>(columns).push_back(std::get<DIMS>(key)), ...);
+    }
+
+    template<typename Metric, size_t... DIMS>
+    double reducedDistance(size_t i, const Key &key, std::index_sequence<DIMS...>) const {
+        double sum = 0;
+        ((sum = Metric::accumulate(sum, Metric::axis((double) std::get<DIMS>(columns)[i],
+                                                     (double) std::get<DIMS>(key)))), ...);
+        return sum;
+    }
+
+    template<size_t... DIMS>
+    bool inBox(size_t i, const Key &lo, const Key &hi, std::index_sequence<DIMS...>) const {
+        return ((!(std::get<DIMS>(columns)[i] < std::get<DIMS>(lo)) &&
+                 !(std::get<DIMS>(hi) < std::get<DIMS>(columns)[i])) && ...);
+    }
+
+    /**
+     * Scan the points [begin, end) of a leaf for the collector, see KDTree::nearestSearch
+     * Time Complexity: O(k LeafSize)
+     */
+    template<typename Metric, typename Collector>
+    void scanLeaf(const Key &key, size_t begin, size_t end, Collector &collector) const {
+        if constexpr (Vectorized && std::is_same<Metric, KDTreeL2Metric>::value) {
+            //rounded up to whole AVX2 vectors, so the compiler can see that the kernel stores stay inside
+            std::array<double, (LeafSize + 3) / 4 * 4> distances;
+            auto indices = std::make_index_sequence<KeySize>();
+            BucketKernels::squaredDistances(columnPointers(begin, indices), end - begin,
+                                            toArray(key, indices), distances.data());
+            for (size_t i = begin; i < end; i++) {
+                collector.add(distances[i - begin], i);
+            }
+        } else {
+            for (size_t i = begin; i < end; i++) {
+                collector.add(reducedDistance<Metric>(i, key, std::make_index_sequence<KeySize>()), i);
+            }
+        }
+    }
+
+    /**
+     * Branch-and-bound search for the points near key, see KDTree::nearestSearch
+     */
+    template<size_t DIM, typename Metric, typename Collector>
+    void nearestSearch(const Key &key, size_t node, size_t level, size_t position, Collector &collector) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (level == depth) {
+            scanLeaf<Metric>(key, rangeBegin(level, position), rangeBegin(level, position + 1), collector);
+            return;
+        }
+        const Key &split = splits[node];
+        bool goLeft = std::get<DIM>(key) < std::get<DIM>(split);
+        if (goLeft) {
+            nearestSearch<DIM_NEXT, Metric>(key, leftChild(node), level + 1, 2 * position, collector);
+        } else {
+            nearestSearch<DIM_NEXT, Metric>(key, rightChild(node), level + 1, 2 * position + 1, collector);
+        }
+        if (Metric::axis((double) std::get<DIM>(key), (double) std::get<DIM>(split)) <= collector.bound()) {
+            if (goLeft) {
+                nearestSearch<DIM_NEXT, Metric>(key, rightChild(node), level + 1, 2 * position + 1, collector);
+            } else {
+                nearestSearch<DIM_NEXT, Metric>(key, leftChild(node), level + 1, 2 * position, collector);
+            }
+        }
+    }
+
+    struct NearestHeap {
+        size_t k;
+        std::vector<std::pair<double, size_t>> items;
+
+        explicit NearestHeap(size_t k) : k(k) { items.reserve(k); }
+
+        double bound() const {
+            return items.size() < k ? std::numeric_limits<double>::infinity() : items.front().first;
+        }
+
+        void add(double distance, size_t index) {
+            if (items.size() < k) {
+                items.emplace_back(distance, index);
+                std::push_heap(items.begin(), items.end());
+            } else if (distance < items.front().first) {
+                std::pop_heap(items.begin(), items.end());
+                items.back() = {distance, index};
+                std::push_heap(items.begin(), items.end());
+            }
+        }
+    };
+
+    struct RadiusCollector {
+        double radius;
+        std::vector<std::pair<double, size_t>> items;
+
+        explicit RadiusCollector(double radius) : radius(radius) {}
+
+        double bound() const { return radius; }
+
+        void add(double distance, size_t index) {
+            if (distance <= radius) {
+                items.emplace_back(distance, index);
+            }
+        }
+    };
+
+    std::vector<Iterator> sortedIterators(std::vector<std::pair<double, size_t>> &items) {
+        std::sort(items.begin(), items.end());
+        std::vector<Iterator> result;
+        result.reserve(items.size());
+        for (auto &item : items) {
+            result.push_back(Iterator(this, item.second));
+        }
+        return result;
+    }
+
+    /**
+     * Visit the index of every point in the box [lo, hi] (bounds included)
+     * Time Complexity: O(k n^(1-1/k) + m), where m is the number of results
+     */
+    template<size_t DIM, typename Visit>
+    void rangeSearch(const Key &lo, const Key &hi, size_t node, size_t level, size_t position, Visit &visit) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (level == depth) {
+            size_t begin = rangeBegin(level, position);
+            size_t end = rangeBegin(level, position + 1);
+            auto indices = std::make_index_sequence<KeySize>();
+            if constexpr (Vectorized) {
+                BucketKernels::boxScan(columnPointers(begin, indices), end - begin,
+                                       toArray(lo, indices), toArray(hi, indices),
+                                       [&visit, begin](size_t i) { visit(begin + i); });
+            } else {
+                for (size_t i = begin; i < end; i++) {
+                    if (inBox(i, lo, hi, indices)) {
+                        visit(i);
+                    }
+                }
+            }
+            return;
+        }
+        const Key &split = splits[node];
+        if (!(std::get<DIM>(split) < std::get<DIM>(lo))) {
+            rangeSearch<DIM_NEXT>(lo, hi, leftChild(node), level + 1, 2 * position, visit);
+        }
+        if (!(std::get<DIM>(hi) < std::get<DIM>(split))) {
+            rangeSearch<DIM_NEXT>(lo, hi, rightChild(node), level + 1, 2 * position + 1, visit);
+        }
+    }
+
+    /**
+     * Find the point with key, both sides are searched when key is equal to a split on its dimension
+     * @return index of the point, or treeSize if not found
+     */
+    template<size_t DIM>
+    size_t find(const Key &key, size_t node, size_t level, size_t position) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (level == depth) {
+            for (size_t i = rangeBegin(level, position), end = rangeBegin(level, position + 1); i < end; i++) {
+                if (keyAt(i) == key) {
+                    return i;
+                }
+            }
+            return treeSize;
+        }
+        const Key &split = splits[node];
+        size_t found = treeSize;
+        if (!(std::get<DIM>(split) < std::get<DIM>(key))) {
+            found = find<DIM_NEXT>(key, leftChild(node), level + 1, 2 * position);
+        }
+        if (found == treeSize && !(std::get<DIM>(key) < std::get<DIM>(split))) {
+            found = find<DIM_NEXT>(key, rightChild(node), level + 1, 2 * position + 1);
+        }
+        return found;
+    }
+
+public:
+    BucketKDTree() = default;
+
+    /**
+     * Build the tree from key-value pairs
+     * If a key appears more than once, the last value wins (same as KDTree(vector))
+     * Time complexity: O(kn log n)
+     * @param v we pass by value here because v need to be modified
+     */
+    explicit BucketKDTree(std::vector<std::pair<Key, Value>> v) {
+        std::stable_sort(v.begin(), v.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        auto new_head = std::unique(v.rbegin(), v.rend(), [](const auto &a, const auto &b) {
+            return a.first == b.first;
+        });
+        v.erase(v.begin(), new_head.base());
+
+        treeSize = v.size();
+        while (((treeSize + ((size_t) 1 << depth) - 1) >> depth) > LeafSize) {   // the largest leaf is too large
+            depth++;
+        }
+        splits.resize(((size_t) 1 << depth) - 1);
+        buildRange<0>(v.begin(), 0, 0, 0);
+
+        std::apply([this](auto &... column) { (column.reserve(treeSize), ...); }, columns);
+        values.reserve(treeSize);
+        for (auto &item : v) {
+            appendKey(item.first, std::make_index_sequence<KeySize>());
+            values.push_back(std::move(item.second));
+        }
+    }
+
+    Iterator begin() { return Iterator(this, 0); }
+
+    Iterator end() { return Iterator(this, treeSize); }
+
+    /**
+     * Time Complexity: O(k (log n + LeafSize)) (more if many keys are equal to key on some dimension)
+     * @param key
+     * @return iterator of the key, or end() if not found
+     */
+    Iterator find(const Key &key) {
+        return Iterator(this, find<0>(key, 0, 0, 0));
+    }
+
+    /**
+     * Same as KDTree::nearest
+     */
+    template<typename Metric = KDTreeL2Metric>
+    Iterator nearest(const Key &key) {
+        NearestHeap heap(1);
+        nearestSearch<0, Metric>(key, 0, 0, 0, heap);
+        return heap.items.empty() ? end() : Iterator(this, heap.items.front().second);
+    }
+
+    /**
+     * Same as KDTree::kNearest
+     */
+    template<typename Metric = KDTreeL2Metric>
+    std::vector<Iterator> kNearest(const Key &key, size_t count) {
+        if (count == 0) {
+            return {};
+        }
+        NearestHeap heap(count);
+        nearestSearch<0, Metric>(key, 0, 0, 0, heap);
+        return sortedIterators(heap.items);
+    }
+
+    /**
+     * Same as KDTree::withinRadius
+     */
+    template<typename Metric = KDTreeL2Metric>
+    std::vector<Iterator> withinRadius(const Key &key, double radius) {
+        if (radius < 0) {
+            return {};
+        }
+        RadiusCollector collector(Metric::reduce(radius));
+        nearestSearch<0, Metric>(key, 0, 0, 0, collector);
+        return sortedIterators(collector.items);
+    }
+
+    /**
+     * Same as KDTree::rangeQuery, the callback takes a Reference (with first and second)
+     */
+    template<typename Callback>
+    void rangeQuery(const Key &lo, const Key &hi, Callback callback) {
+        auto visit = [this, &callback](size_t i) {
+            Reference reference{keyAt(i), values[i]};
+            callback(reference);
+        };
+        rangeSearch<0>(lo, hi, 0, 0, 0, visit);
+    }
+
+    /**
+     * Same as KDTree::rangeCount, the keys are never rebuilt from the columns
+     */
+    size_t rangeCount(const Key &lo, const Key &hi) const {
+        size_t count = 0;
+        auto visit = [&count](size_t) { count++; };
+        rangeSearch<0>(lo, hi, 0, 0, 0, visit);
+        return count;
+    }
+
+    size_t size() const { return treeSize; }
+
+    /**
+     * @return the number of internal levels, the leaves hold at most LeafSize points
+     */
+    size_t height() const { return depth; }
+};
+
+#endif //VE281P3_BUCKET_KDTREE_HPP
@@ -1,9 +1,117 @@
+#ifndef VE281P3_KDTREE_HPP
+#define VE281P3_KDTREE_HPP
+
 #include <tuple>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include<iostream>
+#include <sstream>
+
+#include "kdtree_stats.hpp"
+#include "node_pool.hpp"
+#include "worker_pool.hpp"
+
+/**
+ * Distance metrics of the nearest neighbor queries of KDTree
+ * A metric works on "reduced" distances, which are cheaper to compute and have the same order:
+ * - axis(a, b) is the reduced distance of two points that differ on one dimension only,
+ *   it is a lower bound of the reduced distance of any two points with these coordinates
+ * - accumulate(sum, term) combines the axis terms of all dimensions
+ * - reduce / expand convert between real and reduced distances
+ */
+struct KDTreeL2Metric {
+    static double axis(double a, double b) { return (a - b) * (a - b); }
+
+    static double accumulate(double sum, double term) { return sum + term; }
+
+    static double reduce(double distance) { return distance * distance; }
+
+    static double expand(double reduced) { return std::sqrt(reduced); }
+};
+
+struct KDTreeL1Metric {
+    static double axis(double a, double b) { return std::fabs(a - b); }
+
+    static double accumulate(double sum, double term) { return sum + term; }
+
+    static double reduce(double distance) { return distance; }
+
+    static double expand(double reduced) { return reduced; }
+};
+
+struct KDTreeLInfMetric {
+    static double axis(double a, double b) { return std::fabs(a - b); }
+
+    static double accumulate(double max, double term) { return term > max ? term : max; }
+
+    static double reduce(double distance) { return distance; }
+
+    static double expand(double reduced) { return reduced; }
+};
+
+/**
+ * The stack of pending subtrees of a depth-first traversal of KDTree
+ * The first InlineSize items live inside the object and only the items above them go to the heap,
+ * so a search of a balanced tree, which holds about one pending subtree per level, allocates nothing
+ * Only the part of the vector interface the traversals use is provided
+ * @tparam T a trivially destructible item, the inline items are never destroyed
+ * @tparam InlineSize number of items stored without allocation
+ */
+template<typename T, size_t InlineSize = 64>
+class KDTreeStack {
+    static_assert(std::is_trivially_destructible<T>::value, "KDTreeStack items must be trivially destructible");
+
+    // left uninitialized, an item is constructed when it is pushed
+    union Slot {
+        T item;
+
+        Slot() {}
+    };
+
+    Slot slots[InlineSize];
+    size_t count = 0;
+    std::vector<T> spilled;     // the items above InlineSize
+
+public:
+    KDTreeStack() = default;
+
+    KDTreeStack(const KDTreeStack &) = delete;
+
+    KDTreeStack &operator=(const KDTreeStack &) = delete;
+
+    bool empty() const { return count == 0; }
+
+    T &back() { return count <= InlineSize ? slots[count - 1].item : spilled.back(); }
+
+    template<typename... Args>
+    void emplace_back(Args &&... args) {
+        if (count < InlineSize) {
+            ::new(&slots[count].item) T(std::forward<Args>(args)...);
+        } else {
+            spilled.emplace_back(std::forward<Args>(args)...);
+        }
+        count++;
+    }
+
+    void push_back(const T &item) { emplace_back(item); }
+
+    void pop_back() {
+        if (count > InlineSize) {
+            spilled.pop_back();
+        }
+        count--;
+    }
+};
 
 /**
  * An abstract template base of the KDTree class
@@ -11,6 +119,9 @@
 template<typename...>
 class KDTree;
 
+template<typename...>
+class MappedKDTree;
+
 /**
  * A partial template specialization of the KDTree class
  * The time complexity of functions are based on n and k
@@ -20,6 +131,9 @@ class KDTree;
  * @typedef Value       value type
  * @typedef Data        key-value pair
  * @static  KeySize     k (number of dimensions)
+ * The queries (find, findMin, findMax, nearest, kNearest, withinRadius, rangeQuery, rangeCount and
+ * the batch versions) only read the tree, so any number of threads may run them on one tree at the
+ * same time, as long as no thread inserts, erases, rebalances or assigns to it meanwhile
  */
 template<typename ValueType, typename... KeyTypes>
 class KDTree<std::tuple<KeyTypes...>, ValueType> {
@@ -35,8 +149,15 @@ protected:
         Node *parent;
         Node *left = nullptr;
         Node *right = nullptr;
+        Key lo;     // per-dimension minimum of the keys in the subtree
+        Key hi;     // per-dimension maximum of the keys in the subtree
+        size_t size = 1;    // number of nodes in the subtree
 
-        Node(const Key &key, const Value &value, Node *parent) : data(key, value), parent(parent) {}
+        Node(const Key &key, const Value &value, Node *parent) :
+                data(key, value), parent(parent), lo(key), hi(key) {}
+
+        Node(Key &&key, Value &&value, Node *parent) :
+                data(std::move(key), std::move(value)), parent(parent), lo(data.first), hi(data.first) {}
 
         const Key &key() { return data.first; }
 
@@ -57,84 +178,69 @@ public:
 
         /**
          * Increment the iterator
-         * Time complexity: O(log n)
+         * The successor is the leftmost node of the right subtree, or the lowest ancestor whose left subtree
+         * holds the node; a full traversal crosses every edge twice, nothing is allocated
+         * Time complexity: O(1) amortized over a traversal, O(height) for one step
+         * @throw std::range_error if the iterator is end()
          */
         void increment() {
-            // TODO: implement this function
-
-            class rangeException{};
-            // If we increment a nullptr(end), throw exception
             if(this->node == nullptr) {
-                rangeException exception;
-                throw exception;
-            }
-
-            // If this node does not have the right child
-            if(this->node->right == nullptr) {
-                while(this->node->parent != nullptr && this->node->parent->left != this->node) {
-                    this->node = this->node->parent;
-                }
-                //If we find a parent such that its left child is this node, then we set the node to that parent, and we found the next
-                if(this->node->parent != nullptr && this->node->parent->left == this->node) {
-                    this->node = this->node->parent;
-                }
-
-                //Else the loop ends due to the the parent is null, then we meet the root node, return nullptr
-                else {
-                    this->node = nullptr;
-                }
+                throw std::range_error("KDTree iterator incremented past the end");
             }
 
             // If this node has a right child, go to that child, find the left most descendant
-            else {
+            if(this->node->right != nullptr) {
                 this->node = this->node->right;
                 while(this->node->left != nullptr) {
                     this->node = this->node->left;
                 }
+                return;
+            }
+
+            // Else climb while this node is a right child, the parent we stop at (if any) is the next one
+            while(this->node->parent != nullptr && this->node->parent->right == this->node) {
+                this->node = this->node->parent;
             }
+            this->node = this->node->parent;
         }
 
         /**
-         * Decrement the iterator
-         * Time complexity: O(log n)
+         * Decrement the iterator, the mirror of increment
+         * Time complexity: O(1) amortized over a traversal, O(height) for one step
+         * @throw std::range_error if the iterator is begin()
          */
         void decrement() {
-            // TODO: implement this function
-
-            class rangeException;
-            // If we decrement the nullptr, we should get the right most node
+            // If we decrement the end, we should get the right most node
             if(this->node == nullptr) {
+                if(this->tree->root == nullptr) {
+                    throw std::range_error("KDTree iterator decremented before the beginning");
+                }
                 this->node = this->tree->root;
                 while(this->node->right != nullptr) {
                     this->node = this->node->right;
                 }
+                return;
             }
 
-            else {
-                //if this node have left child, we find the right most node of the left child
-                if(this->node->left != nullptr) {
-                    this->node = this->node->left;
-                    while(node->right != nullptr) {
-                        this->node = this->node->right;
-                    }
+            //if this node have left child, we find the right most node of the left child
+            if(this->node->left != nullptr) {
+                this->node = this->node->left;
+                while(this->node->right != nullptr) {
+                    this->node = this->node->right;
                 }
+                return;
+            }
 
-                //if this node does not have left child, then we fidn the parent such that it is in the parent's right subtree
-                else {
-                    while(this->node->parent != nullptr && this->node->parent->right != this->node) {
-                        this->node = this->node->parent;
-                    }
-
-                    if(this->node->parent->right == this->node) {
-                        this->node = this->node->parent;
-                    }
-                    //else this node is the left most node 
-                    else {
-                        rangeException exception;
-                        throw exception;
-                    }
-                }
+            //else climb while this node is a left child, the parent we stop at is the previous one
+            Node *current = this->node;
+            while(current->parent != nullptr && current->parent->left == current) {
+                current = current->parent;
+            }
+            //this node is the left most node
+            if(current->parent == nullptr) {
+                throw std::range_error("KDTree iterator decremented before the beginning");
             }
+            this->node = current->parent;
         }
 
     public:
@@ -186,88 +292,133 @@ public:
     };
 
 protected:                      // DO NOT USE private HERE!
+    static constexpr size_t BUILD_GRAIN_SIZE = 1 << 14;    // subtrees smaller than this are built by one thread
+    static constexpr size_t BATCH_GRAIN_SIZE = 256;         // queries a batch worker claims at a time
+    static constexpr size_t BATCH_GROUP_DEPTH = 16;         // levels of the tree the grouped batches sort by
+public:
+    static constexpr double DEFAULT_BALANCE_ALPHA = 0.7;
+protected:
+
+    NodePool<Node> pool;        // storage of the nodes
     Node *root = nullptr;       // root of the tree
     size_t treeSize = 0;        // size of the tree
+    double balanceAlpha = 0;    // weight-balance bound of the subtrees, 0 if balancing is disabled
+    double balanceDepthScale = 0;   // 1 / log(1 / balanceAlpha)
+    size_t maxTreeSize = 0;     // largest size since the whole tree was last rebuilt
+    KDTreeStats *stats = nullptr;   // counters the queries add to, nullptr if not instrumented
 
     /**
-     * Find the node with key
-     * Time Complexity: O(k log n)
-     * @tparam DIM current dimension of node
-     * @param key
-     * @param node
-     * @return the node with key, or nullptr if not found
+     * Count a visit of node at depth in visits, if not nullptr
      */
-    template<size_t DIM>
-    Node *find(const Key &key, Node *node) {
-        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
-        // TODO: implement this function
-        if(node == nullptr) {
-            return nullptr;
+    static void record(KDTreeStats *visits, Node *node, size_t depth) {
+        if (visits != nullptr) {
+            visits->recordVisit(node->left == nullptr && node->right == nullptr, depth);
         }
+    }
 
-        //if the current node has exactly the same key on all dimensions, then we are done
-        if(this->isEqualKey(node->key(), key)) {
-            return node;
+    void countQuery() {
+        if (stats != nullptr) {
+            stats->recordQuery();
         }
+    }
 
-        //else we need to check the next layer
-        if(this->compareKey_DIM<DIM>(key, node->key())) {
-            return find<DIM_NEXT>(key, node->left);
+    /**
+     * nearestSearch of a public query, counted if there are stats
+     */
+    template<typename Metric, typename Collector>
+    void countedNearestSearch(const Key &key, Collector &collector) {
+        if (stats != nullptr) {
+            stats->recordQuery();
+            nearestSearch<Metric, true>(key, collector);
+        } else {
+            nearestSearch<Metric>(key, collector);
         }
-        else {
-            return find<DIM_NEXT>(key, node->right);
+    }
+
+    /**
+     * Find the node with key, walking down from the root
+     * Time Complexity: O(k log n)
+     * @param key
+     * @param dim set to the splitting dimension of the node found
+     * @param visits counts the nodes on the path, if not nullptr
+     * @return the node with key, or nullptr if not found
+     */
+    Node *find(const Key &key, size_t &dim, KDTreeStats *visits = nullptr) {
+        Node *node = root;
+        dim = 0;
+        //if the current node has exactly the same key on all dimensions, then we are done
+        //else we need to check the next layer
+        for(size_t depth = 0; node != nullptr; depth++) {
+            record(visits, node, depth);
+            if(this->isEqualKey(node->key(), key)) {
+                break;
+            }
+            node = this->compareKey_dim(dim, key, node->key()) ? node->left : node->right;
+            dim = nextDim(dim);
         }
+        return node;
     }
 
     /**
      * Insert the key-value pair, if the key already exists, replace the value only
-     * Time Complexity: O(k log n)
-     * @tparam DIM current dimension of node
+     * The new node is linked at the end of the search path, which is then walked back up through
+     * the parent pointers to count it in the subtree sizes
+     * With balancing enabled, if the new node is deeper than log_{1 / alpha} n, the lowest ancestor it is
+     * too deep for (deeper than log_{1 / alpha} of the ancestor's size below it, one always exists then)
+     * is rebuilt as the scapegoat
+     * Time Complexity: O(k log n), amortized O(k log^2 n) with balancing
      * @param key
      * @param value
-     * @param node
-     * @param parent
      * @return whether insertion took place (return false if the key already exists)
      */
-    template<size_t DIM>
-    bool insert(const Key &key, const Value &value, Node *&node, Node *parent) {
-        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
-        // TODO: implement this function
-        if(node == nullptr) {
-            node = new Node(key, value, parent);
+    bool insertNode(const Key &key, const Value &value) {
+        Node *parent = nullptr;
+        Node **link = &root;
+        size_t dim = 0;
+        size_t depth = 0;
+        while(*link != nullptr) {
+            Node *node = *link;
+            //the key will be in this subtree, whether it is new or not
+            expandBox(node, key, key);
 
-            //update the treesize
-            this->treeSize ++;
-            return true;
-        }
-        else {
-            //if the key is equal in all dimension, then we change the value by replacing the node
+            //if the key is equal in all dimension, then we change the value in place
             if(this->isEqualKey(node->key(), key)) {
-                //create a new node with given information
-                Node * new_node = new Node(key, value, parent);
-
-                //get the original pointers copied
-                new_node->left = node->left;
-                new_node->right = node->right;
-                if(node->left != nullptr) {
-                    new_node->left->parent = new_node;
-                }
-                if(node->right != nullptr) {
-                    new_node->right->parent = new_node;
-                }
-                delete node;
-                node = new_node;
-                
+                node->value() = value;
                 return false;
             }
-
-            if(this->compareKey_DIM<DIM>(key, node->key())) {
-                return insert<DIM_NEXT>(key, value, node->left, node);
-            }
-            else {
-                return insert<DIM_NEXT>(key, value, node->right, node);
+            parent = node;
+            link = this->compareKey_dim(dim, key, node->key()) ? &node->left : &node->right;
+            dim = nextDim(dim);
+            depth++;
+        }
+        *link = pool.create(key, value, parent);
+
+        //update the treesize
+        this->treeSize ++;
+        size_t newDepth = depth;
+        bool tooDeep = balanceAlpha > 0 && newDepth > balancedDepth(treeSize);
+        for(Node *node = parent; node != nullptr; node = node->parent) {
+            depth--;
+            dim = dim == 0 ? KeySize - 1 : dim - 1;
+            node->size++;
+            if(tooDeep && newDepth - depth > balancedDepth(node->size)) {
+                Node *&slot = childLink(node);
+                rebuildDynamic<0>(slot, dim);
+                node = slot;
+                tooDeep = false;
             }
         }
+        return true;
+    }
+
+    /**
+     * @return the pointer that links node into the tree, its parent's child pointer or root
+     */
+    Node *&childLink(Node *node) {
+        if(node->parent == nullptr) {
+            return root;
+        }
+        return node->parent->left == node ? node->parent->left : node->parent->right;
     }
 
     /**
@@ -307,205 +458,663 @@ protected:                      // DO NOT USE private HERE!
 
     /**
      * Find the minimum node on a dimension
-     * Time Complexity: ?
+     * A subtree is skipped if its bounding box shows that it can not hold a smaller key than best,
+     * and the child with the smaller bound is searched first
+     * The subtrees waiting to be searched are kept on an explicit stack, the tree can be as deep as it is large
+     * Time Complexity: O(k log n) typically, O(n^(1-1/k)) if many keys tie on DIM_CMP
      * @tparam DIM_CMP comparison dimension
-     * @tparam DIM current dimension of node
      * @param node
+     * @param best the minimum node found so far (nullptr if none)
+     * @param visits counts the visited nodes, with depths relative to node, if not nullptr
      * @return the minimum node on a dimension
      */
-    template<size_t DIM_CMP, size_t DIM>
-    Node *findMin(Node *node) {
-        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
-        // TODO: implement this function
-        if(node == nullptr) {
-            return nullptr;
+    template<size_t DIM_CMP>
+    static Node *findMin(Node *node, Node *best = nullptr, KDTreeStats *visits = nullptr) {
+        //(node, depth)
+        KDTreeStack<std::pair<Node *, size_t>> stack;
+        if(node != nullptr) {
+            stack.emplace_back(node, 0);
         }
-        Node * min = findMin<DIM_CMP, DIM_NEXT>(node->left); //no matter what, the left subtree are all condidates
-        if(DIM != DIM_CMP) {
-            Node * rightMin = findMin<DIM_CMP,DIM_NEXT>(node->right); //if the dimension of this layer is not the target dimension, then right subtree are also candidates
-            min = this->compareNode<DIM_CMP, std::less<>>(min,rightMin); //the min should be the smaller of right min and left min
+        while(!stack.empty()) {
+            auto [current, depth] = stack.back();
+            node = current;
+            stack.pop_back();
+            //the whole subtree is larger than best on the comparison dimension
+            if(best != nullptr && std::get<DIM_CMP>(best->key()) < std::get<DIM_CMP>(node->lo)) {
+                continue;
+            }
+            record(visits, node, depth);
+            best = compareNode<DIM_CMP, std::less<>>(best, node);
+            Node * first = node->left;
+            Node * second = node->right;
+            if(first == nullptr || (second != nullptr && std::get<DIM_CMP>(second->lo) < std::get<DIM_CMP>(first->lo))) {
+                std::swap(first, second);
+            }
+            if(second != nullptr) {
+                stack.emplace_back(second, depth + 1);
+            }
+            if(first != nullptr) {
+                stack.emplace_back(first, depth + 1);
+            }
         }
-        return this->compareNode<DIM_CMP, std::less<>>(min, node); //don't bother to think about whether this layer is the desired dimension layer, just do a comparison
+        return best;
     }
 
     /**
      * Find the maximum node on a dimension
-     * Time Complexity: ?
+     * Same as findMin, with the upper corners of the bounding boxes
+     * Time Complexity: O(k log n) typically, O(n^(1-1/k)) if many keys tie on DIM_CMP
      * @tparam DIM_CMP comparison dimension
-     * @tparam DIM current dimension of node
      * @param node
+     * @param best the maximum node found so far (nullptr if none)
+     * @param visits counts the visited nodes, with depths relative to node, if not nullptr
      * @return the maximum node on a dimension
      */
-    template<size_t DIM_CMP, size_t DIM>
-    Node *findMax(Node *node) {
-        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
-        // TODO: implement this function
-        if(node == nullptr) {
-            return nullptr;
+    template<size_t DIM_CMP>
+    static Node *findMax(Node *node, Node *best = nullptr, KDTreeStats *visits = nullptr) {
+        //(node, depth)
+        KDTreeStack<std::pair<Node *, size_t>> stack;
+        if(node != nullptr) {
+            stack.emplace_back(node, 0);
         }
-        Node * max = findMax<DIM_CMP, DIM_NEXT>(node->right); //no matter what, the right subtree are all candidates 
-        if(DIM_CMP != DIM) {
-            Node * leftMax = findMax<DIM_CMP,DIM_NEXT>(node->left); //if the dimension of this layer is not the comparison dimension, then the left subtree are all candidates as well
-            max = this->compareNode<DIM_CMP, std::greater<>>(max,leftMax);
+        while(!stack.empty()) {
+            auto [current, depth] = stack.back();
+            node = current;
+            stack.pop_back();
+            //the whole subtree is smaller than best on the comparison dimension
+            if(best != nullptr && std::get<DIM_CMP>(node->hi) < std::get<DIM_CMP>(best->key())) {
+                continue;
+            }
+            record(visits, node, depth);
+            best = compareNode<DIM_CMP, std::greater<>>(best, node);
+            Node * first = node->right;
+            Node * second = node->left;
+            if(first == nullptr || (second != nullptr && std::get<DIM_CMP>(first->hi) < std::get<DIM_CMP>(second->hi))) {
+                std::swap(first, second);
+            }
+            if(second != nullptr) {
+                stack.emplace_back(second, depth + 1);
+            }
+            if(first != nullptr) {
+                stack.emplace_back(first, depth + 1);
+            }
         }
-        return this->compareNode<DIM_CMP,std::greater<>>(max,node);
+        return best;
     }
 
     template<size_t DIM>
-    Node *findMinDynamic(size_t dim) {
+    static Node *findMinDynamic(Node *node, size_t dim, KDTreeStats *visits = nullptr) {
         constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
         if (dim >= KeySize) {
             dim %= KeySize;
         }
-        if (dim == DIM) return findMin<DIM, 0>(root);
-        return findMinDynamic<DIM_NEXT>(dim);
+        if (dim == DIM) return findMin<DIM>(node, nullptr, visits);
+        return findMinDynamic<DIM_NEXT>(node, dim, visits);
     }
 
     template<size_t DIM>
-    Node *findMaxDynamic(size_t dim) {
+    static Node *findMaxDynamic(Node *node, size_t dim, KDTreeStats *visits = nullptr) {
         constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
         if (dim >= KeySize) {
             dim %= KeySize;
         }
-        if (dim == DIM) return findMax<DIM, 0>(root);
-        return findMaxDynamic<DIM_NEXT>(dim);
+        if (dim == DIM) return findMax<DIM>(node, nullptr, visits);
+        return findMaxDynamic<DIM_NEXT>(node, dim, visits);
     }
 
     /**
-     * Erase a node with key (check the pseudocode in project description)
+     * Unlink a node from the tree (check the pseudocode in project description)
+     * The node is not freed, the caller destroys it
+     * A node with children is replaced by the minimum node on its splitting dimension of a subtree,
+     * which is unlinked from its old place the same way and moved up, so no key or value is copied
+     * and the other nodes keep their addresses
+     * The chain of replacements is found top-down and relinked bottom-up, then the bounding boxes
+     * and sizes are recomputed on the way up through the parent pointers
      * Time Complexity: max{O(k log n), O(findMin)}
-     * @tparam DIM current dimension of node
      * @param node
+     * @param dim splitting dimension of node
+     * @return the node moved into the place of node, nullptr if node was a leaf
+     */
+    Node *unlink(Node *node, size_t dim) {
+        //chain[i + 1] moves up into the place of chain[i], the last one is a leaf
+        //fromLeft[i] tells whether chain[i + 1] came from the left subtree of chain[i]
+        std::vector<Node *> chain(1, node);
+        std::vector<bool> fromLeft;
+        for(Node *current = node; current->left != nullptr || current->right != nullptr;) {
+            //if the node has right subtree, move up the minimum of it
+            //if the node only has left subtree, move up the minimum of the left subtree, which becomes the right subtree
+            //(taking the maximum instead could leave keys equal to it on dim in the left subtree)
+            Node *subtree = current->right != nullptr ? current->right : current->left;
+            Node *minNode = findMinDynamic<0>(subtree, dim);
+            fromLeft.push_back(current->right == nullptr);
+            for(Node *temp = minNode; temp != current; temp = temp->parent) {
+                dim = nextDim(dim);
+            }
+            chain.push_back(minNode);
+            current = minNode;
+        }
+
+        Node *leaf = chain.back();
+        Node *lowest = leaf->parent;    //the deepest node whose subtree changes
+        childLink(leaf) = nullptr;
+        for(size_t i = chain.size() - 1; i-- > 0;) {
+            Node *old = chain[i];
+            Node *replacement = chain[i + 1];
+            replacement->left = fromLeft[i] ? nullptr : old->left;
+            replacement->right = fromLeft[i] ? old->left : old->right;
+            replacement->parent = old->parent;
+            if(replacement->left != nullptr) {
+                replacement->left->parent = replacement;
+            }
+            if(replacement->right != nullptr) {
+                replacement->right->parent = replacement;
+            }
+            childLink(old) = replacement;
+            if(lowest == old) {
+                lowest = replacement;
+            }
+            old->left = nullptr;
+            old->right = nullptr;
+        }
+        node->parent = nullptr;
+        for(Node *temp = lowest; temp != nullptr; temp = temp->parent) {
+            updateNode(temp);
+        }
+        return chain.size() > 1 ? chain[1] : nullptr;
+    }
+
+    // TODO: define your helper functions here if necessary
+
+    /**
+     * Reduced distance of two keys under a metric
+     * Time Complexity: O(k)
+     */
+    template<typename Metric, size_t... DIMS>
+    static double reducedDistance(const Key &a, const Key &b, std::index_sequence<DIMS...>) {
+        double sum = 0;
+        ((sum = Metric::accumulate(sum, Metric::axis((double) std::get<DIMS>(a), (double) std::get<DIMS>(b)))), ...);
+        return sum;
+    }
+
+    template<typename Metric>
+    static double reducedDistance(const Key &a, const Key &b) {
+        return reducedDistance<Metric>(a, b, std::make_index_sequence<KeySize>());
+    }
+
+    /**
+     * Reduced distance from key to the nearest point of the bounding box of node (0 if inside)
+     * Time Complexity: O(k)
+     */
+    template<typename Metric, size_t... DIMS>
+    static double reducedBoxDistance(const Key &key, Node *node, std::index_sequence<DIMS...>) {
+        double sum = 0;
+        ((sum = Metric::accumulate(sum, std::get<DIMS>(key) < std::get<DIMS>(node->lo) ?
+                Metric::axis((double) std::get<DIMS>(key), (double) std::get<DIMS>(node->lo)) :
+                std::get<DIMS>(node->hi) < std::get<DIMS>(key) ?
+                Metric::axis((double) std::get<DIMS>(key), (double) std::get<DIMS>(node->hi)) : 0.0)), ...);
+        return sum;
+    }
+
+    template<typename Metric>
+    static double reducedBoxDistance(const Key &key, Node *node) {
+        return reducedBoxDistance<Metric>(key, node, std::make_index_sequence<KeySize>());
+    }
+
+    /**
+     * Collect the k nearest nodes in a bounded max-heap of (reduced distance, node)
+     * The top of the heap is the farthest of the current k candidates
+     */
+    struct NearestHeap {
+        size_t k;
+        std::vector<std::pair<double, Node *>> items;
+
+        explicit NearestHeap(size_t k) : k(k) { items.reserve(k); }
+
+        double bound() const {
+            return items.size() < k ? std::numeric_limits<double>::infinity() : items.front().first;
+        }
+
+        void add(double distance, Node *node) {
+            if (items.size() < k) {
+                items.emplace_back(distance, node);
+                std::push_heap(items.begin(), items.end());
+            } else if (distance < items.front().first) {
+                std::pop_heap(items.begin(), items.end());
+                items.back() = {distance, node};
+                std::push_heap(items.begin(), items.end());
+            }
+        }
+    };
+
+    /**
+     * Collect every node within a (reduced) radius
+     */
+    struct RadiusCollector {
+        double radius;
+        std::vector<std::pair<double, Node *>> items;
+
+        explicit RadiusCollector(double radius) : radius(radius) {}
+
+        double bound() const { return radius; }
+
+        void add(double distance, Node *node) {
+            if (distance <= radius) {
+                items.emplace_back(distance, node);
+            }
+        }
+    };
+
+    /**
+     * Branch-and-bound search for the nodes near key
+     * The subtree on the side of key is searched first, then the other subtree is searched
+     * only if its bounding box is within collector.bound() of key (which implies the splitting plane is)
+     * The subtrees waiting to be searched are kept on an explicit stack, the tree can be as deep as it is large
+     * Time Complexity: O(k log n) on average for uniform data and a small result
+     * @tparam Metric see KDTreeL2Metric
+     * @tparam Counted count the visited nodes in stats (a template parameter, so the uncounted
+     *         searches do not pay for it)
+     * @tparam Collector NearestHeap or RadiusCollector
      * @param key
-     * @return nullptr if node is erased, else the (probably) replaced node
+     * @param collector receives every node with a reduced distance within its bound
      */
-    template<size_t DIM>
-    Node *erase(Node *node, const Key &key) {
-        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
-        // TODO: implement this function
-        if (node == nullptr) {
-            return nullptr;
+    template<typename Metric, bool Counted = false, typename Collector>
+    void nearestSearch(const Key &key, Collector &collector) {
+        //(node, depth), the splitting dimension is depth % KeySize
+        KDTreeStack<std::pair<Node *, size_t>> stack;
+        if (root != nullptr) {
+            stack.emplace_back(root, 0);
         }
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            size_t dim = depth % KeySize;
+            stack.pop_back();
+            if (reducedBoxDistance<Metric>(key, node) > collector.bound()) {
+                continue;
+            }
+            if constexpr (Counted) {
+                record(stats, node, depth);
+            }
+            collector.add(reducedDistance<Metric>(key, node->key()), node);
+            bool goLeft = compareKey_dim(dim, key, node->key());
+            Node *nearSide = goLeft ? node->left : node->right;
+            Node *farSide = goLeft ? node->right : node->left;
+            if (farSide != nullptr) {
+                stack.emplace_back(farSide, depth + 1);
+            }
+            if (nearSide != nullptr) {
+                stack.emplace_back(nearSide, depth + 1);
+            }
+        }
+    }
 
-        bool isRoot = false;
-        //note that the erase node may be the root node, in this case, if we delete the node directly without update the root pointer, the root pointer will be null
-        if (node == this->root) {
-            isRoot = true;
-        }
-        //if the key is what we want to find 
-        if (this->isEqualKey(node->key(), key)) {
-            //if the node is a leaf node, delete it directly
-            if(node->left == nullptr && node->right == nullptr) {
-                node->parent = nullptr;
-                delete node;
-                node = nullptr;
-                //update the treesize
-                treeSize--;
-            }
-
-            //if the node has right subtree then
-            else if(node->right != nullptr) {
-                //std::cout<<"The node has a right subtree"<<std::endl;
-                Node * minNode = this->findMin<DIM, DIM_NEXT>(node->right);
-                if(minNode == nullptr) {
-                    // std::cout<<"The findMin is wrong"<<std::endl;
+    /**
+     * Whether key lies in the box [lo, hi] on every dimension
+     * Time Complexity: O(k)
+     */
+    template<size_t... DIMS>
+    static bool inBox(const Key &key, const Key &lo, const Key &hi, std::index_sequence<DIMS...>) {
+        return ((!(std::get<DIMS>(key) < std::get<DIMS>(lo)) && !(std::get<DIMS>(hi) < std::get<DIMS>(key))) && ...);
+    }
+
+    static bool inBox(const Key &key, const Key &lo, const Key &hi) {
+        return inBox(key, lo, hi, std::make_index_sequence<KeySize>());
+    }
+
+    /**
+     * Whether the boxes [loA, hiA] and [loB, hiB] intersect (bounds included)
+     * Time Complexity: O(k)
+     */
+    template<size_t... DIMS>
+    static bool boxesIntersect(const Key &loA, const Key &hiA, const Key &loB, const Key &hiB,
+                               std::index_sequence<DIMS...>) {
+        return ((!(std::get<DIMS>(hiA) < std::get<DIMS>(loB)) && !(std::get<DIMS>(hiB) < std::get<DIMS>(loA))) && ...);
+    }
+
+    static bool boxesIntersect(const Key &loA, const Key &hiA, const Key &loB, const Key &hiB) {
+        return boxesIntersect(loA, hiA, loB, hiB, std::make_index_sequence<KeySize>());
+    }
+
+    /**
+     * Call callback on every node of a subtree, in order
+     * The walk follows the parent pointers like Iterator, so nothing is allocated
+     * Time Complexity: O(size of the subtree)
+     * @tparam Counted count the visited nodes in visits
+     * @param visits
+     * @param depth depth of node
+     */
+    template<bool Counted = false, typename Callback>
+    static void visitAll(Node *node, Callback &callback, KDTreeStats *visits = nullptr, size_t depth = 0) {
+        if (node == nullptr) {
+            return;
+        }
+        Node *top = node;
+        while (node->left != nullptr) {
+            node = node->left;
+            depth++;
+        }
+        while (true) {
+            if constexpr (Counted) {
+                record(visits, node, depth);
+            }
+            callback(node->data);
+            if (node->right != nullptr) {
+                node = node->right;
+                depth++;
+                while (node->left != nullptr) {
+                    node = node->left;
+                    depth++;
                 }
-                //copy the minnode to this node
-                node = NodeCopy(node, minNode);
-                // if(node->right == nullptr) {
-                //     std::cout<<"The copy is not successful!"<<std::endl;
-                // }
-                // std::cout<<"The right node is:";
-                // std::cout<<node->right->data.second<<std::endl;
-                // std::cout<<"The victim is now with value:";
-                // std::cout<<node->data.second<<std::endl;
-                // std::cout<<"The victim's parent is:";
-                // std::cout<<node->parent->data.second<<std::endl;
-                // std::cout<<"The victim's parent's right child is:";
-                // std::cout<<node->parent->right->data.second<<std::endl;
-                node->right = erase<DIM_NEXT>(node->right, minNode->key());
-            }
-
-            //if the node has left subtree and does not have right subtree
-            else if(node->left != nullptr) {
-                Node * maxNode = this->findMax<DIM, DIM_NEXT>(node->left);
-                node = NodeCopy(node, maxNode);
-                // if(node->left == nullptr) {
-                //     std::cout<<"The copy is not successful!"<<std::endl;
-                // }
-                // std::cout<<"The left node is:";
-                // std::cout<<node->left->data.second<<std::endl;
-                node->left = erase<DIM_NEXT>(node->left, maxNode->key());
+                continue;
+            }
+            while (node != top && node->parent->right == node) {
+                node = node->parent;
+                depth--;
             }
+            if (node == top) {
+                return;
+            }
+            node = node->parent;
+            depth--;
         }
-        else {
-            if(this->compareKey_DIM<DIM>(key, node->key())) {
-                node->left = erase<DIM_NEXT>(node->left, key);
+    }
+
+    /**
+     * Visit every node in the box [lo, hi] (bounds included)
+     * A subtree is skipped if its bounding box does not intersect the box, and visited without
+     * any test if its bounding box is inside the box
+     * Otherwise the left subtree is searched only if lo is below the splitting plane, since its keys are
+     * strictly below it (insert, erase and the median split all keep the keys equal to it on the right),
+     * and the right subtree only if hi is not below it
+     * The subtrees waiting to be searched are kept on an explicit stack, the tree can be as deep as it is large
+     * Time Complexity: O(k n^(1-1/k) + m) for a balanced tree, where m is the number of results
+     * @tparam Counted count the visited nodes in stats, see nearestSearch
+     * @tparam Callback called with Data & of every node in the box
+     * @param lo
+     * @param hi
+     * @param callback
+     */
+    template<bool Counted = false, typename Callback>
+    void rangeSearch(const Key &lo, const Key &hi, Callback &callback) {
+        //(node, depth), the splitting dimension is depth % KeySize
+        KDTreeStack<std::pair<Node *, size_t>> stack;
+        if (root != nullptr) {
+            stack.emplace_back(root, 0);
+        }
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            size_t dim = depth % KeySize;
+            stack.pop_back();
+            if (!boxesIntersect(node->lo, node->hi, lo, hi)) {
+                continue;
             }
-            else {
-                node->right = erase<DIM_NEXT>(node->right, key);
+            if (inBox(node->lo, lo, hi) && inBox(node->hi, lo, hi)) {
+                visitAll<Counted>(node, callback, stats, depth);   //the whole subtree is in the box
+                continue;
             }
+            if constexpr (Counted) {
+                record(stats, node, depth);
+            }
+            if (inBox(node->key(), lo, hi)) {
+                callback(node->data);
+            }
+            if (node->right != nullptr && !compareKey_dim(dim, hi, node->key())) {
+                stack.emplace_back(node->right, depth + 1);
+            }
+            if (node->left != nullptr && compareKey_dim(dim, lo, node->key())) {
+                stack.emplace_back(node->left, depth + 1);
+            }
+        }
+    }
+
+    /**
+     * Sort collected (distance, node) pairs by distance and convert them to iterators
+     */
+    std::vector<Iterator> sortedIterators(std::vector<std::pair<double, Node *>> &items) {
+        std::sort(items.begin(), items.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        std::vector<Iterator> result;
+        result.reserve(items.size());
+        for (auto &item : items) {
+            result.push_back(Iterator(this, item.second));
         }
+        return result;
+    }
 
-        if(isRoot) {
-            root = node;
+    /**
+     * Build a balanced subtree from the range [first, last) of a buffer, in place
+     * The median on DIM is selected with nth_element, and the first of the keys equal to it on DIM
+     * becomes the root, so the left subtree is strictly less on DIM as find expects
+     * The pairs are moved into nodes constructed in the given storage, nothing is allocated,
+     * so the threads never touch the pool
+     * Above BUILD_GRAIN_SIZE the left subtree is built by a worker of WorkerPool while this thread builds
+     * the right, the threads are split between the two halves
+     * Time complexity: O(kn log n)
+     * @tparam DIM current dimension of node
+     * @param first
+     * @param last
+     * @param slots storage for the nodes, one per pair of the range (slots[i] goes with first[i])
+     * @param parent parent of the subtree root
+     * @param threads number of threads this subtree may use
+     * @return the root of the subtree
+     */
+    template<size_t DIM, typename RandomIt>
+    Node *buildRange(RandomIt first, RandomIt last, void *const *slots, Node *parent, size_t threads) {
+        if (first == last) {
+            return nullptr;
+        }
+        constexpr size_t NEXT_DIM = (DIM + 1) % KeySize;
+        auto median = first + (last - first - 1) / 2; //choose the left element when the size is even
+        std::nth_element(first, median, last, this->compareData_DIM<DIM>);
+        auto equal = std::partition(first, median, [&median](const auto &data) {
+            return compareData_DIM<DIM>(data, *median);
+        });
+        std::iter_swap(equal, median);
+        median = equal;
+
+        auto rightSlots = slots + (median - first) + 1;
+        Node *node = ::new(slots[median - first]) Node(std::move(median->first), std::move(median->second), parent);
+        if (threads > 1 && (size_t) (last - first) >= BUILD_GRAIN_SIZE) {
+            WorkerPool &pool = WorkerPool::instance();
+            pool.reserve(threads - 1);
+            Node *left = nullptr;
+            auto handle = pool.submit([this, first, median, slots, node, threads, &left]() {
+                left = buildRange<NEXT_DIM>(first, median, slots, node, threads / 2);
+            });
+            node->right = buildRange<NEXT_DIM>(median + 1, last, rightSlots, node, threads - threads / 2);
+            handle.wait();
+            node->left = left;
+        } else {
+            node->left = buildRange<NEXT_DIM>(first, median, slots, node, 1);
+            node->right = buildRange<NEXT_DIM>(median + 1, last, rightSlots, node, 1);
         }
+        updateNode(node);
         return node;
     }
 
+    /**
+     * Grow the bounding box of node to include the box [lo, hi]
+     * Time Complexity: O(k)
+     */
+    template<size_t... DIMS>
+    static void expandBox(Node *node, const Key &lo, const Key &hi, std::index_sequence<DIMS...>) {
+        ((std::get<DIMS>(lo) < std::get<DIMS>(node->lo) ? (void) (std::get<DIMS>(node->lo) = std::get<DIMS>(lo)) : (void) 0), ...);
+        ((std::get<DIMS>(node->hi) < std::get<DIMS>(hi) ? (void) (std::get<DIMS>(node->hi) = std::get<DIMS>(hi)) : (void) 0), ...);
+    }
+
+    static void expandBox(Node *node, const Key &lo, const Key &hi) {
+        expandBox(node, lo, hi, std::make_index_sequence<KeySize>());
+    }
+
+    /**
+     * Recompute the bounding box and the subtree size of node from its key and its children
+     * Time Complexity: O(k)
+     */
+    static void updateNode(Node *node) {
+        node->lo = node->key();
+        node->hi = node->key();
+        node->size = 1;
+        if(node->left != nullptr) {
+            expandBox(node, node->left->lo, node->left->hi);
+            node->size += node->left->size;
+        }
+        if(node->right != nullptr) {
+            expandBox(node, node->right->lo, node->right->hi);
+            node->size += node->right->size;
+        }
+    }
+
+    /**
+     * @return the height an alpha-weight-balanced tree of size nodes can not exceed, log_{1 / balanceAlpha} size
+     */
+    size_t balancedDepth(size_t size) const {
+        return (size_t) (std::log((double) size) * balanceDepthScale);
+    }
+
+    /**
+     * Rebuild a subtree into a balanced one with buildRange, node is replaced by the new subtree root
+     * The new nodes reuse the storage of the old ones
+     * Time complexity: O(km log m), where m is the size of the subtree
+     * @tparam DIM current dimension of node
+     * @param node
+     * @param threads number of threads the build may use
+     */
     template<size_t DIM>
-    Node *eraseDynamic(Node *node, size_t dim) {
-        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
-        if (dim >= KeySize) {
-            dim %= KeySize;
+    void rebuild(Node *&node, size_t threads = 1) {
+        if (node == nullptr) {
+            return;
+        }
+        Node *parent = node->parent;
+        std::vector<std::pair<Key, Value>> items;
+        std::vector<void *> slots;
+        items.reserve(node->size);
+        slots.reserve(node->size);
+        //an explicit stack, the subtree can be as deep as it is large
+        std::vector<Node *> stack(1, node);
+        while (!stack.empty()) {
+            Node *victim = stack.back();
+            stack.pop_back();
+            if (victim->left != nullptr) {
+                stack.push_back(victim->left);
+            }
+            if (victim->right != nullptr) {
+                stack.push_back(victim->right);
+            }
+            items.emplace_back(victim->key(), std::move(victim->value()));
+            victim->~Node();
+            slots.push_back(victim);
         }
-        if (dim == DIM) return erase<DIM>(node, node->key());
-        return eraseDynamic<DIM_NEXT>(node, dim);
+        node = buildRange<DIM>(items.begin(), items.end(), slots.data(), parent, threads);
     }
 
-    // TODO: define your helper functions here if necessary
+    template<size_t DIM>
+    void rebuildDynamic(Node *&node, size_t dim) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (dim == DIM) return rebuild<DIM>(node);
+        return rebuildDynamic<DIM_NEXT>(node, dim);
+    }
 
-    //copy one node to the other node
-    Node * NodeCopy(Node* dst, Node * src) {
-        if(src == nullptr) {
-            return nullptr;
+    /**
+     * Rebuild the whole tree if erase has shrunk it below balanceAlpha of its largest size,
+     * which keeps the depth logarithmic when the erased keys leave unbalanced subtrees behind
+     * Time complexity: O(1), or O(kn log n) amortized over the erases that triggered it
+     */
+    void rebalanceAfterErase() {
+        if (balanceAlpha > 0 && (double) treeSize < balanceAlpha * (double) maxTreeSize) {
+            rebuild<0>(root, buildThreads());
+            maxTreeSize = treeSize;
         }
-        //create a new node, deep copy the data from the srouce node
-        Node * new_node = new Node(src->key(),src->value(), nullptr);
+    }
 
-        //update three pointers of newnode
-        new_node->left = dst->left;
-        new_node->right = dst->right;
-        new_node->parent = dst->parent;
+    static size_t buildThreads() {
+        size_t threads = std::thread::hardware_concurrency();
+        return threads > 0 ? threads : 1;
+    }
 
-        //change the parent's pointer
-        if(dst->parent != nullptr && dst->parent->left == dst) {
-            dst->parent->left = new_node;
+    /**
+     * Call task(i) for every i in [0, count)
+     * The indices are split into chunks of BATCH_GRAIN_SIZE, which up to threads workers
+     * (this thread included) claim one at a time, so an expensive chunk does not hold up the rest
+     * The other workers come from WorkerPool, and a batch of a single chunk runs in this thread only
+     * @param count
+     * @param threads maximum number of workers, 0 for one per hardware thread
+     * @param task
+     */
+    template<typename Task>
+    static void parallelFor(size_t count, size_t threads, const Task &task) {
+        size_t chunks = (count + BATCH_GRAIN_SIZE - 1) / BATCH_GRAIN_SIZE;
+        threads = std::min(threads > 0 ? threads : buildThreads(), chunks);
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t chunk = next++; chunk < chunks; chunk = next++) {
+                size_t end = std::min(count, (chunk + 1) * BATCH_GRAIN_SIZE);
+                for (size_t i = chunk * BATCH_GRAIN_SIZE; i < end; i++) {
+                    task(i);
+                }
+            }
+        };
+        if (threads <= 1) {
+            worker();
+            return;
         }
-        if(dst->parent != nullptr && dst->parent->right == dst) {
-            dst->parent->right = new_node;
+        WorkerPool &pool = WorkerPool::instance();
+        pool.reserve(threads - 1);
+        std::vector<WorkerPool::Handle> helpers;
+        helpers.reserve(threads - 1);
+        for (size_t i = 1; i < threads; i++) {
+            helpers.push_back(pool.submit(worker));
         }
-
-        //change the left child's pointer
-        if(dst->left != nullptr) {
-            dst->left->parent = new_node;
+        worker();
+        for (auto &helper : helpers) {
+            helper.wait();
         }
+    }
 
-        //change the right child's pointer
-        if(dst->right != nullptr) {
-            dst->right->parent = new_node;
+    /**
+     * The path find would take through the top BATCH_GROUP_DEPTH levels of the tree, one bit per level
+     * (1 for right), left-aligned so that keys in the same subtree get adjacent codes
+     * Time Complexity: O(BATCH_GROUP_DEPTH)
+     * @tparam DIM current dimension of node
+     */
+    template<size_t DIM>
+    static uint32_t subtreeCode(const Key &key, Node *node, size_t level = 0, uint32_t code = 0) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (node == nullptr || level == BATCH_GROUP_DEPTH) {
+            return code << (BATCH_GROUP_DEPTH - level);
+        }
+        if (compareKey_DIM<DIM>(key, node->key())) {
+            return subtreeCode<DIM_NEXT>(key, node->left, level + 1, code << 1);
         }
+        return subtreeCode<DIM_NEXT>(key, node->right, level + 1, (code << 1) | 1);
+    }
 
-        //set the original pointers to null so that it will not cause series deletion
-        dst->left = nullptr;
-        dst->right = nullptr;
-        dst->parent = nullptr;
+    /**
+     * Threads a batch may use, the stats hook is not thread safe so an instrumented tree answers in one thread
+     */
+    size_t batchThreads(size_t threads) const {
+        return stats != nullptr ? 1 : threads;
+    }
 
-        //delete the dst and return the new node
-        delete dst;
-        // std::cout<<"The copied data is:";
-        // std::cout<<new_node->data.second<<std::endl;
-        return new_node;
+    /**
+     * Order in which a batch is answered: the input order, or grouped by the subtree each key falls into,
+     * so that queries running one after another share the nodes they read
+     * Time Complexity: O(1), or O(m log m) when grouped, where m is the batch size
+     * @return the order, empty for the input order
+     */
+    template<typename KeyIt>
+    std::vector<size_t> batchOrder(KeyIt keys, size_t count, size_t threads, bool grouped) {
+        std::vector<size_t> order;
+        if (!grouped) {
+            return order;
+        }
+        std::vector<std::pair<uint32_t, size_t>> codes(count);
+        parallelFor(count, threads, [&](size_t i) {
+            codes[i] = std::make_pair(subtreeCode<0>(keys[i], root), i);
+        });
+        std::sort(codes.begin(), codes.end());
+        order.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            order[i] = codes[i].second;
+        }
+        return order;
     }
 
     //return the node with smaller key
@@ -554,6 +1163,28 @@ protected:                      // DO NOT USE private HERE!
         }
     }
 
+    /**
+     * Same as compareKey_DIM, on a dimension chosen at runtime
+     * Time Complexity: O(k)
+     */
+    template<size_t... DIMS>
+    static bool compareKey_dim(size_t dim, const Key & a, const Key & b, std::index_sequence<DIMS...>) {
+        bool result = false;
+        (void) ((dim == DIMS && ((result = std::get<DIMS>(a) < std::get<DIMS>(b)), true)) || ...);
+        return result;
+    }
+
+    static bool compareKey_dim(size_t dim, const Key & a, const Key & b) {
+        return compareKey_dim(dim, a, b, std::make_index_sequence<KeySize>());
+    }
+
+    /**
+     * @return the splitting dimension of the children of a node that splits on dim
+     */
+    static size_t nextDim(size_t dim) {
+        return dim + 1 == KeySize ? 0 : dim + 1;
+    }
+
     static bool compareData_ALL(const Data & a, const Data & b) {
         if(a.first < b.first) {
             return true;
@@ -591,63 +1222,28 @@ public:
     KDTree() = default;
 
     /**
-     * Time complexity: O(kn log n)
+     * Time complexity: O(kn log n), the subtrees above BUILD_GRAIN_SIZE are built in parallel
+     * If a key appears more than once, the last value wins (same as inserting them in order)
      * @param v we pass by value here because v need to be modified
      */
     explicit KDTree(std::vector<std::pair<Key, Value>> v) {
-        // TODO: implement this function
         // First run a stable sort and then do a std::unique to get rid of all the duplicated value
-        // typename std::vector<std::pair<Key, Value>>::iterator i = v.begin();
         std::stable_sort(v.begin(), v.end(), this->compareData_ALL);
-
-        // while(i != v.end()) {
-        //     std::cout<<(*i).second<<std::endl;
-        //     std::cout<<std::get<0>((*i).first)<<" "<<std::get<1>((*i).first)<<" "<<std::get<2>((*i).first)<<std::endl;
-        //     i++;
-        // }
-
         auto new_head = std::unique(v.rbegin(), v.rend(), this->isEqualData_ALL);
         v.erase(v.begin(), new_head.base());
 
-
-        //Build the tree on the root node of this, and the depth of the root node is 0
-        this->root = build_helper<0>(v, nullptr);
+        //Build the tree on the root node of this in place, and the depth of the root node is 0
+        //the nodes are carved out of a single slab
+        Node *storage = pool.allocateBulk(v.size());
+        std::vector<void *> slots(v.size());
+        for (size_t i = 0; i < v.size(); i++) {
+            slots[i] = storage + i;
+        }
+        this->root = buildRange<0>(v.begin(), v.end(), slots.data(), nullptr, buildThreads());
 
         // update the treesize
         this->treeSize = v.size();
-    }
-
-    template<size_t DIM>
-    Node * build_helper(std::vector<std::pair<Key, Value>> data, Node * parent) {
-        if(data.empty()) {
-            return nullptr;
-        }
-        constexpr size_t NEXT_DIM = (DIM + 1) % this->KeySize;
-        //std::vector<std::pair<Key, Value>>::iterator iter_1 = data.begin();
-        auto m = data.begin() + (data.size() - 1) / 2; //choose the left element when the size is even 
-        std::nth_element(data.begin(), m, data.end(), this->compareData_DIM<DIM>);
-        std::vector<std::pair<Key,Value>> left;
-        std::vector<std::pair<Key,Value>> right;
-        auto median = data[(data.size() - 1) / 2]; // set the median element
-
-        //get left
-        for(size_t i = 0; i < (data.size() - 1) / 2 ; i++) {
-            left.push_back(data[i]);
-        }
-
-        //get right
-        for(size_t i = ((data.size() - 1) / 2) + 1; i < data.size(); i++) {
-            right.push_back(data[i]);
-        }
-
-        //free the original vector since it has been divided
-        data.clear();
-
-        //create a new node as the root node
-        Node * node = new Node(median.first, median.second, parent);
-        node->left = build_helper<NEXT_DIM>(left, node);
-        node->right = build_helper<NEXT_DIM>(right, node);
-        return node;
+        this->maxTreeSize = v.size();
     }
 
     /**
@@ -657,18 +1253,41 @@ public:
         // TODO: implement this function
         this->root = copy_helper(that.root, nullptr);
         this->treeSize = that.treeSize;
+        this->balanceAlpha = that.balanceAlpha;
+        this->balanceDepthScale = that.balanceDepthScale;
+        this->maxTreeSize = that.maxTreeSize;
     }
 
     //deep copy the tree rooted at the root_node, return the root node of the copied tree
     //parent is the parent of the returned root node
+    //the nodes whose children are still to be copied wait on an explicit stack, with their copies
     Node * copy_helper(Node * root_node, Node * parent) {
         if(root_node == nullptr) {
             return nullptr;
         }
-        Node * new_node = new Node(root_node->key(), root_node->value(), parent);
-        new_node->left = copy_helper(root_node->left, new_node);
-        new_node->right = copy_helper(root_node->right, new_node);
-        return new_node;
+        auto copyNode = [this](Node * source, Node * copyParent) {
+            Node * new_node = pool.create(source->key(), source->value(), copyParent);
+            new_node->lo = source->lo;
+            new_node->hi = source->hi;
+            new_node->size = source->size;
+            return new_node;
+        };
+        Node * new_root = copyNode(root_node, parent);
+        KDTreeStack<std::pair<Node *, Node *>> stack;
+        stack.emplace_back(root_node, new_root);
+        while(!stack.empty()) {
+            auto [source, new_node] = stack.back();
+            stack.pop_back();
+            if(source->left != nullptr) {
+                new_node->left = copyNode(source->left, new_node);
+                stack.emplace_back(source->left, new_node->left);
+            }
+            if(source->right != nullptr) {
+                new_node->right = copyNode(source->right, new_node);
+                stack.emplace_back(source->right, new_node->right);
+            }
+        }
+        return new_root;
     }
 
     /**
@@ -679,34 +1298,50 @@ public:
         if(that.root == this->root) {
             return *this;
         }
-        //if this is not self-assignment, we delete the original root first and then copy the tree
+        //if this is not self-assignment, we delete the original tree first and then copy the tree
         //update the treeSize
-        delete_helper(this->root);
+        clear();
         this->root = copy_helper(that.root,nullptr);
         this->treeSize = that.treeSize;
+        this->balanceAlpha = that.balanceAlpha;
+        this->balanceDepthScale = that.balanceDepthScale;
+        this->maxTreeSize = that.maxTreeSize;
         return *this;
     }
 
-    //delete the tree rooted at victim
-    void delete_helper(Node * victim) {
-        if(victim == nullptr) {
-            return;
+    /**
+     * Erase all nodes, the balance setting is kept
+     * Time complexity: O(number of slabs) if the keys and values are trivially destructible, else O(n)
+     */
+    void clear() {
+        if constexpr (!std::is_trivially_destructible_v<Node>) {
+            KDTreeStack<Node *> stack;
+            if (root != nullptr) {
+                stack.push_back(root);
+            }
+            while (!stack.empty()) {
+                Node *victim = stack.back();
+                stack.pop_back();
+                if (victim->left != nullptr) {
+                    stack.push_back(victim->left);
+                }
+                if (victim->right != nullptr) {
+                    stack.push_back(victim->right);
+                }
+                victim->~Node();
+            }
         }
-        delete_helper(victim->left);
-        delete_helper(victim->right);
-        victim->left = nullptr;
-        victim->right = nullptr;
-        victim->parent = nullptr;
-        delete victim;
-        return;
+        pool.clear();
+        root = nullptr;
+        treeSize = 0;
+        maxTreeSize = 0;
     }
 
     /**
-     * Time complexity: O(n)
+     * Time complexity: same as clear
      */
     ~KDTree() {
-        // TODO: implement this function'
-        delete_helper(this->root);
+        clear();
     }
 
     Iterator begin() {
@@ -721,52 +1356,351 @@ public:
     }
 
     Iterator find(const Key &key) {
-        return Iterator(this, find<0>(key, root));
+        size_t dim;
+        countQuery();
+        return Iterator(this, find(key, dim, stats));
     }
 
     void insert(const Key &key, const Value &value) {
-        insert<0>(key, value, root, nullptr);
+        if (insertNode(key, value) && treeSize > maxTreeSize) {
+            maxTreeSize = treeSize;
+        }
+    }
+
+    /**
+     * Keep the tree balanced from now on, scapegoat style: when an insert makes a node deeper than
+     * log_{1 / alpha} n, a subtree on its path is rebuilt with the median split of the vector constructor
+     * The depth stays below log_{1 / alpha} n + 1 unless many keys share a value on one dimension
+     * (the keys equal to a splitting value always go right), updates take amortized O(k log^2 n)
+     * Inserts and erases by key may rebuild subtrees, which invalidates the iterators into them;
+     * erase(Iterator) only rebuilds when it erases the last node in order
+     * Time complexity: O(kn log n), the whole tree is rebuilt once
+     * @param alpha weight-balance bound, in (0.5, 1); smaller is better balanced but rebuilds more
+     */
+    void enableBalance(double alpha = DEFAULT_BALANCE_ALPHA) {
+        if (!(alpha > 0.5 && alpha < 1)) {
+            throw std::range_error("KDTree balance alpha must be in (0.5, 1)");
+        }
+        balanceAlpha = alpha;
+        balanceDepthScale = 1 / std::log(1 / alpha);
+        rebuild<0>(root, buildThreads());
+        maxTreeSize = treeSize;
+    }
+
+    /**
+     * Stop rebalancing, the tree keeps its current shape
+     */
+    void disableBalance() {
+        balanceAlpha = 0;
+        balanceDepthScale = 0;
+    }
+
+    bool balanceEnabled() const { return balanceAlpha > 0; }
+
+    /**
+     * Count the work of the queries in counters from now on: find, findMin, findMax, nearest, kNearest,
+     * withinRadius, rangeQuery, rangeCount and the batches add one query each and the nodes they visit
+     * Searches made by insert and erase are not counted
+     * The counters are not synchronized, so the batches run in one thread while they are set
+     * A copy of the tree is not instrumented
+     * @param counters owned by the caller, nullptr to stop counting
+     */
+    void setStats(KDTreeStats *counters) { stats = counters; }
+
+    KDTreeStats *getStats() const { return stats; }
+
+    /**
+     * Dump the shape of the tree and the counters of setStats (if any) as a JSON object
+     * minHeight is the height of a perfectly balanced tree of the same size, a height far above it
+     * means the keys arrived in an order the tree did not balance away
+     * Time Complexity: O(n)
+     * @return the JSON string
+     */
+    std::string dumpStats() const {
+        size_t minHeight = 0;
+        while (((size_t) 2 << minHeight) <= treeSize) {
+            minHeight++;
+        }
+        std::ostringstream out;
+        out << "{\"size\":" << treeSize
+            << ",\"height\":" << height()
+            << ",\"minHeight\":" << minHeight
+            << ",\"balanced\":" << (balanceEnabled() ? "true" : "false")
+            << ",\"nodeBytes\":" << pool.bytes();
+        if (stats != nullptr) {
+            stats->writeJson(out);
+        }
+        out << "}";
+        return out.str();
+    }
+
+    /**
+     * Time complexity: O(n)
+     * @return the number of edges on the longest root-to-leaf path, 0 if the tree has at most one node
+     */
+    size_t height() const {
+        size_t result = 0;
+        KDTreeStack<std::pair<Node *, size_t>> stack;
+        if (root != nullptr) {
+            stack.emplace_back(root, 0);
+        }
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            result = std::max(result, depth);
+            if (node->left != nullptr) {
+                stack.emplace_back(node->left, depth + 1);
+            }
+            if (node->right != nullptr) {
+                stack.emplace_back(node->right, depth + 1);
+            }
+        }
+        return result;
     }
 
     template<size_t DIM>
     Iterator findMin() {
-        return Iterator(this, findMin<DIM, 0>(root));
+        countQuery();
+        return Iterator(this, findMin<DIM>(root, nullptr, stats));
     }
 
     Iterator findMin(size_t dim) {
-        return Iterator(this, findMinDynamic<0>(dim));
+        countQuery();
+        return Iterator(this, findMinDynamic<0>(root, dim, stats));
     }
 
     template<size_t DIM>
     Iterator findMax() {
-        return Iterator(this, findMax<DIM, 0>(root));
+        countQuery();
+        return Iterator(this, findMax<DIM>(root, nullptr, stats));
     }
 
     Iterator findMax(size_t dim) {
-        return Iterator(this, findMaxDynamic<0>(dim));
+        countQuery();
+        return Iterator(this, findMaxDynamic<0>(root, dim, stats));
+    }
+
+    /**
+     * Distance of two keys under a metric
+     * Time Complexity: O(k)
+     */
+    template<typename Metric = KDTreeL2Metric>
+    static double distance(const Key &a, const Key &b) {
+        return Metric::expand(reducedDistance<Metric>(a, b));
+    }
+
+    /**
+     * Find the node nearest to key (not necessarily equal to it)
+     * Time Complexity: O(k log n) on average for uniform data, O(kn) in the worst case
+     * @tparam Metric KDTreeL2Metric, KDTreeL1Metric or KDTreeLInfMetric
+     * @param key
+     * @return iterator of the nearest node, or end() if the tree is empty
+     */
+    template<typename Metric = KDTreeL2Metric>
+    Iterator nearest(const Key &key) {
+        NearestHeap heap(1);
+        countedNearestSearch<Metric>(key, heap);
+        return heap.items.empty() ? end() : Iterator(this, heap.items.front().second);
+    }
+
+    /**
+     * Find the k nodes nearest to key, ties are broken arbitrarily
+     * Time Complexity: O(k log n + m log m) on average for uniform data, where m is the number of results
+     * @tparam Metric KDTreeL2Metric, KDTreeL1Metric or KDTreeLInfMetric
+     * @param key
+     * @param count maximum number of nodes to return
+     * @return iterators of the nearest min(count, n) nodes, nearest first
+     */
+    template<typename Metric = KDTreeL2Metric>
+    std::vector<Iterator> kNearest(const Key &key, size_t count) {
+        if (count == 0) {
+            return {};
+        }
+        NearestHeap heap(count);
+        countedNearestSearch<Metric>(key, heap);
+        return sortedIterators(heap.items);
+    }
+
+    /**
+     * Find all nodes whose distance to key is not greater than radius
+     * Time Complexity: O(k log n + m log m) on average for uniform data, where m is the number of results
+     * @tparam Metric KDTreeL2Metric, KDTreeL1Metric or KDTreeLInfMetric
+     * @param key
+     * @param radius
+     * @return iterators of the nodes within radius, nearest first
+     */
+    template<typename Metric = KDTreeL2Metric>
+    std::vector<Iterator> withinRadius(const Key &key, double radius) {
+        if (radius < 0) {
+            return {};
+        }
+        RadiusCollector collector(Metric::reduce(radius));
+        countedNearestSearch<Metric>(key, collector);
+        return sortedIterators(collector.items);
+    }
+
+    /**
+     * Call callback on every key-value pair inside the axis-aligned box [lo, hi] (bounds included)
+     * Nothing is allocated unless the search holds more than 64 pending subtrees (see KDTreeStack),
+     * which a tree kept balanced does not reach; the pairs are visited in no particular order
+     * The callback must not insert into or erase from the tree
+     * Time Complexity: O(k n^(1-1/k) + m) for a balanced tree, where m is the number of results
+     * @tparam Callback a function object taking Data &
+     * @param lo lower corner of the box
+     * @param hi upper corner of the box
+     * @param callback
+     */
+    template<typename Callback>
+    void rangeQuery(const Key &lo, const Key &hi, Callback callback) {
+        if (stats != nullptr) {
+            stats->recordQuery();
+            rangeSearch<true>(lo, hi, callback);
+        } else {
+            rangeSearch(lo, hi, callback);
+        }
+    }
+
+    /**
+     * Count the key-value pairs inside the axis-aligned box [lo, hi] (bounds included)
+     * Time Complexity: O(k n^(1-1/k) + m) for a balanced tree, where m is the result
+     * @param lo lower corner of the box
+     * @param hi upper corner of the box
+     * @return the number of pairs in the box
+     */
+    size_t rangeCount(const Key &lo, const Key &hi) {
+        size_t count = 0;
+        rangeQuery(lo, hi, [&count](Data &) { count++; });
+        return count;
+    }
+
+    /**
+     * Find many keys at once, out[i] is set to find(keys[i])
+     * The keys are answered in parallel, see parallelFor
+     * Time Complexity: O(m k log n / threads), where m is the number of keys
+     * @param first
+     * @param last random access iterators of the keys
+     * @param out random access iterator of the output, with room for last - first iterators
+     * @param threads maximum number of threads, 0 for one per hardware thread
+     * @param grouped answer the keys that fall into the same subtree one after another
+     */
+    template<typename KeyIt, typename OutIt>
+    void findBatch(KeyIt first, KeyIt last, OutIt out, size_t threads = 0, bool grouped = false) {
+        size_t count = (size_t) (last - first);
+        threads = batchThreads(threads);
+        auto order = batchOrder(first, count, threads, grouped);
+        parallelFor(count, threads, [&](size_t i) {
+            size_t index = order.empty() ? i : order[i];
+            size_t dim;
+            countQuery();
+            out[index] = Iterator(this, find(first[index], dim, stats));
+        });
+    }
+
+    /**
+     * Find the nearest node of many keys at once, out[i] is set to nearest(keys[i])
+     * Time Complexity: O(m k log n / threads) on average for uniform data, where m is the number of keys
+     * @tparam Metric KDTreeL2Metric, KDTreeL1Metric or KDTreeLInfMetric
+     * @param first
+     * @param last random access iterators of the keys
+     * @param out random access iterator of the output, with room for last - first iterators
+     * @param threads maximum number of threads, 0 for one per hardware thread
+     * @param grouped answer the keys that fall into the same subtree one after another
+     */
+    template<typename Metric = KDTreeL2Metric, typename KeyIt, typename OutIt>
+    void nearestBatch(KeyIt first, KeyIt last, OutIt out, size_t threads = 0, bool grouped = false) {
+        size_t count = (size_t) (last - first);
+        threads = batchThreads(threads);
+        auto order = batchOrder(first, count, threads, grouped);
+        parallelFor(count, threads, [&](size_t i) {
+            size_t index = order.empty() ? i : order[i];
+            out[index] = nearest<Metric>(first[index]);
+        });
+    }
+
+    /**
+     * Count the pairs in many boxes at once, out[i] is set to rangeCount(lo[i], hi[i])
+     * Time Complexity: O(m (k n^(1-1/k) + r) / threads), where m is the number of boxes, r the average result
+     * @param loFirst
+     * @param loLast random access iterators of the lower corners
+     * @param hiFirst random access iterator of the upper corners
+     * @param out random access iterator of the output, with room for loLast - loFirst counts
+     * @param threads maximum number of threads, 0 for one per hardware thread
+     * @param grouped answer the boxes whose lower corners fall into the same subtree one after another
+     */
+    template<typename KeyIt, typename OutIt>
+    void rangeCountBatch(KeyIt loFirst, KeyIt loLast, KeyIt hiFirst, OutIt out, size_t threads = 0,
+                         bool grouped = false) {
+        size_t count = (size_t) (loLast - loFirst);
+        threads = batchThreads(threads);
+        auto order = batchOrder(loFirst, count, threads, grouped);
+        parallelFor(count, threads, [&](size_t i) {
+            size_t index = order.empty() ? i : order[i];
+            out[index] = rangeCount(loFirst[index], hiFirst[index]);
+        });
     }
 
     bool erase(const Key &key) {
-        auto prevSize = treeSize;
-        erase<0>(root, key);
-        return prevSize > treeSize;
+        size_t dim;
+        Node *removed = find(key, dim);
+        if (removed == nullptr) {
+            return false;
+        }
+        unlink(removed, dim);
+        pool.destroy(removed);
+        treeSize--;
+        rebalanceAfterErase();
+        return true;
     }
 
+    /**
+     * Erase the node of an iterator, the other nodes keep their addresses and iterators
+     * A loop that goes on from the returned iterator visits every node that followed the erased one
+     * exactly once: if the node had a right subtree, the node moved into its place comes from there
+     * and is returned, otherwise the subtree of the node (now without it) precedes its old successor,
+     * which is returned
+     * With balancing enabled, the tree is rebuilt as in erase(const Key &) only when the returned
+     * iterator is end(), so that an iteration is never reordered under it (an erase never makes
+     * the tree deeper, the rebuild waits for the end of the iteration or the next erase by key)
+     * Time Complexity: same as erase(const Key &)
+     * @return iterator of the next node to visit
+     */
     Iterator erase(Iterator it) {
         if (it == end()) return it;
         auto node = it.node;
-        if (!it.node->left && !it.node->right) {
-            it.node = it.node->parent;
-        }
+        ++it;
         size_t depth = 0;
-        auto temp = node->parent;
-        while (temp) {
-            temp = temp->parent;
+        for (auto temp = node->parent; temp; temp = temp->parent) {
             ++depth;
         }
-        eraseDynamic<0>(node, depth % KeySize);
+        bool hasRight = node->right != nullptr;
+        Node *replacement = unlink(node, depth % KeySize);
+        if (hasRight) {
+            it = Iterator(this, replacement);
+        }
+        pool.destroy(node);
+        treeSize--;
+        if (it == end()) {
+            rebalanceAfterErase();
+        }
         return it;
     }
 
     size_t size() const { return treeSize; }
+
+    /**
+     * Write the tree to an image file at path, MappedKDTree<Key, Value>::open(path) queries it
+     * Include mapped_kdtree.hpp to use it, the key types and the value type must be trivially copyable
+     * Time Complexity: O(kn log n)
+     * @throw std::runtime_error if the file can not be written
+     */
+    template<typename Image = MappedKDTree<Key, Value>>
+    void save(const std::string &path) const {
+        std::vector<std::pair<Key, Value>> v;
+        v.reserve(treeSize);
+        auto collect = [&v](const Data &data) { v.emplace_back(data.first, data.second); };
+        visitAll(root, collect);
+        Image::save(std::move(v), path);
+    }
 };
+
+#endif //VE281P3_KDTREE_HPP
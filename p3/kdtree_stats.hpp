@@ -0,0 +1,66 @@
+#ifndef VE281P3_KDTREE_STATS_HPP
+#define VE281P3_KDTREE_STATS_HPP
+
+#include <cstddef>
+#include <ostream>
+
+/**
+ * Count the work done by the queries of a KDTree, see KDTree::setStats
+ * A node is visited when a query examines its key, a leaf is a visited node without children,
+ * and the root is at depth 0
+ */
+struct KDTreeStats {
+    size_t queries = 0;         // number of queries counted
+    size_t nodesVisited = 0;    // total nodes visited by the queries
+    size_t leavesVisited = 0;   // total leaves among them
+    size_t maxDepth = 0;        // deepest node visited by any query
+
+    /**
+     * Time Complexity: O(1)
+     */
+    void recordQuery() {
+        queries++;
+    }
+
+    /**
+     * Time Complexity: O(1)
+     * @param leaf whether the node has no children
+     * @param depth depth of the node
+     */
+    void recordVisit(bool leaf, size_t depth) {
+        nodesVisited++;
+        if (leaf) {
+            leavesVisited++;
+        }
+        if (depth > maxDepth) {
+            maxDepth = depth;
+        }
+    }
+
+    void reset() { *this = KDTreeStats(); }
+
+    double averageNodesVisited() const {
+        return queries ? (double) nodesVisited / (double) queries : 0.0;
+    }
+
+    double averageLeavesVisited() const {
+        return queries ? (double) leavesVisited / (double) queries : 0.0;
+    }
+
+    /**
+     * Write the counters as JSON members (without the enclosing braces)
+     * The output starts with a comma so it can be appended to another object
+     */
+    void writeJson(std::ostream &out) const {
+        out << ",\"queries\":{"
+            << "\"count\":" << queries
+            << ",\"nodesVisited\":" << nodesVisited
+            << ",\"leavesVisited\":" << leavesVisited
+            << ",\"avgNodesVisited\":" << averageNodesVisited()
+            << ",\"avgLeavesVisited\":" << averageLeavesVisited()
+            << ",\"maxDepth\":" << maxDepth
+            << "}";
+    }
+};
+
+#endif //VE281P3_KDTREE_STATS_HPP
@@ -0,0 +1,447 @@
+#ifndef VE281P3_LOG_STRUCTURED_KDTREE_HPP
+#define VE281P3_LOG_STRUCTURED_KDTREE_HPP
+
+#include "kdtree.hpp"
+#include "static_kdtree.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * An abstract template base of the LogStructuredKDTree class
+ */
+template<typename Key, typename Value, size_t BufferSize = 64>
+class LogStructuredKDTree;
+
+/**
+ * A KDTree for write-heavy workloads, dynamized the Bentley-Saxe way
+ * New records go to an unsorted buffer of BufferSize records. Level i is a StaticKDTree of at most
+ * BufferSize * 2^i records, or empty. When the buffer is full, it is merged with levels 0 .. j-1
+ * into the first empty level j (like adding 1 to a binary counter), so every record is rebuilt
+ * O(log n) times and an insert costs amortized O(k log^2 n).
+ * A record in the buffer or a lower level is newer and shadows the records of the same key in higher levels;
+ * erase writes a tombstone record. Merges keep only the newest record of a key, and drop tombstones
+ * when they merge into the highest level, where nothing older is left to shadow.
+ * Queries are answered by the buffer and every level whose bounding box can hold a result,
+ * skipping the shadowed records.
+ * The time complexity of functions are based on n and k
+ * n is the number of records (live keys plus not yet purged shadowed records and tombstones)
+ * k is the number of dimensions
+ * @typedef Key         key type
+ * @typedef Value       value type
+ * @static  KeySize     k (number of dimensions)
+ */
+template<typename ValueType, typename... KeyTypes, size_t BufferSize>
+class LogStructuredKDTree<std::tuple<KeyTypes...>, ValueType, BufferSize> {
+public:
+    typedef std::tuple<KeyTypes...> Key;
+    typedef ValueType Value;
+    static inline constexpr size_t KeySize = std::tuple_size<Key>::value;
+    static_assert(KeySize > 0, "Can not construct KDTree with zero dimension");
+    static_assert(BufferSize > 0, "The buffer of LogStructuredKDTree must not be empty");
+
+    /**
+     * A key-value reference to a live record, it has first and second like the Data of KDTree
+     */
+    struct Reference {
+        const Key &first;
+        Value &second;
+    };
+
+protected:
+    struct Record {
+        Value value;
+        bool erased;    // a tombstone
+    };
+
+    struct Level {
+        StaticKDTree<Key, Record> tree;
+        Key lo;     // per-dimension minimum of the keys of the level
+        Key hi;     // per-dimension maximum of the keys of the level
+
+        Level() = default;
+
+        explicit Level(std::vector<std::pair<Key, Record>> records) {
+            if (!records.empty()) {
+                lo = hi = records.front().first;
+                for (auto &record : records) {
+                    expand(record.first, std::make_index_sequence<KeySize>());
+                }
+            }
+            tree = StaticKDTree<Key, Record>(std::move(records));
+        }
+
+        template<size_t... DIMS>
+        void expand(const Key &key, std::index_sequence<DIMS...>) {
+            ((std::get<DIMS>(lo) = std::min(std::get<DIMS>(lo), std::get<DIMS>(key))), ...);
+            ((std::get<DIMS>(hi) = std::max(std::get<DIMS>(hi), std::get<DIMS>(key))), ...);
+        }
+
+        size_t size() const { return tree.size(); }
+    };
+
+    std::vector<std::pair<Key, Record>> buffer;     // at most one record per key
+    std::vector<Level> levels;
+    size_t liveSize = 0;
+    size_t shadowing = 0;       // records written over an older record since the last full merge
+
+    /**
+     * Find the newest record of key
+     * Time Complexity: O(BufferSize + k log^2 n)
+     * @param key
+     * @param level set to the level of the record, levels.size() for the buffer
+     * @return the record, or nullptr if there is none
+     */
+    Record *findRecord(const Key &key, size_t &level) {
+        for (auto &item : buffer) {
+            if (item.first == key) {
+                level = levels.size();
+                return &item.second;
+            }
+        }
+        for (level = 0; level < levels.size(); level++) {
+            auto it = levels[level].tree.find(key);
+            if (it != levels[level].tree.end()) {
+                return &it.value();
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Time Complexity: O(BufferSize + k log n * level)
+     * @return whether a record of key newer than those of level exists
+     */
+    bool isShadowed(const Key &key, size_t level) {
+        if (shadowing == 0) {
+            return false;
+        }
+        for (auto &item : buffer) {
+            if (item.first == key) {
+                return true;
+            }
+        }
+        for (size_t i = 0; i < level; i++) {
+            if (levels[i].tree.find(key) != levels[i].tree.end()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Time Complexity: O(1) plus isShadowed
+     * @return whether the record of key in level (levels.size() for the buffer) is the live value of key
+     */
+    bool isLive(const Key &key, const Record &record, size_t level) {
+        if (record.erased) {
+            return false;
+        }
+        return level == levels.size() ? true : !isShadowed(key, level);
+    }
+
+    /**
+     * Merge the buffer and levels 0 .. j-1 into the first empty level j
+     * Time Complexity: O(km log m), where m = BufferSize * 2^j
+     */
+    void mergeBuffer() {
+        size_t target = 0;
+        while (target < levels.size() && levels[target].size() > 0) {
+            target++;
+        }
+        if (target == levels.size()) {
+            levels.emplace_back();
+        }
+        bool purge = true;      // whether target becomes the highest non-empty level
+        for (size_t i = target + 1; i < levels.size(); i++) {
+            purge = purge && levels[i].size() == 0;
+        }
+
+        // oldest first, so that the newest record of a key is the last one
+        std::vector<std::pair<Key, Record>> records;
+        for (size_t i = target; i-- > 0;) {
+            for (auto it = levels[i].tree.begin(); it != levels[i].tree.end(); ++it) {
+                records.emplace_back(it.key(), std::move(it.value()));
+            }
+            levels[i] = Level();
+        }
+        for (auto &item : buffer) {
+            records.push_back(std::move(item));
+        }
+        buffer.clear();
+
+        std::stable_sort(records.begin(), records.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        auto newHead = std::unique(records.rbegin(), records.rend(), [](const auto &a, const auto &b) {
+            return a.first == b.first;
+        });
+        records.erase(records.begin(), newHead.base());
+        if (purge) {
+            records.erase(std::remove_if(records.begin(), records.end(), [](const auto &item) {
+                return item.second.erased;
+            }), records.end());
+            shadowing = 0;
+        }
+        levels[target] = Level(std::move(records));
+        while (!levels.empty() && levels.back().size() == 0) {
+            levels.pop_back();
+        }
+    }
+
+    /**
+     * Write a record to the buffer, over the buffered record of the same key if there is one
+     */
+    void write(const Key &key, const Value &value, bool erased, Record *newest, size_t level) {
+        if (newest != nullptr && level == levels.size()) {
+            newest->value = value;
+            newest->erased = erased;
+            return;
+        }
+        if (newest != nullptr) {
+            shadowing++;
+        }
+        buffer.emplace_back(key, Record{value, erased});
+        if (buffer.size() == BufferSize) {
+            mergeBuffer();
+        }
+    }
+
+    template<size_t... DIMS>
+    static bool inBox(const Key &key, const Key &lo, const Key &hi, std::index_sequence<DIMS...>) {
+        return ((!(std::get<DIMS>(key) < std::get<DIMS>(lo)) && !(std::get<DIMS>(hi) < std::get<DIMS>(key))) && ...);
+    }
+
+    template<size_t... DIMS>
+    static bool boxesIntersect(const Key &loA, const Key &hiA, const Key &loB, const Key &hiB,
+                               std::index_sequence<DIMS...>) {
+        return ((!(std::get<DIMS>(hiA) < std::get<DIMS>(loB)) && !(std::get<DIMS>(hiB) < std::get<DIMS>(loA))) && ...);
+    }
+
+    /**
+     * Distance from key to the nearest point of the bounding box of a level (0 if inside)
+     */
+    template<typename Metric, size_t... DIMS>
+    static double boxDistance(const Key &key, const Level &level, std::index_sequence<DIMS...>) {
+        double sum = 0;
+        ((sum = Metric::accumulate(sum, std::get<DIMS>(key) < std::get<DIMS>(level.lo) ?
+                Metric::axis((double) std::get<DIMS>(key), (double) std::get<DIMS>(level.lo)) :
+                std::get<DIMS>(level.hi) < std::get<DIMS>(key) ?
+                Metric::axis((double) std::get<DIMS>(key), (double) std::get<DIMS>(level.hi)) : 0.0)), ...);
+        return Metric::expand(sum);
+    }
+
+    struct Candidate {
+        double distance;
+        const Key *key;
+        Value *value;
+
+        bool operator<(const Candidate &that) const { return distance < that.distance; }
+    };
+
+public:
+    LogStructuredKDTree() = default;
+
+    /**
+     * Build the tree from key-value pairs, they all go to one level
+     * If a key appears more than once, the last value wins (same as KDTree(vector))
+     * Time complexity: O(kn log n)
+     */
+    explicit LogStructuredKDTree(const std::vector<std::pair<Key, Value>> &v) {
+        std::vector<std::pair<Key, Record>> records;
+        records.reserve(v.size());
+        for (auto &item : v) {
+            records.emplace_back(item.first, Record{item.second, false});
+        }
+        Level level(std::move(records));
+        liveSize = level.size();
+        if (liveSize == 0) {
+            return;
+        }
+        size_t index = 0;
+        while ((BufferSize << index) < liveSize) {
+            index++;
+        }
+        levels.resize(index + 1);
+        levels[index] = std::move(level);
+    }
+
+    /**
+     * Insert the key-value pair, if the key already exists, replace the value only
+     * Time Complexity: amortized O(BufferSize + k log^2 n)
+     * @return whether insertion took place (return false if the key already exists)
+     */
+    bool insert(const Key &key, const Value &value) {
+        size_t level;
+        Record *newest = findRecord(key, level);
+        bool inserted = newest == nullptr || newest->erased;
+        write(key, value, false, newest, level);
+        if (inserted) {
+            liveSize++;
+        }
+        return inserted;
+    }
+
+    /**
+     * Erase the key by writing a tombstone
+     * Time Complexity: amortized O(BufferSize + k log^2 n)
+     * @return whether the key was erased
+     */
+    bool erase(const Key &key) {
+        size_t level;
+        Record *newest = findRecord(key, level);
+        if (newest == nullptr || newest->erased) {
+            return false;
+        }
+        write(key, newest->value, true, newest, level);
+        liveSize--;
+        return true;
+    }
+
+    /**
+     * Time Complexity: O(BufferSize + k log^2 n)
+     * @return the value of key, or nullptr if not found
+     */
+    Value *find(const Key &key) {
+        size_t level;
+        Record *newest = findRecord(key, level);
+        return newest == nullptr || newest->erased ? nullptr : &newest->value;
+    }
+
+    bool contains(const Key &key) { return find(key) != nullptr; }
+
+    /**
+     * Find the count nearest live keys, see KDTree::kNearest
+     * The levels are searched in the order of the distance to their bounding boxes, and the search stops
+     * at a level that can not hold anything nearer than the count-th nearest candidate so far
+     * (with time-ordered keys most levels are skipped this way)
+     * A level answers with its nearest records and, if some of them are shadowed, is asked again for twice as many
+     * Time Complexity: O(BufferSize + (k log n + m log m) log n) on average for uniform data without
+     * shadowed records, where m is the number of results
+     * @return references of the nearest min(count, size()) records, nearest first
+     */
+    template<typename Metric = KDTreeL2Metric>
+    std::vector<Reference> kNearest(const Key &key, size_t count) {
+        typedef KDTree<Key, Value> Tree;
+        std::vector<Candidate> candidates;
+        if (count == 0) {
+            return {};
+        }
+        for (auto &item : buffer) {
+            if (!item.second.erased) {
+                candidates.push_back({Tree::template distance<Metric>(key, item.first), &item.first, &item.second.value});
+            }
+        }
+        std::vector<std::pair<double, size_t>> order;
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (levels[i].size() > 0) {
+                order.emplace_back(boxDistance<Metric>(key, levels[i], std::make_index_sequence<KeySize>()), i);
+            }
+        }
+        std::sort(order.begin(), order.end());
+        for (auto &[distance, i] : order) {
+            if (candidates.size() >= count) {
+                std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end());
+                if (distance > candidates[count - 1].distance) {
+                    break;
+                }
+            }
+            size_t found = 0;
+            size_t mark = candidates.size();
+            for (size_t ask = count; found < count; ask *= 2) {
+                auto nearest = levels[i].tree.template kNearest<Metric>(key, ask);
+                // start over, a larger query may order the ties differently
+                candidates.erase(candidates.begin() + mark, candidates.end());
+                found = 0;
+                for (auto &it : nearest) {
+                    if (found < count && isLive(it.key(), it.value(), i)) {
+                        candidates.push_back({Tree::template distance<Metric>(key, it.key()), &it.key(), &it.value().value});
+                        found++;
+                    }
+                }
+                if (nearest.size() < ask) {
+                    break;
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        std::vector<Reference> result;
+        for (size_t i = 0; i < candidates.size() && i < count; i++) {
+            result.push_back({*candidates[i].key, *candidates[i].value});
+        }
+        return result;
+    }
+
+    /**
+     * Find the nearest live key, see KDTree::nearest
+     * @return reference of the nearest record, or nothing if the tree is empty
+     */
+    template<typename Metric = KDTreeL2Metric>
+    std::optional<Reference> nearest(const Key &key) {
+        auto result = kNearest<Metric>(key, 1);
+        if (result.empty()) {
+            return std::nullopt;
+        }
+        return result.front();
+    }
+
+    /**
+     * Call callback on every live key-value pair inside the box [lo, hi], see KDTree::rangeQuery
+     * The callback takes a Reference and must not insert into or erase from the tree
+     * Time Complexity: O(BufferSize + k n^(1-1/k) + m) without shadowed records, where m is the number of results
+     */
+    template<typename Callback>
+    void rangeQuery(const Key &lo, const Key &hi, Callback callback) {
+        for (auto &item : buffer) {
+            if (!item.second.erased && inBox(item.first, lo, hi, std::make_index_sequence<KeySize>())) {
+                Reference reference{item.first, item.second.value};
+                callback(reference);
+            }
+        }
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (!boxesIntersect(levels[i].lo, levels[i].hi, lo, hi, std::make_index_sequence<KeySize>())) {
+                continue;
+            }
+            levels[i].tree.rangeQuery(lo, hi, [&](auto &record) {
+                if (isLive(record.first, record.second, i)) {
+                    Reference reference{record.first, record.second.value};
+                    callback(reference);
+                }
+            });
+        }
+    }
+
+    /**
+     * Count the live keys inside the box [lo, hi], see KDTree::rangeCount
+     */
+    size_t rangeCount(const Key &lo, const Key &hi) {
+        size_t count = 0;
+        rangeQuery(lo, hi, [&count](const Reference &) { count++; });
+        return count;
+    }
+
+    /**
+     * Time Complexity: O(1)
+     * @return the number of live keys
+     */
+    size_t size() const { return liveSize; }
+
+    /**
+     * @return the number of levels, empty ones included
+     */
+    size_t levelCount() const { return levels.size(); }
+
+    /**
+     * @return the number of records in the buffer and all levels, shadowed ones and tombstones included
+     */
+    size_t recordCount() const {
+        size_t count = buffer.size();
+        for (auto &level : levels) {
+            count += level.size();
+        }
+        return count;
+    }
+};
+
+#endif //VE281P3_LOG_STRUCTURED_KDTREE_HPP
@@ -0,0 +1,289 @@
+#ifndef VE281P3_MAPPED_KDTREE_HPP
+#define VE281P3_MAPPED_KDTREE_HPP
+
+#include "kdtree.hpp"
+#include "static_kdtree.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * The first bytes of a KDTree image
+ * The image is the header, the keys and then the values, each array starts at a multiple of
+ * MappedKDTreeHeader::ALIGNMENT. The keys are in the BFS order of StaticKDTree, so there are no pointers in it.
+ * A key is packed: its coordinates follow each other in tuple order, without padding (std::tuple is not
+ * trivially copyable, so its object representation is not written). Values are stored as they are in memory.
+ * An image can be opened by programs built for the same architecture with the same key and value types,
+ * which the header checks as far as it can
+ */
+struct MappedKDTreeHeader {
+    static inline constexpr char MAGIC[8] = {'V', 'E', '2', '8', '1', 'K', 'D', 'T'};
+    static inline constexpr uint32_t VERSION = 2;
+    static inline constexpr uint32_t ENDIANNESS = 0x01020304;
+    static inline constexpr uint64_t ALIGNMENT = 64;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t endianness;    // ENDIANNESS as written by the saving machine
+    uint64_t keySize;       // number of dimensions
+    uint64_t keyBytes;      // bytes of a packed key, the sum of the sizes of the key types
+    uint64_t valueBytes;    // sizeof(Value)
+    uint64_t size;          // number of nodes
+    uint64_t keysOffset;    // in bytes from the start of the image
+    uint64_t valuesOffset;
+};
+
+/**
+ * Packing of the keys of a KDTree image, see MappedKDTreeHeader
+ */
+template<typename Key>
+struct MappedKDTreeKey;
+
+template<typename... KeyTypes>
+struct MappedKDTreeKey<std::tuple<KeyTypes...>> {
+    static_assert((std::is_trivially_copyable<KeyTypes>::value && ...),
+                  "MappedKDTree key types must be trivially copyable");
+
+    static inline constexpr size_t BYTES = (sizeof(KeyTypes) + ...);
+
+    template<size_t... DIMS>
+    static void pack(const std::tuple<KeyTypes...> &key, char *out, std::index_sequence<DIMS...>) {
+        size_t offset = 0;
+        ((std::memcpy(out + offset, &std::get<DIMS>(key), sizeof(KeyTypes)), offset += sizeof(KeyTypes)), ...);
+    }
+
+    template<size_t... DIMS>
+    static void unpack(const char *in, std::tuple<KeyTypes...> &key, std::index_sequence<DIMS...>) {
+        size_t offset = 0;
+        ((std::memcpy(&std::get<DIMS>(key), in + offset, sizeof(KeyTypes)), offset += sizeof(KeyTypes)), ...);
+    }
+
+    static void pack(const std::tuple<KeyTypes...> &key, char *out) {
+        pack(key, out, std::index_sequence_for<KeyTypes...>());
+    }
+
+    static void unpack(const char *in, std::tuple<KeyTypes...> &key) {
+        unpack(in, key, std::index_sequence_for<KeyTypes...>());
+    }
+};
+
+/**
+ * Storage of a StaticKDTree in a memory mapped image
+ * The keys are unpacked into memory when the image is mapped, the values are read in place
+ * The mapping is private: values may be written through the tree, but the writes are never
+ * carried to the file, and the pages nobody writes are shared with every process that maps the image
+ */
+template<typename Key, typename Value>
+class MappedKDTreeStorage {
+    void *image = MAP_FAILED;
+    size_t length = 0;
+    std::vector<Key> keys;
+    Value *values = nullptr;
+
+public:
+    MappedKDTreeStorage() = default;
+
+    /**
+     * Map the image at path
+     * @throw std::runtime_error if the file can not be mapped or is not an image of this key and value type
+     * @return the number of nodes in the image
+     */
+    size_t map(const std::string &path, size_t keySize) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can not open KDTree image " + path);
+        }
+        struct stat status{};
+        if (::fstat(fd, &status) != 0 || (size_t) status.st_size < sizeof(MappedKDTreeHeader)) {
+            ::close(fd);
+            throw std::runtime_error("bad KDTree image " + path);
+        }
+        length = (size_t) status.st_size;
+        image = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (image == MAP_FAILED) {
+            throw std::runtime_error("can not map KDTree image " + path);
+        }
+
+        MappedKDTreeHeader header{};
+        std::memcpy(&header, image, sizeof(header));
+        bool valid = std::memcmp(header.magic, MappedKDTreeHeader::MAGIC, sizeof(header.magic)) == 0 &&
+                     header.version == MappedKDTreeHeader::VERSION &&
+                     header.endianness == MappedKDTreeHeader::ENDIANNESS &&
+                     header.keySize == keySize && header.keyBytes == MappedKDTreeKey<Key>::BYTES &&
+                     header.valueBytes == sizeof(Value) && header.valuesOffset % alignof(Value) == 0 &&
+                     header.keysOffset <= length && header.valuesOffset <= length &&
+                     header.size <= (length - header.keysOffset) / MappedKDTreeKey<Key>::BYTES &&
+                     header.size <= (length - header.valuesOffset) / sizeof(Value);
+        if (!valid) {
+            unmap();
+            throw std::runtime_error("bad KDTree image " + path);
+        }
+        const char *packed = static_cast<const char *>(image) + header.keysOffset;
+        keys.resize((size_t) header.size);
+        for (size_t i = 0; i < keys.size(); i++) {
+            MappedKDTreeKey<Key>::unpack(packed + i * MappedKDTreeKey<Key>::BYTES, keys[i]);
+        }
+        values = reinterpret_cast<Value *>(static_cast<char *>(image) + header.valuesOffset);
+        return (size_t) header.size;
+    }
+
+    void unmap() {
+        if (image != MAP_FAILED) {
+            ::munmap(image, length);
+        }
+        image = MAP_FAILED;
+        length = 0;
+        keys.clear();
+        keys.shrink_to_fit();
+        values = nullptr;
+    }
+
+    MappedKDTreeStorage(const MappedKDTreeStorage &) = delete;
+
+    MappedKDTreeStorage &operator=(const MappedKDTreeStorage &) = delete;
+
+    MappedKDTreeStorage(MappedKDTreeStorage &&that) noexcept { *this = std::move(that); }
+
+    MappedKDTreeStorage &operator=(MappedKDTreeStorage &&that) noexcept {
+        if (this != &that) {
+            unmap();
+            std::swap(image, that.image);
+            std::swap(length, that.length);
+            std::swap(keys, that.keys);
+            std::swap(values, that.values);
+        }
+        return *this;
+    }
+
+    ~MappedKDTreeStorage() { unmap(); }
+
+    const Key &key(size_t i) const { return keys[i]; }
+
+    Value &value(size_t i) { return values[i]; }
+
+    /**
+     * @return the size of the mapping in bytes (the pages of the values are only read in when touched)
+     * and of the unpacked keys
+     */
+    size_t bytes() const { return length + keys.capacity() * sizeof(Key); }
+};
+
+/**
+ * An abstract template base of the MappedKDTree class
+ */
+template<typename...>
+class MappedKDTree;
+
+/**
+ * A read-only KDTree queried from an image file, see KDTree::save
+ * Opening an image maps it and unpacks the keys, O(kn); the values are read in place,
+ * so they cost only the page faults of the queries that reach them
+ * The queries are those of StaticKDTree
+ * The key types and the value type must be trivially copyable
+ * @typedef Key         key type
+ * @typedef Value       value type
+ */
+template<typename ValueType, typename... KeyTypes>
+class MappedKDTree<std::tuple<KeyTypes...>, ValueType>
+        : public StaticKDTree<std::tuple<KeyTypes...>, ValueType, true,
+                MappedKDTreeStorage<std::tuple<KeyTypes...>, ValueType>> {
+public:
+    typedef std::tuple<KeyTypes...> Key;
+    typedef ValueType Value;
+    static_assert(std::is_trivially_copyable<Value>::value, "MappedKDTree values must be trivially copyable");
+
+protected:
+    typedef StaticKDTree<Key, Value, true, MappedKDTreeStorage<Key, Value>> Base;
+    typedef StaticKDTree<Key, Value, true> Image;
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + MappedKDTreeHeader::ALIGNMENT - 1) / MappedKDTreeHeader::ALIGNMENT *
+               MappedKDTreeHeader::ALIGNMENT;
+    }
+
+    static void pad(std::ofstream &out, uint64_t &offset, uint64_t target) {
+        static const char zeros[MappedKDTreeHeader::ALIGNMENT] = {};
+        out.write(zeros, (std::streamsize) (target - offset));
+        offset = target;
+    }
+
+public:
+    MappedKDTree() = default;
+
+    /**
+     * Same as open(path)
+     */
+    explicit MappedKDTree(const std::string &path) {
+        this->treeSize = this->storage.map(path, Base::KeySize);
+    }
+
+    /**
+     * Map the image at path
+     * Time Complexity: O(1) (plus the page faults of later queries)
+     * @throw std::runtime_error if the file can not be mapped or is not an image of this key and value type
+     */
+    static MappedKDTree open(const std::string &path) {
+        return MappedKDTree(path);
+    }
+
+    /**
+     * Write key-value pairs to an image at path
+     * The image is written next to path and renamed over it, so processes that mapped the old image keep it
+     * If a key appears more than once, the last value wins (same as KDTree(vector))
+     * Time Complexity: O(kn log n)
+     * @throw std::runtime_error if the file can not be written
+     */
+    static void save(std::vector<std::pair<Key, Value>> v, const std::string &path) {
+        Image tree(std::move(v));
+        size_t size = tree.size();
+        MappedKDTreeHeader header{};
+        std::memcpy(header.magic, MappedKDTreeHeader::MAGIC, sizeof(header.magic));
+        header.version = MappedKDTreeHeader::VERSION;
+        header.endianness = MappedKDTreeHeader::ENDIANNESS;
+        header.keySize = Base::KeySize;
+        header.keyBytes = MappedKDTreeKey<Key>::BYTES;
+        header.valueBytes = sizeof(Value);
+        header.size = size;
+        header.keysOffset = align(sizeof(header));
+        header.valuesOffset = align(header.keysOffset + size * MappedKDTreeKey<Key>::BYTES);
+
+        std::string temporary = path + ".tmp";
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        uint64_t offset = sizeof(header);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        pad(out, offset, header.keysOffset);
+        // the nodes of the Image are in BFS order already
+        char packed[MappedKDTreeKey<Key>::BYTES];
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            MappedKDTreeKey<Key>::pack(it.key(), packed);
+            out.write(packed, (std::streamsize) sizeof(packed));
+        }
+        offset += size * MappedKDTreeKey<Key>::BYTES;
+        pad(out, offset, header.valuesOffset);
+        if (size > 0) {
+            out.write(reinterpret_cast<const char *>(&tree.begin().value()),
+                      (std::streamsize) (size * sizeof(Value)));
+        }
+        out.close();
+        if (!out || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("can not write KDTree image " + path);
+        }
+    }
+};
+
+#endif //VE281P3_MAPPED_KDTREE_HPP
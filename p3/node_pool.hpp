@@ -0,0 +1,134 @@
+#ifndef VE281P3_NODE_POOL_HPP
+#define VE281P3_NODE_POOL_HPP
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * A slab allocator for the nodes of one tree
+ * Objects are carved out of slabs of SlabSize objects, a destroyed object goes to a free list
+ * and its storage is reused by the next create
+ * The pool never runs destructors on its own: clear only releases the slabs, so the owner
+ * must destroy the live objects first unless T is trivially destructible
+ * Not thread safe, except that the storage returned by allocateBulk may be filled by many threads
+ * @tparam T object type, at least as large as a pointer
+ * @tparam SlabSize number of objects in a slab
+ */
+template<typename T, size_t SlabSize = 256>
+class NodePool {
+    static_assert(sizeof(T) >= sizeof(void *), "NodePool objects must be able to hold a free list link");
+    static_assert(SlabSize > 0, "NodePool slabs must not be empty");
+
+    struct FreeSlot {
+        FreeSlot *next;
+    };
+
+    std::vector<std::pair<T *, size_t>> slabs;  // storage and capacity of every slab
+    T *current = nullptr;       // slab that create carves from
+    size_t used = SlabSize;     // objects taken from current
+    FreeSlot *freeList = nullptr;
+
+    T *allocateSlab(size_t count) {
+        T *slab = std::allocator<T>().allocate(count);
+        slabs.emplace_back(slab, count);
+        return slab;
+    }
+
+public:
+    NodePool() = default;
+
+    NodePool(const NodePool &) = delete;
+
+    NodePool &operator=(const NodePool &) = delete;
+
+    ~NodePool() { clear(); }
+
+    /**
+     * Time Complexity: O(1), amortized over the slab allocations
+     * @return storage for one object, nothing is constructed
+     */
+    void *allocate() {
+        if (freeList != nullptr) {
+            FreeSlot *slot = freeList;
+            freeList = slot->next;
+            return slot;
+        }
+        if (used == SlabSize) {
+            current = allocateSlab(SlabSize);
+            used = 0;
+        }
+        return current + used++;
+    }
+
+    /**
+     * Give back storage returned by allocate or allocateBulk, the object must already be destroyed
+     * Time Complexity: O(1)
+     */
+    void deallocate(void *storage) {
+        FreeSlot *slot = ::new(storage) FreeSlot;
+        slot->next = freeList;
+        freeList = slot;
+    }
+
+    /**
+     * Construct an object in the pool
+     * Time Complexity: O(1) plus the constructor
+     */
+    template<typename... Args>
+    T *create(Args &&... args) {
+        void *storage = allocate();
+        try {
+            return ::new(storage) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(storage);
+            throw;
+        }
+    }
+
+    /**
+     * Destroy an object created in the pool and recycle its storage
+     * Time Complexity: O(1) plus the destructor
+     */
+    void destroy(T *object) {
+        object->~T();
+        deallocate(object);
+    }
+
+    /**
+     * Storage for count objects in a slab of its own, nothing is constructed
+     * The objects are given back one by one with deallocate or destroy, or all at once by clear
+     * Time Complexity: O(1)
+     */
+    T *allocateBulk(size_t count) {
+        return count == 0 ? nullptr : allocateSlab(count);
+    }
+
+    /**
+     * Release all slabs, the objects in them must already be destroyed (or trivially destructible)
+     * Time Complexity: O(number of slabs)
+     */
+    void clear() {
+        for (auto &slab : slabs) {
+            std::allocator<T>().deallocate(slab.first, slab.second);
+        }
+        slabs.clear();
+        current = nullptr;
+        used = SlabSize;
+        freeList = nullptr;
+    }
+
+    /**
+     * @return the memory held by the slabs in bytes
+     */
+    size_t bytes() const {
+        size_t count = 0;
+        for (auto &slab : slabs) {
+            count += slab.second;
+        }
+        return count * sizeof(T);
+    }
+};
+
+#endif //VE281P3_NODE_POOL_HPP
@@ -0,0 +1,494 @@
+#ifndef VE281P3_PERSISTENT_KDTREE_HPP
+#define VE281P3_PERSISTENT_KDTREE_HPP
+
+#include "kdtree.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * An abstract template base of the PersistentKDTree class
+ */
+template<typename...>
+class PersistentKDTree;
+
+/**
+ * A KDTree for one writer and many concurrent readers, without locks
+ * The nodes are immutable: insert and erase copy the path from the root to the changed node
+ * (path copying) and publish the new root with one atomic store, the rest of the tree is shared
+ * between the versions. A reader pins the current version with snapshot() and traverses it
+ * without any synchronization; it never blocks the writer and never sees a half-done update.
+ * The nodes a write replaces are retired, and freed once no snapshot pinned before the write
+ * is alive any more (epoch based reclamation): every write advances a global epoch, and a snapshot
+ * records the epoch it was taken in in one of READER_SLOTS slots, which the writer scans.
+ *
+ * Thread safety: insert, erase and the destructor must be called by one writer at a time;
+ * snapshot() and everything on a Snapshot may be called by any number of threads at the same time.
+ * All snapshots must be destroyed before the tree.
+ *
+ * The tree is not rebalanced: build it with the vector constructor, which balances it like KDTree(vector);
+ * while it stays balanced, an insert or erase allocates O(log n) nodes.
+ * The time complexity of functions are based on n and k
+ * n is the size of the tree
+ * k is the number of dimensions
+ * @typedef Key         key type
+ * @typedef Value       value type
+ * @typedef Data        key-value pair
+ * @static  KeySize     k (number of dimensions)
+ */
+template<typename ValueType, typename... KeyTypes>
+class PersistentKDTree<std::tuple<KeyTypes...>, ValueType> {
+public:
+    typedef std::tuple<KeyTypes...> Key;
+    typedef ValueType Value;
+    typedef std::pair<const Key, Value> Data;
+    static inline constexpr size_t KeySize = std::tuple_size<Key>::value;
+    static_assert(KeySize > 0, "Can not construct KDTree with zero dimension");
+    static constexpr size_t READER_SLOTS = 128;     // maximum number of snapshots alive at the same time
+
+protected:
+    struct Node {
+        Data data;
+        const Node *left;
+        const Node *right;
+        size_t size;    // number of nodes in the subtree
+
+        Node(const Key &key, const Value &value, const Node *left, const Node *right) :
+                data(key, value), left(left), right(right),
+                size(1 + (left != nullptr ? left->size : 0) + (right != nullptr ? right->size : 0)) {}
+
+        const Key &key() const { return data.first; }
+    };
+
+    /**
+     * The epoch a snapshot was taken in, 0 if the slot is free
+     * One slot per cache line, so that readers pinning at the same time do not share lines
+     */
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch{0};
+    };
+
+    std::atomic<const Node *> root{nullptr};
+    std::atomic<uint64_t> epoch{1};
+    ReaderSlot slots[READER_SLOTS];
+    std::deque<std::pair<uint64_t, std::vector<const Node *>>> retired;    // written by the writer only
+
+public:
+    /**
+     * A pinned version of the tree, readable without locks while the writer goes on
+     * It holds one reader slot until it is destroyed, so keep it short lived
+     */
+    class Snapshot {
+    private:
+        ReaderSlot *slot;
+        const Node *root;
+
+        Snapshot(ReaderSlot *slot, const Node *root) : slot(slot), root(root) {}
+
+    public:
+        friend class PersistentKDTree;
+
+        Snapshot(const Snapshot &) = delete;
+
+        Snapshot &operator=(const Snapshot &) = delete;
+
+        Snapshot(Snapshot &&that) noexcept : slot(that.slot), root(that.root) {
+            that.slot = nullptr;
+            that.root = nullptr;
+        }
+
+        ~Snapshot() {
+            if (slot != nullptr) {
+                slot->epoch.store(0, std::memory_order_release);
+            }
+        }
+
+        /**
+         * Time Complexity: O(k log n)
+         * @return the value of key, or nullptr if it is not in this version
+         */
+        const Value *find(const Key &key) const {
+            const Node *node = findNode<0>(key, root);
+            return node != nullptr ? &node->data.second : nullptr;
+        }
+
+        bool contains(const Key &key) const { return find(key) != nullptr; }
+
+        /**
+         * Same as KDTree::nearest
+         * @return the nearest key-value pair, or nullptr if this version is empty
+         */
+        template<typename Metric = KDTreeL2Metric>
+        const Data *nearest(const Key &key) const {
+            const Node *best = nullptr;
+            double bound = std::numeric_limits<double>::infinity();
+            nearestSearch<0, Metric>(key, root, best, bound);
+            return best != nullptr ? &best->data : nullptr;
+        }
+
+        /**
+         * Same as KDTree::rangeQuery, the callback takes const Data &
+         */
+        template<typename Callback>
+        void rangeQuery(const Key &lo, const Key &hi, Callback callback) const {
+            rangeSearch<0>(lo, hi, root, callback);
+        }
+
+        /**
+         * Same as KDTree::rangeCount
+         */
+        size_t rangeCount(const Key &lo, const Key &hi) const {
+            size_t count = 0;
+            rangeQuery(lo, hi, [&count](const Data &) { count++; });
+            return count;
+        }
+
+        /**
+         * @return the size of this version
+         */
+        size_t size() const { return root != nullptr ? root->size : 0; }
+    };
+
+protected:
+    template<size_t DIM>
+    static bool compareKey_DIM(const Key &a, const Key &b) {
+        return std::get<DIM>(a) < std::get<DIM>(b);
+    }
+
+    template<size_t DIM>
+    static bool compareData_DIM(const std::pair<Key, Value> &a, const std::pair<Key, Value> &b) {
+        return std::get<DIM>(a.first) < std::get<DIM>(b.first);
+    }
+
+    template<size_t DIM>
+    static const Node *findNode(const Key &key, const Node *node) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (node == nullptr) {
+            return nullptr;
+        }
+        if (node->key() == key) {
+            return node;
+        }
+        return findNode<DIM_NEXT>(key, compareKey_DIM<DIM>(key, node->key()) ? node->left : node->right);
+    }
+
+    template<typename Metric, size_t... DIMS>
+    static double reducedDistance(const Key &a, const Key &b, std::index_sequence<DIMS...>) {
+        double sum = 0;
+        ((sum = Metric::accumulate(sum, Metric::axis((double) std::get<DIMS>(a), (double) std::get<DIMS>(b)))), ...);
+        return sum;
+    }
+
+    /**
+     * Branch-and-bound search for the nearest node, see KDTree::nearestSearch
+     */
+    template<size_t DIM, typename Metric>
+    static void nearestSearch(const Key &key, const Node *node, const Node *&best, double &bound) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (node == nullptr) {
+            return;
+        }
+        double distance = reducedDistance<Metric>(key, node->key(), std::make_index_sequence<KeySize>());
+        if (distance < bound) {
+            bound = distance;
+            best = node;
+        }
+        bool goLeft = compareKey_DIM<DIM>(key, node->key());
+        nearestSearch<DIM_NEXT, Metric>(key, goLeft ? node->left : node->right, best, bound);
+        if (Metric::axis((double) std::get<DIM>(key), (double) std::get<DIM>(node->key())) <= bound) {
+            nearestSearch<DIM_NEXT, Metric>(key, goLeft ? node->right : node->left, best, bound);
+        }
+    }
+
+    template<size_t... DIMS>
+    static bool inBox(const Key &key, const Key &lo, const Key &hi, std::index_sequence<DIMS...>) {
+        return ((!(std::get<DIMS>(key) < std::get<DIMS>(lo)) && !(std::get<DIMS>(hi) < std::get<DIMS>(key))) && ...);
+    }
+
+    /**
+     * Visit every node in the box [lo, hi], see KDTree::rangeSearch
+     */
+    template<size_t DIM, typename Callback>
+    static void rangeSearch(const Key &lo, const Key &hi, const Node *node, Callback &callback) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (node == nullptr) {
+            return;
+        }
+        if (inBox(node->key(), lo, hi, std::make_index_sequence<KeySize>())) {
+            callback(node->data);
+        }
+        if (!compareKey_DIM<DIM>(node->key(), lo)) {
+            rangeSearch<DIM_NEXT>(lo, hi, node->left, callback);
+        }
+        if (!compareKey_DIM<DIM>(hi, node->key())) {
+            rangeSearch<DIM_NEXT>(lo, hi, node->right, callback);
+        }
+    }
+
+    /**
+     * Find the minimum node on a dimension
+     * Time Complexity: O(n^(1-1/k))
+     */
+    template<size_t DIM_CMP, size_t DIM>
+    static const Node *findMin(const Node *node) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (node == nullptr) {
+            return nullptr;
+        }
+        const Node *best = node;
+        auto consider = [&best](const Node *candidate) {
+            if (candidate != nullptr && (std::get<DIM_CMP>(candidate->key()) < std::get<DIM_CMP>(best->key()) ||
+                                         (std::get<DIM_CMP>(candidate->key()) == std::get<DIM_CMP>(best->key()) &&
+                                          candidate->key() < best->key()))) {
+                best = candidate;
+            }
+        };
+        consider(findMin<DIM_CMP, DIM_NEXT>(node->left));
+        if (DIM != DIM_CMP) {
+            consider(findMin<DIM_CMP, DIM_NEXT>(node->right));
+        }
+        return best;
+    }
+
+    /**
+     * Insert by path copying, the copied nodes are added to garbage
+     * Time Complexity: O(k log n)
+     * @return the root of the new version of the subtree
+     */
+    template<size_t DIM>
+    const Node *insert(const Node *node, const Key &key, const Value &value, std::vector<const Node *> &garbage) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (node == nullptr) {
+            return new Node(key, value, nullptr, nullptr);
+        }
+        garbage.push_back(node);
+        if (node->key() == key) {
+            return new Node(key, value, node->left, node->right);
+        }
+        if (compareKey_DIM<DIM>(key, node->key())) {
+            return new Node(node->key(), node->data.second, insert<DIM_NEXT>(node->left, key, value, garbage), node->right);
+        }
+        return new Node(node->key(), node->data.second, node->left, insert<DIM_NEXT>(node->right, key, value, garbage));
+    }
+
+    /**
+     * Erase by path copying, the copied and removed nodes are added to garbage
+     * A node with children is replaced by a copy of the minimum on DIM of a subtree, as KDTree::erase
+     * Time Complexity: max{O(k log n), O(findMin)}
+     * @return the root of the new version of the subtree
+     */
+    template<size_t DIM>
+    const Node *erase(const Node *node, const Key &key, std::vector<const Node *> &garbage) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (node == nullptr) {
+            return nullptr;
+        }
+        if (node->key() == key) {
+            garbage.push_back(node);
+            if (node->right != nullptr) {
+                const Node *minNode = findMin<DIM, DIM_NEXT>(node->right);
+                return new Node(minNode->key(), minNode->data.second, node->left,
+                                erase<DIM_NEXT>(node->right, minNode->key(), garbage));
+            }
+            if (node->left != nullptr) {
+                const Node *minNode = findMin<DIM, DIM_NEXT>(node->left);
+                return new Node(minNode->key(), minNode->data.second, nullptr,
+                                erase<DIM_NEXT>(node->left, minNode->key(), garbage));
+            }
+            return nullptr;
+        }
+        bool goLeft = compareKey_DIM<DIM>(key, node->key());
+        const Node *child = goLeft ? node->left : node->right;
+        size_t before = garbage.size();
+        const Node *newChild = erase<DIM_NEXT>(child, key, garbage);
+        if (garbage.size() == before) {
+            return node;    // key not found, nothing to copy
+        }
+        garbage.push_back(node);
+        return goLeft ? new Node(node->key(), node->data.second, newChild, node->right)
+                      : new Node(node->key(), node->data.second, node->left, newChild);
+    }
+
+    /**
+     * Build a balanced subtree from [first, last), see KDTree::buildRange
+     * Time complexity: O(kn log n)
+     */
+    template<size_t DIM, typename RandomIt>
+    static const Node *buildRange(RandomIt first, RandomIt last) {
+        if (first == last) {
+            return nullptr;
+        }
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        auto median = first + (last - first - 1) / 2;
+        std::nth_element(first, median, last, compareData_DIM<DIM>);
+        auto equal = std::partition(first, median, [&median](const auto &data) {
+            return compareData_DIM<DIM>(data, *median);
+        });
+        std::iter_swap(equal, median);
+        median = equal;
+        const Node *left = buildRange<DIM_NEXT>(first, median);
+        const Node *right = buildRange<DIM_NEXT>(median + 1, last);
+        return new Node(median->first, median->second, left, right);
+    }
+
+    static void deleteTree(const Node *node) {
+        std::vector<const Node *> stack;
+        if (node != nullptr) {
+            stack.push_back(node);
+        }
+        while (!stack.empty()) {
+            node = stack.back();
+            stack.pop_back();
+            if (node->left != nullptr) {
+                stack.push_back(node->left);
+            }
+            if (node->right != nullptr) {
+                stack.push_back(node->right);
+            }
+            delete node;
+        }
+    }
+
+    /**
+     * Make newRoot the current version, retire the nodes it replaced and free what no reader can see
+     * Time Complexity: O(READER_SLOTS + number of freed nodes)
+     */
+    void publish(const Node *newRoot, std::vector<const Node *> &garbage) {
+        root.store(newRoot);
+        if (!garbage.empty()) {
+            retired.emplace_back(epoch.load(), std::move(garbage));
+        }
+        // a snapshot that pins the new epoch loads the root after this, so it can only see newRoot
+        epoch.fetch_add(1);
+        reclaim();
+    }
+
+    /**
+     * Free the retired nodes of the epochs before the oldest pinned one
+     */
+    void reclaim() {
+        if (retired.empty()) {
+            return;
+        }
+        uint64_t oldest = epoch.load();
+        for (auto &slot : slots) {
+            uint64_t pinned = slot.epoch.load();
+            if (pinned != 0 && pinned < oldest) {
+                oldest = pinned;
+            }
+        }
+        while (!retired.empty() && retired.front().first < oldest) {
+            for (const Node *node : retired.front().second) {
+                delete node;
+            }
+            retired.pop_front();
+        }
+    }
+
+public:
+    PersistentKDTree() = default;
+
+    /**
+     * Time complexity: O(kn log n)
+     * If a key appears more than once, the last value wins, as in KDTree(vector)
+     */
+    explicit PersistentKDTree(std::vector<std::pair<Key, Value>> v) {
+        std::stable_sort(v.begin(), v.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        auto newHead = std::unique(v.rbegin(), v.rend(), [](const auto &a, const auto &b) { return a.first == b.first; });
+        v.erase(v.begin(), newHead.base());
+        root.store(buildRange<0>(v.begin(), v.end()));
+    }
+
+    PersistentKDTree(const PersistentKDTree &) = delete;
+
+    PersistentKDTree &operator=(const PersistentKDTree &) = delete;
+
+    /**
+     * Time complexity: O(n + retired nodes), no snapshot may be alive
+     */
+    ~PersistentKDTree() {
+        deleteTree(root.load());
+        for (auto &epochNodes : retired) {
+            for (const Node *node : epochNodes.second) {
+                delete node;
+            }
+        }
+    }
+
+    /**
+     * Pin the current version for reading
+     * Waits (yielding) only if READER_SLOTS snapshots are already alive
+     * Time Complexity: O(1) unless the slots are crowded
+     */
+    Snapshot snapshot() {
+        size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % READER_SLOTS;
+        for (size_t i = start;; i = (i + 1) % READER_SLOTS) {
+            uint64_t expected = 0;
+            if (slots[i].epoch.compare_exchange_strong(expected, epoch.load())) {
+                return Snapshot(&slots[i], root.load());
+            }
+            if ((i + 1) % READER_SLOTS == start) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /**
+     * Insert the key-value pair, if the key already exists, replace the value only
+     * Writer only
+     * Time Complexity: O(k log n)
+     * @return whether insertion took place
+     */
+    bool insert(const Key &key, const Value &value) {
+        const Node *current = root.load(std::memory_order_relaxed);
+        size_t before = current != nullptr ? current->size : 0;
+        std::vector<const Node *> garbage;
+        const Node *newRoot = insert<0>(current, key, value, garbage);
+        publish(newRoot, garbage);
+        return newRoot->size > before;
+    }
+
+    /**
+     * Writer only
+     * Time Complexity: max{O(k log n), O(findMin)}
+     * @return whether the key was erased
+     */
+    bool erase(const Key &key) {
+        std::vector<const Node *> garbage;
+        const Node *newRoot = erase<0>(root.load(std::memory_order_relaxed), key, garbage);
+        if (garbage.empty()) {
+            return false;
+        }
+        publish(newRoot, garbage);
+        return true;
+    }
+
+    /**
+     * @return the size of the current version
+     */
+    size_t size() const {
+        const Node *current = root.load();
+        return current != nullptr ? current->size : 0;
+    }
+
+    /**
+     * @return the number of retired nodes that some snapshot may still read
+     */
+    size_t retiredNodes() const {
+        size_t count = 0;
+        for (auto &epochNodes : retired) {
+            count += epochNodes.second.size();
+        }
+        return count;
+    }
+};
+
+#endif //VE281P3_PERSISTENT_KDTREE_HPP
@@ -0,0 +1,497 @@
+#ifndef VE281P3_STATIC_KDTREE_HPP
+#define VE281P3_STATIC_KDTREE_HPP
+
+#include "kdtree.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * Storage of the nodes of a StaticKDTree, in BFS order
+ * By default a key and its value are stored together,
+ * the specialization below keeps the keys in their own array so that queries only read keys
+ */
+template<typename Key, typename Value, bool SeparateValues>
+struct StaticKDTreeStorage {
+    std::vector<std::pair<Key, Value>> nodes;
+
+    void resize(size_t size) { nodes.resize(size); }
+
+    void set(size_t i, Key &&key, Value &&value) { nodes[i] = {std::move(key), std::move(value)}; }
+
+    const Key &key(size_t i) const { return nodes[i].first; }
+
+    Value &value(size_t i) { return nodes[i].second; }
+
+    size_t bytes() const { return nodes.capacity() * sizeof(std::pair<Key, Value>); }
+};
+
+template<typename Key, typename Value>
+struct StaticKDTreeStorage<Key, Value, true> {
+    std::vector<Key> keys;
+    std::vector<Value> values;
+
+    void resize(size_t size) {
+        keys.resize(size);
+        values.resize(size);
+    }
+
+    void set(size_t i, Key &&key, Value &&value) {
+        keys[i] = std::move(key);
+        values[i] = std::move(value);
+    }
+
+    const Key &key(size_t i) const { return keys[i]; }
+
+    Value &value(size_t i) { return values[i]; }
+
+    size_t bytes() const { return keys.capacity() * sizeof(Key) + values.capacity() * sizeof(Value); }
+};
+
+/**
+ * An abstract template base of the StaticKDTree class
+ * Storage has resize, set, key, value and bytes like StaticKDTreeStorage,
+ * a storage that is filled some other way (see MappedKDTree) only needs key, value and bytes
+ */
+template<typename Key, typename Value, bool SeparateValues = false,
+        typename Storage = StaticKDTreeStorage<Key, Value, SeparateValues>>
+class StaticKDTree;
+
+/**
+ * A read-only KDTree stored implicitly in one array
+ * The tree is a complete binary tree in BFS (Eytzinger) order: the root is at index 0 and
+ * the children of node i are at 2i+1 and 2i+2, so there are no pointers and no per-node allocation
+ * It is balanced the same way as KDTree(vector): the node at depth d splits on dimension d % k,
+ * its left subtree is not greater and its right subtree is not less on that dimension
+ * (keys equal to the splitting key may be on both sides, the queries handle that)
+ * The time complexity of functions are based on n and k
+ * n is the size of the KDTree
+ * k is the number of dimensions
+ * Use StaticKDTree<std::tuple<KeyTypes...>, Value, true> to store keys and values in separate arrays
+ * @typedef Key         key type
+ * @typedef Value       value type
+ * @static  KeySize     k (number of dimensions)
+ */
+template<typename ValueType, typename... KeyTypes, bool SeparateValues, typename Storage>
+class StaticKDTree<std::tuple<KeyTypes...>, ValueType, SeparateValues, Storage> {
+public:
+    typedef std::tuple<KeyTypes...> Key;
+    typedef ValueType Value;
+    static inline constexpr size_t KeySize = std::tuple_size<Key>::value;
+    static_assert(KeySize > 0, "Can not construct KDTree with zero dimension");
+
+    /**
+     * A key-value reference to a node, it has first and second like the Data of KDTree
+     */
+    struct Reference {
+        const Key &first;
+        Value &second;
+    };
+
+    /**
+     * A forward iterator of the nodes in array order (not sorted)
+     */
+    class Iterator {
+    private:
+        StaticKDTree *tree;
+        size_t index;
+
+        struct Pointer {
+            Reference reference;
+
+            Reference *operator->() { return &reference; }
+        };
+
+        Iterator(StaticKDTree *tree, size_t index) : tree(tree), index(index) {}
+
+    public:
+        friend class StaticKDTree;
+
+        Iterator() = delete;
+
+        Iterator &operator++() {
+            ++index;
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator temp = *this;
+            ++index;
+            return temp;
+        }
+
+        bool operator==(const Iterator &that) const { return index == that.index; }
+
+        bool operator!=(const Iterator &that) const { return index != that.index; }
+
+        Reference operator*() const { return {tree->storage.key(index), tree->storage.value(index)}; }
+
+        Pointer operator->() const { return {**this}; }
+
+        const Key &key() const { return tree->storage.key(index); }
+
+        Value &value() const { return tree->storage.value(index); }
+    };
+
+protected:
+    Storage storage;
+    size_t treeSize = 0;
+
+    static size_t leftChild(size_t i) { return 2 * i + 1; }
+
+    static size_t rightChild(size_t i) { return 2 * i + 2; }
+
+    /**
+     * Size of the left subtree of a complete binary tree with size nodes
+     * Time Complexity: O(1)
+     */
+    static size_t leftSubtreeSize(size_t size) {
+        if (size <= 1) {
+            return 0;
+        }
+        size_t levels = 0;                  // number of full levels
+        while (((size_t) 2 << levels) - 1 <= size) {
+            levels++;
+        }
+        size_t half = (size_t) 1 << (levels - 1);               // full nodes of the left subtree + 1
+        size_t bottom = size - (((size_t) 1 << levels) - 1);    // nodes on the last, partial level
+        return half - 1 + std::min(bottom, half);
+    }
+
+    /**
+     * Move the range [first, last) of a buffer into the subtree rooted at index
+     * Time Complexity: O(kn log n)
+     */
+    template<size_t DIM, typename RandomIt>
+    void buildRange(RandomIt first, RandomIt last, size_t index) {
+        if (first == last) {
+            return;
+        }
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        auto median = first + leftSubtreeSize((size_t) (last - first));
+        std::nth_element(first, median, last, [](const auto &a, const auto &b) {
+            return std::get<DIM>(a.first) < std::get<DIM>(b.first);
+        });
+        storage.set(index, std::move(median->first), std::move(median->second));
+        buildRange<DIM_NEXT>(first, median, leftChild(index));
+        buildRange<DIM_NEXT>(median + 1, last, rightChild(index));
+    }
+
+    /**
+     * Find the node with key
+     * Time Complexity: O(k log n) (more if many keys are equal to key on some dimension)
+     * @return index of the node, or treeSize if not found
+     */
+    template<size_t DIM>
+    size_t find(const Key &key, size_t index) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (index >= treeSize) {
+            return treeSize;
+        }
+        const Key &nodeKey = storage.key(index);
+        if (nodeKey == key) {
+            return index;
+        }
+        if (std::get<DIM>(key) < std::get<DIM>(nodeKey)) {
+            return find<DIM_NEXT>(key, leftChild(index));
+        }
+        if (std::get<DIM>(nodeKey) < std::get<DIM>(key)) {
+            return find<DIM_NEXT>(key, rightChild(index));
+        }
+        // equal on DIM, the key may be on either side
+        size_t found = find<DIM_NEXT>(key, leftChild(index));
+        return found != treeSize ? found : find<DIM_NEXT>(key, rightChild(index));
+    }
+
+    /**
+     * Compare two nodes on a dimension, same as KDTree::compareNode
+     * @return index of the minimum / maximum of two nodes (treeSize stands for none)
+     */
+    template<size_t DIM_CMP, typename Compare>
+    size_t compareIndex(size_t a, size_t b, Compare compare = Compare()) const {
+        if (a == treeSize) return b;
+        if (b == treeSize) return a;
+        const Key &keyA = storage.key(a);
+        const Key &keyB = storage.key(b);
+        if (std::get<DIM_CMP>(keyA) != std::get<DIM_CMP>(keyB)) {
+            return compare(std::get<DIM_CMP>(keyA), std::get<DIM_CMP>(keyB)) ? a : b;
+        }
+        return compare(keyA, keyB) ? a : b;
+    }
+
+    template<size_t DIM_CMP, size_t DIM>
+    size_t findMin(size_t index) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (index >= treeSize) {
+            return treeSize;
+        }
+        size_t min = findMin<DIM_CMP, DIM_NEXT>(leftChild(index));
+        if (DIM != DIM_CMP) {
+            min = compareIndex<DIM_CMP, std::less<>>(min, findMin<DIM_CMP, DIM_NEXT>(rightChild(index)));
+        }
+        return compareIndex<DIM_CMP, std::less<>>(min, index);
+    }
+
+    template<size_t DIM_CMP, size_t DIM>
+    size_t findMax(size_t index) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (index >= treeSize) {
+            return treeSize;
+        }
+        size_t max = findMax<DIM_CMP, DIM_NEXT>(rightChild(index));
+        if (DIM != DIM_CMP) {
+            max = compareIndex<DIM_CMP, std::greater<>>(max, findMax<DIM_CMP, DIM_NEXT>(leftChild(index)));
+        }
+        return compareIndex<DIM_CMP, std::greater<>>(max, index);
+    }
+
+    template<size_t DIM>
+    size_t findMinDynamic(size_t dim) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (dim >= KeySize) {
+            dim %= KeySize;
+        }
+        if (dim == DIM) return findMin<DIM, 0>(0);
+        return findMinDynamic<DIM_NEXT>(dim);
+    }
+
+    template<size_t DIM>
+    size_t findMaxDynamic(size_t dim) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (dim >= KeySize) {
+            dim %= KeySize;
+        }
+        if (dim == DIM) return findMax<DIM, 0>(0);
+        return findMaxDynamic<DIM_NEXT>(dim);
+    }
+
+    template<typename Metric, size_t... DIMS>
+    static double reducedDistance(const Key &a, const Key &b, std::index_sequence<DIMS...>) {
+        double sum = 0;
+        ((sum = Metric::accumulate(sum, Metric::axis((double) std::get<DIMS>(a), (double) std::get<DIMS>(b)))), ...);
+        return sum;
+    }
+
+    template<typename Metric>
+    static double reducedDistance(const Key &a, const Key &b) {
+        return reducedDistance<Metric>(a, b, std::make_index_sequence<KeySize>());
+    }
+
+    /**
+     * Branch-and-bound search for the nodes near key, see KDTree::nearestSearch
+     * The collector has bound() and add(distance, index)
+     */
+    template<size_t DIM, typename Metric, typename Collector>
+    void nearestSearch(const Key &key, size_t index, Collector &collector) const {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (index >= treeSize) {
+            return;
+        }
+        const Key &nodeKey = storage.key(index);
+        collector.add(reducedDistance<Metric>(key, nodeKey), index);
+        bool goLeft = std::get<DIM>(key) < std::get<DIM>(nodeKey);
+        nearestSearch<DIM_NEXT, Metric>(key, goLeft ? leftChild(index) : rightChild(index), collector);
+        if (Metric::axis((double) std::get<DIM>(key), (double) std::get<DIM>(nodeKey)) <= collector.bound()) {
+            nearestSearch<DIM_NEXT, Metric>(key, goLeft ? rightChild(index) : leftChild(index), collector);
+        }
+    }
+
+    struct NearestHeap {
+        size_t k;
+        std::vector<std::pair<double, size_t>> items;
+
+        explicit NearestHeap(size_t k) : k(k) { items.reserve(k); }
+
+        double bound() const {
+            return items.size() < k ? std::numeric_limits<double>::infinity() : items.front().first;
+        }
+
+        void add(double distance, size_t index) {
+            if (items.size() < k) {
+                items.emplace_back(distance, index);
+                std::push_heap(items.begin(), items.end());
+            } else if (distance < items.front().first) {
+                std::pop_heap(items.begin(), items.end());
+                items.back() = {distance, index};
+                std::push_heap(items.begin(), items.end());
+            }
+        }
+    };
+
+    struct RadiusCollector {
+        double radius;
+        std::vector<std::pair<double, size_t>> items;
+
+        explicit RadiusCollector(double radius) : radius(radius) {}
+
+        double bound() const { return radius; }
+
+        void add(double distance, size_t index) {
+            if (distance <= radius) {
+                items.emplace_back(distance, index);
+            }
+        }
+    };
+
+    std::vector<Iterator> sortedIterators(std::vector<std::pair<double, size_t>> &items) {
+        std::sort(items.begin(), items.end());
+        std::vector<Iterator> result;
+        result.reserve(items.size());
+        for (auto &item : items) {
+            result.push_back(Iterator(this, item.second));
+        }
+        return result;
+    }
+
+    template<size_t... DIMS>
+    static bool inBox(const Key &key, const Key &lo, const Key &hi, std::index_sequence<DIMS...>) {
+        return ((!(std::get<DIMS>(key) < std::get<DIMS>(lo)) && !(std::get<DIMS>(hi) < std::get<DIMS>(key))) && ...);
+    }
+
+    /**
+     * Visit every node in the box [lo, hi], see KDTree::rangeSearch
+     */
+    template<size_t DIM, typename Callback>
+    void rangeSearch(const Key &lo, const Key &hi, size_t index, Callback &callback) {
+        constexpr size_t DIM_NEXT = (DIM + 1) % KeySize;
+        if (index >= treeSize) {
+            return;
+        }
+        const Key &nodeKey = storage.key(index);
+        if (inBox(nodeKey, lo, hi, std::make_index_sequence<KeySize>())) {
+            Reference reference{nodeKey, storage.value(index)};
+            callback(reference);
+        }
+        if (!(std::get<DIM>(nodeKey) < std::get<DIM>(lo))) {
+            rangeSearch<DIM_NEXT>(lo, hi, leftChild(index), callback);
+        }
+        if (!(std::get<DIM>(hi) < std::get<DIM>(nodeKey))) {
+            rangeSearch<DIM_NEXT>(lo, hi, rightChild(index), callback);
+        }
+    }
+
+public:
+    StaticKDTree() = default;
+
+    /**
+     * Build the tree from key-value pairs
+     * If a key appears more than once, the last value wins (same as KDTree(vector))
+     * Time complexity: O(kn log n)
+     * @param v we pass by value here because v need to be modified
+     */
+    explicit StaticKDTree(std::vector<std::pair<Key, Value>> v) {
+        std::stable_sort(v.begin(), v.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        auto new_head = std::unique(v.rbegin(), v.rend(), [](const auto &a, const auto &b) {
+            return a.first == b.first;
+        });
+        v.erase(v.begin(), new_head.base());
+
+        treeSize = v.size();
+        storage.resize(treeSize);
+        buildRange<0>(v.begin(), v.end(), 0);
+    }
+
+    Iterator begin() { return Iterator(this, 0); }
+
+    Iterator end() { return Iterator(this, treeSize); }
+
+    /**
+     * Time Complexity: O(k log n) (more if many keys are equal on some dimension)
+     * @param key
+     * @return iterator of the key, or end() if not found
+     */
+    Iterator find(const Key &key) {
+        return Iterator(this, find<0>(key, 0));
+    }
+
+    /**
+     * Find a node with the minimum key on a dimension, ties on that dimension are broken arbitrarily
+     * Time Complexity: O(n^(1-1/k))
+     */
+    template<size_t DIM>
+    Iterator findMin() {
+        return Iterator(this, findMin<DIM, 0>(0));
+    }
+
+    Iterator findMin(size_t dim) {
+        return Iterator(this, findMinDynamic<0>(dim));
+    }
+
+    /**
+     * Find a node with the maximum key on a dimension, ties on that dimension are broken arbitrarily
+     * Time Complexity: O(n^(1-1/k))
+     */
+    template<size_t DIM>
+    Iterator findMax() {
+        return Iterator(this, findMax<DIM, 0>(0));
+    }
+
+    Iterator findMax(size_t dim) {
+        return Iterator(this, findMaxDynamic<0>(dim));
+    }
+
+    /**
+     * Same as KDTree::nearest
+     */
+    template<typename Metric = KDTreeL2Metric>
+    Iterator nearest(const Key &key) {
+        NearestHeap heap(1);
+        nearestSearch<0, Metric>(key, 0, heap);
+        return heap.items.empty() ? end() : Iterator(this, heap.items.front().second);
+    }
+
+    /**
+     * Same as KDTree::kNearest
+     */
+    template<typename Metric = KDTreeL2Metric>
+    std::vector<Iterator> kNearest(const Key &key, size_t count) {
+        if (count == 0) {
+            return {};
+        }
+        NearestHeap heap(count);
+        nearestSearch<0, Metric>(key, 0, heap);
+        return sortedIterators(heap.items);
+    }
+
+    /**
+     * Same as KDTree::withinRadius
+     */
+    template<typename Metric = KDTreeL2Metric>
+    std::vector<Iterator> withinRadius(const Key &key, double radius) {
+        if (radius < 0) {
+            return {};
+        }
+        RadiusCollector collector(Metric::reduce(radius));
+        nearestSearch<0, Metric>(key, 0, collector);
+        return sortedIterators(collector.items);
+    }
+
+    /**
+     * Same as KDTree::rangeQuery, the callback takes a Reference (with first and second)
+     */
+    template<typename Callback>
+    void rangeQuery(const Key &lo, const Key &hi, Callback callback) {
+        rangeSearch<0>(lo, hi, 0, callback);
+    }
+
+    /**
+     * Same as KDTree::rangeCount
+     */
+    size_t rangeCount(const Key &lo, const Key &hi) {
+        size_t count = 0;
+        rangeQuery(lo, hi, [&count](const Reference &) { count++; });
+        return count;
+    }
+
+    size_t size() const { return treeSize; }
+
+    /**
+     * @return the memory used by the nodes in bytes
+     */
+    size_t bytes() const { return storage.bytes(); }
+};
+
+#endif //VE281P3_STATIC_KDTREE_HPP
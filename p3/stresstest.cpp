@@ -0,0 +1,1018 @@
+// Randomized differential stress test of the KDTrees in this directory against a std::map scanned linearly
+// Build: g++ -std=c++17 -O2 -pthread -o stresstest stresstest.cpp
+// The concurrent tests (batches, PersistentKDTree readers) are also meant to be run with -fsanitize=thread
+// Usage: ./stresstest [operations per tree] [seed]
+
+#include "kdtree.hpp"
+#include "static_kdtree.hpp"
+#include "bucket_kdtree.hpp"
+#include "persistent_kdtree.hpp"
+#include "log_structured_kdtree.hpp"
+#include "mapped_kdtree.hpp"
+#include "vector_kdtree.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+static size_t failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { failures++; cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << endl; } } while (0)
+
+typedef tuple<int, int, int> Key;
+typedef KDTree<Key, uint64_t> Tree;
+typedef map<Key, uint64_t> Reference;
+typedef vector<pair<Key, uint64_t>> Items;
+
+const size_t MAX_SIZE = 1000;    // size of the trees the random operations run on, at most
+
+/**
+ * A key in [0, range)^3, small ranges give many ties on every splitting dimension
+ */
+Key makeKey(mt19937_64 &rng, int range) {
+    return Key((int) (rng() % (uint64_t) range), (int) (rng() % (uint64_t) range), (int) (rng() % (uint64_t) range));
+}
+
+int coordinate(const Key &key, size_t dim) {
+    return dim == 0 ? get<0>(key) : dim == 1 ? get<1>(key) : get<2>(key);
+}
+
+bool inBox(const Key &key, const Key &lo, const Key &hi) {
+    for (size_t dim = 0; dim < 3; dim++) {
+        if (coordinate(key, dim) < coordinate(lo, dim) || coordinate(key, dim) > coordinate(hi, dim)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Table>
+void checkSame(Table &tree, const Reference &reference) {
+    CHECK(tree.size() == reference.size());
+    size_t count = 0;
+    for (auto &&item : tree) {
+        auto it = reference.find(item.first);
+        CHECK(it != reference.end() && it->second == item.second);
+        count++;
+    }
+    CHECK(count == reference.size());
+}
+
+/**
+ * The key-value pairs of the iterators (or references) returned by a query
+ */
+template<typename Results>
+Items itemsOf(Results results) {
+    Items items;
+    for (auto &result : results) {
+        items.emplace_back(result->first, result->second);
+    }
+    return items;
+}
+
+/**
+ * found must be the count nearest pairs of the reference, nearest first
+ * Ties are broken arbitrarily, so only the distances are compared with the linear scan
+ */
+template<typename Metric>
+void checkNearest(const Reference &reference, const Key &key, size_t count, const Items &found) {
+    vector<double> distances;
+    for (auto &item : reference) {
+        distances.push_back(Tree::distance<Metric>(item.first, key));
+    }
+    sort(distances.begin(), distances.end());
+    CHECK(found.size() == min(count, reference.size()));
+    set<Key> seen;
+    for (size_t i = 0; i < found.size() && i < distances.size(); i++) {
+        auto it = reference.find(found[i].first);
+        CHECK(it != reference.end() && it->second == found[i].second);
+        CHECK(seen.insert(found[i].first).second);
+        CHECK(Tree::distance<Metric>(found[i].first, key) == distances[i]);
+    }
+}
+
+/**
+ * found must be the pairs of the reference within radius of key, nearest first
+ */
+template<typename Metric>
+void checkRadius(const Reference &reference, const Key &key, double radius, const Items &found) {
+    set<Key> expected;
+    for (auto &item : reference) {
+        if (Tree::distance<Metric>(item.first, key) <= radius) {
+            expected.insert(item.first);
+        }
+    }
+    set<Key> seen;
+    double last = 0;
+    for (auto &item : found) {
+        auto it = reference.find(item.first);
+        CHECK(it != reference.end() && it->second == item.second);
+        CHECK(expected.count(item.first) == 1);
+        CHECK(seen.insert(item.first).second);
+        double distance = Tree::distance<Metric>(item.first, key);
+        CHECK(distance >= last);
+        last = distance;
+    }
+    CHECK(seen.size() == expected.size());
+}
+
+/**
+ * found must be the pairs of the reference inside the box [lo, hi], in any order
+ */
+void checkRange(const Reference &reference, const Key &lo, const Key &hi, const Items &found, size_t count) {
+    size_t expected = 0;
+    for (auto &item : reference) {
+        expected += inBox(item.first, lo, hi);
+    }
+    set<Key> seen;
+    for (auto &item : found) {
+        auto it = reference.find(item.first);
+        CHECK(it != reference.end() && it->second == item.second);
+        CHECK(inBox(item.first, lo, hi));
+        CHECK(seen.insert(item.first).second);
+    }
+    CHECK(found.size() == expected);
+    CHECK(count == expected);
+}
+
+/**
+ * A box with corners in [-1, range], possibly flat on some dimensions
+ */
+pair<Key, Key> makeBox(mt19937_64 &rng, int range) {
+    Key a = makeKey(rng, range + 2), b = makeKey(rng, range + 2);
+    Key lo(min(get<0>(a), get<0>(b)) - 1, min(get<1>(a), get<1>(b)) - 1, min(get<2>(a), get<2>(b)) - 1);
+    Key hi(max(get<0>(a), get<0>(b)) - 1, max(get<1>(a), get<1>(b)) - 1, max(get<2>(a), get<2>(b)) - 1);
+    return make_pair(lo, hi);
+}
+
+template<typename Metric, typename Table>
+void checkNearestQueries(Table &tree, const Reference &reference, mt19937_64 &rng, int range) {
+    Key key = makeKey(rng, range + 1);
+    switch (rng() % 3) {
+        case 0: {
+            auto it = tree.template nearest<Metric>(key);
+            Items found;
+            if (it != tree.end()) {
+                found.emplace_back(it->first, it->second);
+            }
+            checkNearest<Metric>(reference, key, 1, found);
+            break;
+        }
+        case 1: {
+            size_t count = rng() % 20;
+            checkNearest<Metric>(reference, key, count, itemsOf(tree.template kNearest<Metric>(key, count)));
+            break;
+        }
+        case 2: {
+            double radius = (double) (rng() % (uint64_t) (range + 1));
+            checkRadius<Metric>(reference, key, radius, itemsOf(tree.template withinRadius<Metric>(key, radius)));
+            break;
+        }
+    }
+}
+
+/**
+ * Run a random query on a tree with the interface of KDTree (KDTree, StaticKDTree, BucketKDTree or MappedKDTree)
+ */
+template<typename Table>
+void checkQuery(Table &tree, const Reference &reference, mt19937_64 &rng, int range) {
+    switch (rng() % 6) {
+        case 0: {
+            Key key = makeKey(rng, range + 1);
+            auto it = tree.find(key);
+            auto expected = reference.find(key);
+            CHECK((it != tree.end()) == (expected != reference.end()));
+            if (it != tree.end() && expected != reference.end()) {
+                CHECK(it->first == key && it->second == expected->second);
+            }
+            break;
+        }
+        case 1:
+        case 2:
+            checkNearestQueries<KDTreeL2Metric>(tree, reference, rng, range);
+            break;
+        case 3:
+            checkNearestQueries<KDTreeL1Metric>(tree, reference, rng, range);
+            break;
+        case 4:
+            checkNearestQueries<KDTreeLInfMetric>(tree, reference, rng, range);
+            break;
+        case 5: {
+            auto box = makeBox(rng, range);
+            Items found;
+            tree.rangeQuery(box.first, box.second, [&found](auto &&item) {
+                found.emplace_back(item.first, item.second);
+            });
+            checkRange(reference, box.first, box.second, found, tree.rangeCount(box.first, box.second));
+            break;
+        }
+    }
+}
+
+/**
+ * findMin and findMax on a random dimension, ties on that dimension are broken arbitrarily
+ */
+template<typename Table>
+void checkExtremes(Table &tree, const Reference &reference, mt19937_64 &rng) {
+    size_t dim = rng() % 3;
+    auto min = tree.findMin(dim), max = tree.findMax(dim);
+    CHECK((min == tree.end()) == reference.empty());
+    CHECK((max == tree.end()) == reference.empty());
+    if (reference.empty() || min == tree.end() || max == tree.end()) {
+        return;
+    }
+    int lowest = INT_MAX, highest = INT_MIN;
+    for (auto &item : reference) {
+        lowest = std::min(lowest, coordinate(item.first, dim));
+        highest = std::max(highest, coordinate(item.first, dim));
+    }
+    CHECK(coordinate(min->first, dim) == lowest);
+    CHECK(coordinate(max->first, dim) == highest);
+    CHECK(reference.count(min->first) == 1 && reference.count(max->first) == 1);
+}
+
+/**
+ * Erase churn: once a tree grows past MAX_SIZE, erase random keys until half of it is gone
+ * This also keeps the linear scans of the reference short
+ */
+template<typename Table>
+void cutDown(Table &tree, Reference &reference, mt19937_64 &rng) {
+    if (reference.size() <= MAX_SIZE) {
+        return;
+    }
+    vector<Key> keys;
+    for (auto &item : reference) {
+        keys.push_back(item.first);
+    }
+    shuffle(keys.begin(), keys.end(), rng);
+    keys.resize(keys.size() / 2);
+    for (auto &key : keys) {
+        CHECK(tree.erase(key));
+        reference.erase(key);
+    }
+}
+
+/**
+ * findBatch, nearestBatch and rangeCountBatch with two threads, in input order or grouped
+ */
+void checkBatches(Tree &tree, const Reference &reference, mt19937_64 &rng, int range) {
+    size_t count = rng() % 600;
+    bool grouped = rng() % 2 == 0;
+    vector<Key> keys, lo, hi;
+    for (size_t i = 0; i < count; i++) {
+        keys.push_back(makeKey(rng, range + 1));
+        auto box = makeBox(rng, range);
+        lo.push_back(box.first);
+        hi.push_back(box.second);
+    }
+    vector<Tree::Iterator> found(count, tree.end());
+    tree.findBatch(keys.begin(), keys.end(), found.begin(), 2, grouped);
+    for (size_t i = 0; i < count; i++) {
+        auto expected = reference.find(keys[i]);
+        CHECK((found[i] != tree.end()) == (expected != reference.end()));
+        if (found[i] != tree.end() && expected != reference.end()) {
+            CHECK(found[i]->first == keys[i] && found[i]->second == expected->second);
+        }
+    }
+    // the batches are checked against the single queries, which the other runs check against the reference
+    vector<Tree::Iterator> nearest(count, tree.end());
+    tree.nearestBatch(keys.begin(), keys.end(), nearest.begin(), 2, grouped);
+    for (size_t i = 0; i < count; i++) {
+        auto single = tree.nearest(keys[i]);
+        CHECK((nearest[i] == tree.end()) == (single == tree.end()));
+        if (nearest[i] != tree.end() && single != tree.end()) {
+            CHECK(Tree::distance(nearest[i]->first, keys[i]) == Tree::distance(single->first, keys[i]));
+        }
+    }
+    vector<size_t> counts(count);
+    tree.rangeCountBatch(lo.begin(), lo.end(), hi.begin(), counts.begin(), 2, grouped);
+    for (size_t i = 0; i < count; i++) {
+        CHECK(counts[i] == tree.rangeCount(lo[i], hi[i]));
+    }
+}
+
+/**
+ * Walk a KDTree backwards from end(), it must visit the nodes of the forward walk in reverse order
+ */
+void checkReverse(Tree &tree) {
+    vector<Key> forward;
+    for (auto &item : tree) {
+        forward.push_back(item.first);
+    }
+    auto it = tree.end();
+    size_t i = forward.size();
+    while (it != tree.begin() && i > 0) {
+        --it;
+        CHECK(it->first == forward[--i]);
+    }
+    CHECK(it == tree.begin() && i == 0);
+}
+
+/**
+ * Random inserts, erases and queries on a KDTree
+ * The key range changes now and then, a small one puts many equal coordinates on the splitting dimensions,
+ * and the tree is cut down to half of its size once it grows too large (see cutDown)
+ */
+void stressKDTree(const char *name, size_t operations, uint64_t seed, bool balanced) {
+    mt19937_64 rng(seed);
+    Tree tree;
+    if (balanced) {
+        tree.enableBalance();
+    }
+    Reference reference;
+    KDTreeStats stats;
+    size_t before = failures;
+    int range = 4;
+    for (size_t step = 0; step < operations; step++) {
+        if (step % 10000 == 0) {
+            range = 2 << (rng() % 8);
+        }
+        Key key = makeKey(rng, range);
+        switch (rng() % 16) {
+            case 0:
+            case 1:
+            case 2:
+            case 3:
+                tree.insert(key, step);
+                reference[key] = step;
+                break;
+            case 4:
+            case 5:
+                CHECK(tree.erase(key) == (reference.erase(key) > 0));
+                break;
+            case 6: {
+                auto it = tree.find(key);
+                if (it != tree.end()) {
+                    reference.erase(it->first);
+                    tree.erase(it);
+                }
+                break;
+            }
+            case 7:
+                checkExtremes(tree, reference, rng);
+                break;
+            case 8:
+            case 9:
+            case 10:
+            case 11:
+            case 12:
+                checkQuery(tree, reference, rng, range);
+                break;
+            case 13:
+                if (rng() % 20 == 0) {
+                    checkBatches(tree, reference, rng, range);
+                }
+                break;
+            case 14:
+                if (rng() % 20 == 0) {
+                    switch (rng() % 4) {
+                        case 0: {
+                            Tree copy(tree);
+                            checkSame(copy, reference);
+                            tree = copy;
+                            break;
+                        }
+                        case 1: {
+                            // the pairs in a random order, with some keys twice, the last value wins
+                            Items items(reference.begin(), reference.end());
+                            shuffle(items.begin(), items.end(), rng);
+                            Items pairs;
+                            for (auto &item : items) {
+                                if (rng() % 4 == 0) {
+                                    pairs.emplace_back(item.first, rng());
+                                }
+                                pairs.push_back(item);
+                            }
+                            tree = Tree(pairs);
+                            if (balanced) {
+                                tree.enableBalance();
+                            }
+                            break;
+                        }
+                        case 2:
+                            tree.setStats(tree.getStats() == nullptr ? &stats : nullptr);
+                            break;
+                        case 3:
+                            if (balanced) {
+                                tree.disableBalance();
+                                tree.enableBalance();
+                            }
+                            break;
+                    }
+                }
+                break;
+            case 15:
+                cutDown(tree, reference, rng);
+                break;
+        }
+        CHECK(tree.size() == reference.size());
+        if (step % 5000 == 0) {
+            checkSame(tree, reference);
+            checkReverse(tree);
+        }
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    checkSame(tree, reference);
+    checkReverse(tree);
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Build a KDTree from a vector large enough to be split between threads (on a machine with more than one),
+ * then keep inserting and erasing in it
+ */
+void stressBuild(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    size_t before = failures;
+    for (size_t round = 0; round * 50000 < operations; round++) {
+        int range = 8 << (rng() % 5);
+        Items pairs;
+        Reference reference;
+        size_t count = (2 << 14) + rng() % (1 << 14);    // two to three times KDTree::BUILD_GRAIN_SIZE
+        for (size_t i = 0; i < count; i++) {
+            Key key = makeKey(rng, range);
+            pairs.emplace_back(key, i);
+            reference[key] = i;
+        }
+        Tree tree(pairs);
+        checkSame(tree, reference);
+        for (size_t step = 0; step < 2000; step++) {
+            Key key = makeKey(rng, range);
+            if (rng() % 2 == 0) {
+                CHECK(tree.erase(key) == (reference.erase(key) > 0));
+            } else {
+                tree.insert(key, step);
+                reference[key] = step;
+            }
+            if (step % 10 == 0) {
+                checkQuery(tree, reference, rng, range);
+            }
+        }
+        checkSame(tree, reference);
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Range queries and lookups on 64 bit keys around 2^60, where neighbouring coordinates are equal as doubles
+ */
+template<typename Table>
+void checkWideKeys(mt19937_64 &rng) {
+    typedef tuple<int64_t, int64_t> WideKey;
+    const int64_t base = (int64_t) 1 << 60;
+    int range = 2 << (rng() % 8);
+    map<WideKey, uint64_t> reference;
+    vector<pair<WideKey, uint64_t>> pairs;
+    size_t count = rng() % 500;
+    for (size_t i = 0; i < count; i++) {
+        WideKey key(base + (int64_t) (rng() % (uint64_t) range), (int64_t) (rng() % (uint64_t) range));
+        pairs.emplace_back(key, i);
+        reference[key] = i;
+    }
+    Table tree(pairs);
+    CHECK(tree.size() == reference.size());
+    for (size_t step = 0; step < 100; step++) {
+        int64_t x1 = base + (int64_t) (rng() % (uint64_t) (range + 1));
+        int64_t x2 = base + (int64_t) (rng() % (uint64_t) (range + 1));
+        auto y1 = (int64_t) (rng() % (uint64_t) (range + 1)), y2 = (int64_t) (rng() % (uint64_t) (range + 1));
+        WideKey lo(min(x1, x2), min(y1, y2)), hi(max(x1, x2), max(y1, y2));
+        size_t expected = 0;
+        for (auto &item : reference) {
+            expected += get<0>(lo) <= get<0>(item.first) && get<0>(item.first) <= get<0>(hi) &&
+                        get<1>(lo) <= get<1>(item.first) && get<1>(item.first) <= get<1>(hi);
+        }
+        size_t visited = 0;
+        tree.rangeQuery(lo, hi, [&](auto &&item) {
+            CHECK(reference.count(item.first) == 1 && reference[item.first] == item.second);
+            CHECK(get<0>(lo) <= get<0>(item.first) && get<0>(item.first) <= get<0>(hi));
+            visited++;
+        });
+        CHECK(visited == expected);
+        CHECK(tree.rangeCount(lo, hi) == expected);
+        WideKey key(x1, y1);
+        auto it = tree.find(key);
+        CHECK((it != tree.end()) == (reference.count(key) == 1));
+    }
+}
+
+/**
+ * An image of keys whose tuple has padding (char next to double) must hold packed keys only:
+ * saving the same pairs twice gives the same bytes, and the keys read back are the keys saved
+ */
+void checkPackedImage(mt19937_64 &rng, const string &path) {
+    typedef tuple<char, double, int16_t> PaddedKey;
+    map<PaddedKey, uint64_t> reference;
+    vector<pair<PaddedKey, uint64_t>> pairs;
+    size_t count = rng() % 300;
+    for (size_t i = 0; i < count; i++) {
+        PaddedKey key((char) (rng() % 16), (double) (rng() % 16) / 4, (int16_t) (rng() % 16));
+        pairs.emplace_back(key, i);
+        reference[key] = i;
+    }
+    auto readImage = [&path]() {
+        ifstream in(path, ios::binary);
+        return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    };
+    MappedKDTree<PaddedKey, uint64_t>::save(pairs, path);
+    string first = readImage();
+    MappedKDTree<PaddedKey, uint64_t>::save(pairs, path);
+    CHECK(readImage() == first);
+    MappedKDTreeHeader header{};
+    memcpy(&header, first.data(), min(first.size(), sizeof(header)));
+    CHECK(header.keyBytes == sizeof(char) + sizeof(double) + sizeof(int16_t));
+
+    auto tree = MappedKDTree<PaddedKey, uint64_t>::open(path);
+    CHECK(tree.size() == reference.size());
+    size_t visited = 0;
+    for (auto &&item : tree) {
+        auto it = reference.find(item.first);
+        CHECK(it != reference.end() && it->second == item.second);
+        visited++;
+    }
+    CHECK(visited == reference.size());
+    for (auto &item : reference) {
+        auto it = tree.find(item.first);
+        CHECK(it != tree.end() && it->second == item.second);
+    }
+}
+
+/**
+ * Build a StaticKDTree, a BucketKDTree and a MappedKDTree from the same pairs and query them
+ */
+void stressStatic(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    size_t before = failures;
+    string path = (filesystem::temp_directory_path() / ("stresstest-" + to_string(seed) + ".kdt")).string();
+    for (size_t round = 0; round * 5000 < operations; round++) {
+        int range = 2 << (rng() % 8);
+        Items pairs;
+        Reference reference;
+        size_t count = rng() % 3000;
+        for (size_t i = 0; i < count; i++) {
+            Key key = makeKey(rng, range);
+            pairs.emplace_back(key, i);
+            reference[key] = i;
+        }
+        StaticKDTree<Key, uint64_t> staticTree(pairs);
+        BucketKDTree<Key, uint64_t, 8> bucketTree(pairs);
+        MappedKDTree<Key, uint64_t>::save(pairs, path);
+        auto mappedTree = MappedKDTree<Key, uint64_t>::open(path);
+        checkSame(staticTree, reference);
+        checkSame(bucketTree, reference);
+        checkSame(mappedTree, reference);
+        for (size_t step = 0; step < 500; step++) {
+            checkQuery(staticTree, reference, rng, range);
+            checkQuery(bucketTree, reference, rng, range);
+            checkQuery(mappedTree, reference, rng, range);
+            if (step % 10 == 0) {
+                checkExtremes(staticTree, reference, rng);
+                checkExtremes(mappedTree, reference, rng);
+            }
+        }
+        checkWideKeys<StaticKDTree<tuple<int64_t, int64_t>, uint64_t>>(rng);
+        checkWideKeys<BucketKDTree<tuple<int64_t, int64_t>, uint64_t, 8>>(rng);
+        checkPackedImage(rng, path);
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    remove(path.c_str());
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * A snapshot must answer like the reference of the moment it was taken
+ */
+template<typename Snapshot>
+void checkSnapshot(const Snapshot &snapshot, const Reference &reference, mt19937_64 &rng, int range) {
+    CHECK(snapshot.size() == reference.size());
+    Key key = makeKey(rng, range + 1);
+    const uint64_t *value = snapshot.find(key);
+    auto expected = reference.find(key);
+    CHECK((value != nullptr) == (expected != reference.end()));
+    if (value != nullptr && expected != reference.end()) {
+        CHECK(*value == expected->second);
+    }
+    auto nearest = snapshot.nearest(key);
+    Items found;
+    if (nearest != nullptr) {
+        found.emplace_back(nearest->first, nearest->second);
+    }
+    checkNearest<KDTreeL2Metric>(reference, key, 1, found);
+    auto box = makeBox(rng, range);
+    Items inside;
+    snapshot.rangeQuery(box.first, box.second, [&inside](auto &item) {
+        inside.emplace_back(item.first, item.second);
+    });
+    checkRange(reference, box.first, box.second, inside, snapshot.rangeCount(box.first, box.second));
+}
+
+/**
+ * Random writes on a PersistentKDTree while a few snapshots of older versions stay alive
+ */
+void stressPersistent(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    PersistentKDTree<Key, uint64_t> tree;
+    Reference reference;
+    deque<pair<PersistentKDTree<Key, uint64_t>::Snapshot, Reference>> snapshots;
+    size_t before = failures;
+    int range = 4;
+    for (size_t step = 0; step < operations; step++) {
+        if (step % 10000 == 0) {
+            range = 2 << (rng() % 6);
+        }
+        Key key = makeKey(rng, range);
+        switch (rng() % 8) {
+            case 0:
+            case 1:
+            case 2:
+                CHECK(tree.insert(key, step) == (reference.count(key) == 0));
+                reference[key] = step;
+                break;
+            case 3:
+            case 4:
+                CHECK(tree.erase(key) == (reference.erase(key) > 0));
+                break;
+            case 5:
+                if (rng() % 20 == 0) {
+                    if (snapshots.size() == 8) {
+                        snapshots.pop_front();
+                    }
+                    snapshots.emplace_back(tree.snapshot(), reference);
+                }
+                break;
+            case 6:
+                if (!snapshots.empty()) {
+                    auto &snapshot = snapshots[rng() % snapshots.size()];
+                    checkSnapshot(snapshot.first, snapshot.second, rng, range);
+                }
+                break;
+            case 7:
+                checkSnapshot(tree.snapshot(), reference, rng, range);
+                break;
+        }
+        cutDown(tree, reference, rng);
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Reader threads query snapshots of a PersistentKDTree while the writer inserts and erases
+ * The writes are generated up front: write s inserts its key with value s or erases it, and after it
+ * the writer stores s under a clock key outside the data range. A snapshot whose clock reads c must
+ * then hold the data of write c or of write c + 1 (taken between the write and the clock store).
+ */
+void stressPersistentConcurrent(const char *name, size_t operations, uint64_t seed) {
+    typedef PersistentKDTree<Key, uint64_t> PersistentTree;
+    mt19937_64 rng(seed);
+    size_t before = failures;
+    const int range = 16;
+    const Key clock(-1, -1, -1);
+    size_t count = min(operations, (size_t) 20000);
+    vector<pair<Key, bool>> writes;     // key, and whether it is inserted
+    map<Key, vector<size_t>> history;   // the writes of every key, in order
+    vector<size_t> sizes;               // number of data keys after every write
+    Reference state;
+    for (size_t step = 0; step < count; step++) {
+        Key key = makeKey(rng, range);
+        bool insert = rng() % 3 != 0;
+        writes.emplace_back(key, insert);
+        history[key].push_back(step);
+        if (insert) {
+            state[key] = step;
+        } else {
+            state.erase(key);
+        }
+        sizes.push_back(state.size());
+    }
+
+    // the value of key after the first stepsDone writes, -1 if it is absent
+    auto valueAt = [&](const Key &key, size_t stepsDone) -> int64_t {
+        auto it = history.find(key);
+        if (it == history.end()) {
+            return -1;
+        }
+        auto last = lower_bound(it->second.begin(), it->second.end(), stepsDone);
+        if (last == it->second.begin()) {
+            return -1;
+        }
+        size_t step = *--last;
+        return writes[step].second ? (int64_t) step : -1;
+    };
+    auto valueIn = [](const PersistentTree::Snapshot &snapshot, const Key &key) -> int64_t {
+        const uint64_t *value = snapshot.find(key);
+        return value != nullptr ? (int64_t) *value : -1;
+    };
+
+    PersistentTree tree;
+    atomic<bool> done(false);
+    vector<size_t> readerFailures(3, 0);
+    vector<thread> readers;
+    for (size_t r = 0; r < readerFailures.size(); r++) {
+        readers.emplace_back([&, r]() {
+            mt19937_64 readerRng(seed + r + 1);
+            size_t &bad = readerFailures[r];
+            size_t lastDone = 0;
+            do {
+                auto snapshot = tree.snapshot();
+                const uint64_t *tick = snapshot.find(clock);
+                size_t stepsDone = tick != nullptr ? (size_t) *tick + 1 : 0;
+                bad += stepsDone < lastDone;
+                lastDone = stepsDone;
+                // the snapshot has seen stepsDone writes, or one more if the key of the next one already changed
+                size_t seen = stepsDone;
+                if (stepsDone < count && valueIn(snapshot, writes[stepsDone].first) !=
+                                         valueAt(writes[stepsDone].first, stepsDone)) {
+                    seen++;
+                }
+                size_t dataSize = snapshot.size() - (tick != nullptr);
+                bad += dataSize != (seen > 0 ? sizes[seen - 1] : 0);
+
+                size_t visited = 0;
+                snapshot.rangeQuery(Key(0, 0, 0), Key(range, range, range), [&](const auto &item) {
+                    bad += valueAt(item.first, seen) != (int64_t) item.second;
+                    visited++;
+                });
+                bad += visited != dataSize;
+                bad += snapshot.rangeCount(Key(0, 0, 0), Key(range, range, range)) != dataSize;
+
+                Key key = makeKey(readerRng, range);
+                bad += valueIn(snapshot, key) != valueAt(key, seen);
+                auto nearest = snapshot.nearest(key);
+                bad += (nearest == nullptr) != (snapshot.size() == 0);
+                if (nearest != nullptr) {
+                    const uint64_t *found = snapshot.find(nearest->first);
+                    bad += found == nullptr || *found != nearest->second;
+                }
+            } while (!done.load(memory_order_acquire));
+        });
+    }
+
+    for (size_t step = 0; step < count; step++) {
+        if (writes[step].second) {
+            tree.insert(writes[step].first, step);
+        } else {
+            tree.erase(writes[step].first);
+        }
+        tree.insert(clock, step);
+    }
+    done.store(true, memory_order_release);
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    for (size_t bad : readerFailures) {
+        CHECK(bad == 0);
+    }
+    state[clock] = count - 1;
+    auto snapshot = tree.snapshot();
+    checkSnapshot(snapshot, state, rng, range);
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Random writes and queries on a LogStructuredKDTree with a tiny buffer, so that the levels merge often
+ * and most keys have older records (or tombstones) shadowed by newer ones
+ */
+void stressLogStructured(const char *name, size_t operations, uint64_t seed) {
+    typedef LogStructuredKDTree<Key, uint64_t, 4> LogTree;
+    mt19937_64 rng(seed);
+    LogTree tree;
+    Reference reference;
+    size_t before = failures;
+    int range = 4;
+    for (size_t step = 0; step < operations; step++) {
+        if (step % 10000 == 0) {
+            range = 2 << (rng() % 6);
+        }
+        Key key = makeKey(rng, range);
+        switch (rng() % 10) {
+            case 0:
+            case 1:
+            case 2:
+                CHECK(tree.insert(key, step) == (reference.count(key) == 0));
+                reference[key] = step;
+                break;
+            case 3:
+            case 4:
+                CHECK(tree.erase(key) == (reference.erase(key) > 0));
+                break;
+            case 5: {
+                uint64_t *value = tree.find(key);
+                auto expected = reference.find(key);
+                CHECK((value != nullptr) == (expected != reference.end()));
+                if (value != nullptr && expected != reference.end()) {
+                    CHECK(*value == expected->second);
+                }
+                CHECK(tree.contains(key) == (expected != reference.end()));
+                break;
+            }
+            case 6: {
+                auto nearest = tree.nearest(key);
+                Items found;
+                if (nearest) {
+                    found.emplace_back(nearest->first, nearest->second);
+                }
+                checkNearest<KDTreeL2Metric>(reference, key, 1, found);
+                break;
+            }
+            case 7: {
+                size_t count = rng() % 20;
+                Items found;
+                for (auto &item : tree.kNearest<KDTreeL1Metric>(key, count)) {
+                    found.emplace_back(item.first, item.second);
+                }
+                checkNearest<KDTreeL1Metric>(reference, key, count, found);
+                break;
+            }
+            case 8: {
+                auto box = makeBox(rng, range);
+                Items found;
+                tree.rangeQuery(box.first, box.second, [&found](auto &item) {
+                    found.emplace_back(item.first, item.second);
+                });
+                checkRange(reference, box.first, box.second, found, tree.rangeCount(box.first, box.second));
+                break;
+            }
+            case 9:
+                if (rng() % 200 == 0) {
+                    tree = LogTree(Items(reference.begin(), reference.end()));
+                }
+                break;
+        }
+        cutDown(tree, reference, rng);
+        CHECK(tree.size() == reference.size());
+        CHECK(tree.recordCount() >= tree.size());
+        if (step % 5000 == 0) {
+            Items all;
+            tree.rangeQuery(Key(INT_MIN, INT_MIN, INT_MIN), Key(INT_MAX, INT_MAX, INT_MAX), [&all](auto &item) {
+                all.emplace_back(item.first, item.second);
+            });
+            checkRange(reference, Key(INT_MIN, INT_MIN, INT_MIN), Key(INT_MAX, INT_MAX, INT_MAX), all, all.size());
+        }
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Build VectorKDTrees of points with small integer coordinates (many equal points) in 1 to 16 dimensions,
+ * and compare their nearest points with a linear scan
+ */
+void stressVector(const char *name, size_t operations, uint64_t seed) {
+    mt19937_64 rng(seed);
+    size_t before = failures;
+    for (size_t round = 0; round * 1000 < operations; round++) {
+        size_t dimension = rng() % 16 + 1;
+        size_t count = rng() % 2000;
+        uint64_t range = rng() % 8 + 1;
+        vector<float> points(count * dimension);
+        for (auto &coordinate : points) {
+            coordinate = (float) (rng() % range);
+        }
+        vector<size_t> ids(count);
+        for (size_t i = 0; i < count; i++) {
+            ids[i] = i;
+        }
+        VectorKDTree<size_t, 8> tree(dimension, points, ids);
+        auto distance = [&](const float *a, const float *b) {
+            double sum = 0;
+            for (size_t j = 0; j < dimension; j++) {
+                sum += ((double) a[j] - b[j]) * ((double) a[j] - b[j]);
+            }
+            return sum;
+        };
+
+        CHECK(tree.size() == count && tree.dimension() == dimension);
+        vector<bool> seen(count);
+        for (auto &&item : tree) {
+            CHECK(item.second < count && !seen[item.second]);
+            if (item.second < count) {
+                seen[item.second] = true;
+                CHECK(distance(item.first, points.data() + item.second * dimension) == 0);
+            }
+        }
+        CHECK(find(seen.begin(), seen.end(), false) == seen.end());
+
+        for (size_t step = 0; step < 100; step++) {
+            vector<float> query(dimension);
+            for (auto &coordinate : query) {
+                coordinate = (float) (rng() % (range + 1));
+            }
+            vector<double> distances(count);
+            for (size_t i = 0; i < count; i++) {
+                distances[i] = distance(query.data(), points.data() + i * dimension);
+            }
+            sort(distances.begin(), distances.end());
+            size_t k = rng() % 20;
+            double epsilon = rng() % 2 == 0 ? 0 : 0.5;
+            auto found = tree.kNearest(query.data(), k, epsilon);
+            CHECK(found.size() == min(k, count));
+            set<size_t> ids;
+            for (size_t i = 0; i < found.size() && i < count; i++) {
+                CHECK(ids.insert(found[i]->second).second);
+                double d = distance(query.data(), found[i]->first);
+                // squared distances, (1 + epsilon)^2 times the exact one at most
+                CHECK(d >= distances[i] && d <= (1 + epsilon) * (1 + epsilon) * distances[i]);
+            }
+            auto nearest = tree.nearest(query.data());
+            CHECK((nearest == tree.end()) == (count == 0));
+            if (nearest != tree.end() && count > 0) {
+                CHECK(distance(query.data(), nearest->first) == distances[0]);
+            }
+        }
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+/**
+ * Erase every other node of a tree through iterators, every node must be visited exactly once
+ */
+void stressEraseIterator(const char *name, size_t operations, uint64_t seed, bool balanced) {
+    mt19937_64 rng(seed);
+    size_t before = failures;
+    for (size_t round = 0; round * 1000 < operations; round++) {
+        Tree tree;
+        if (balanced) {
+            tree.enableBalance();
+        }
+        Reference reference;
+        int range = 2 << (rng() % 8);
+        size_t count = rng() % 2000;
+        for (size_t i = 0; i < count; i++) {
+            Key key = makeKey(rng, range);
+            tree.insert(key, i);
+            reference[key] = i;
+        }
+        size_t initial = reference.size();
+        set<Key> visited;
+        bool erase = false;
+        for (auto it = tree.begin(); it != tree.end();) {
+            CHECK(visited.insert(it->first).second);
+            if (erase) {
+                reference.erase(it->first);
+                it = tree.erase(it);
+            } else {
+                ++it;
+            }
+            erase = !erase;
+        }
+        CHECK(visited.size() == initial);
+        CHECK(reference.size() == initial - initial / 2);
+        checkSame(tree, reference);
+        if (failures > before + 10) {
+            break;
+        }
+    }
+    cout << name << ": " << (failures == before ? "passed" : "FAILED") << endl;
+}
+
+int main(int argc, char *argv[]) {
+    size_t operations = argc > 1 ? (size_t) strtoull(argv[1], nullptr, 10) : 200000;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 281;
+
+    stressKDTree("KDTree", operations, seed, false);
+    stressKDTree("KDTree balanced", operations, seed, true);
+    stressBuild("KDTree(vector)", operations, seed);
+    stressEraseIterator("KDTree erase(Iterator)", operations, seed, false);
+    stressEraseIterator("KDTree erase(Iterator) balanced", operations, seed, true);
+    stressStatic("StaticKDTree, BucketKDTree and MappedKDTree", operations, seed);
+    stressPersistent("PersistentKDTree", operations, seed);
+    stressPersistentConcurrent("PersistentKDTree with concurrent readers", operations, seed);
+    stressLogStructured("LogStructuredKDTree", operations, seed);
+    stressVector("VectorKDTree", operations, seed);
+
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    return 0;
+}
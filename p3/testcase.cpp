@@ -1,5 +1,13 @@
 #include<iostream>
 #include"kdtree.hpp"
+#include"static_kdtree.hpp"
+#include"bucket_kdtree.hpp"
+#include"persistent_kdtree.hpp"
+#include"log_structured_kdtree.hpp"
+#include"mapped_kdtree.hpp"
+#include"vector_kdtree.hpp"
+#include<cstdio>
+#include<filesystem>
 #include<string>
 #include<vector>
 using namespace std;
@@ -54,5 +62,167 @@ int main() {
     cout<<"The smallest in dim 1 is "<<tree1.findMin(1)->second<<endl;
     cout<<"The largest in dim 1 is "<<tree1.findMax(1)->second<<endl;
 
+    //test the nearest neighbor queries
+    cout<<"Then we test the nearest neighbor queries around (18,18):"<<endl;
+    cout<<"The nearest node is "<<tree1.nearest(std::tuple<int,int>(18,18))->second<<endl;
+    cout<<"The nearest node in L1 is "<<tree1.nearest<KDTreeL1Metric>(std::tuple<int,int>(18,18))->second<<endl;
+    cout<<"The 3 nearest nodes are:";
+    for (auto &it : tree1.kNearest(std::tuple<int,int>(18,18), 3)) {
+        cout<<" "<<it->second;
+    }
+    cout<<endl;
+    cout<<"The nodes within distance 30 are:";
+    for (auto &it : tree1.withinRadius(std::tuple<int,int>(18,18), 30)) {
+        cout<<" "<<it->second;
+    }
+    cout<<endl;
+
+    //test the range queries
+    cout<<"Then we test the range queries in the box (0,10)-(50,50):"<<endl;
+    cout<<"The nodes in the box are:";
+    tree1.rangeQuery(std::tuple<int,int>(0,10), std::tuple<int,int>(50,50), [](auto &item) {
+        cout<<" "<<item.second;
+    });
+    cout<<endl;
+    cout<<"The number of nodes in the box is "<<tree1.rangeCount(std::tuple<int,int>(0,10), std::tuple<int,int>(50,50))<<endl;
+
+    //test the static tree, built from the remaining nodes of tree1
+    cout<<"Then we build a static tree from tree1:"<<endl;
+    std::vector<std::pair<std::tuple<int,int>,std::string>> nodes;
+    for (auto &item: tree1) {
+        nodes.push_back(item);
+    }
+    StaticKDTree<std::tuple<int,int>,string> tree3(nodes);
+    cout<<"The node (20,15) in the static tree is "<<tree3.find(std::tuple<int,int>(20,15))->second<<endl;
+    cout<<"The smallest in dim 1 is "<<tree3.findMin(1)->second<<endl;
+    cout<<"The largest in dim 0 is "<<tree3.findMax(0)->second<<endl;
+    cout<<"The nearest node to (18,18) is "<<tree3.nearest(std::tuple<int,int>(18,18))->second<<endl;
+    cout<<"The number of nodes in the box is "<<tree3.rangeCount(std::tuple<int,int>(0,10), std::tuple<int,int>(50,50))<<endl;
+
+    //test the bucketed tree, with leaves of 2 nodes
+    cout<<"Then we build a bucketed tree from tree1:"<<endl;
+    BucketKDTree<std::tuple<int,int>,string,2> tree4(nodes);
+    cout<<"The bucketed tree has "<<tree4.height()<<" internal levels"<<endl;
+    cout<<"The node (20,15) in the bucketed tree is "<<tree4.find(std::tuple<int,int>(20,15))->second<<endl;
+    cout<<"The nearest node to (18,18) is "<<tree4.nearest(std::tuple<int,int>(18,18))->second<<endl;
+    cout<<"The number of nodes in the box is "<<tree4.rangeCount(std::tuple<int,int>(0,10), std::tuple<int,int>(50,50))<<endl;
+
+    //test the balanced tree with keys inserted in sorted order
+    cout<<"Then we insert 1000 sorted keys into a balanced tree:"<<endl;
+    KDTree<std::tuple<int,int>,int> tree5;
+    tree5.enableBalance();
+    for (int i = 0; i < 1000; i++) {
+        tree5.insert(std::tuple<int,int>(i, i % 10), i);
+    }
+    cout<<"The height of the balanced tree is "<<tree5.height()<<endl;
+    cout<<"The node (500,0) in the balanced tree is "<<tree5.find(std::tuple<int,int>(500,0))->second<<endl;
+
+    //test the batch queries
+    cout<<"Then we run the batch queries on the balanced tree:"<<endl;
+    std::vector<std::tuple<int,int>> queries = {std::tuple<int,int>(10,0), std::tuple<int,int>(11,0),
+                                                std::tuple<int,int>(999,9), std::tuple<int,int>(300,3)};
+    std::vector<KDTree<std::tuple<int,int>,int>::Iterator> results(queries.size(), tree5.end());
+    tree5.findBatch(queries.begin(), queries.end(), results.begin(), 2, true);
+    cout<<"The nodes found are:";
+    for (auto &it : results) {
+        cout<<" "<<(it == tree5.end() ? string("none") : std::to_string(it->second));
+    }
+    cout<<endl;
+    tree5.nearestBatch(queries.begin(), queries.end(), results.begin());
+    cout<<"The nearest nodes are:";
+    for (auto &it : results) {
+        cout<<" "<<it->second;
+    }
+    cout<<endl;
+
+    //test the persistent tree, a snapshot does not see later writes
+    cout<<"Then we build a persistent tree from tree1:"<<endl;
+    PersistentKDTree<std::tuple<int,int>,string> tree6(nodes);
+    {
+        auto before = tree6.snapshot();
+        tree6.erase(std::tuple<int,int>(20,15));
+        tree6.insert(std::tuple<int,int>(1,1),"z");
+        auto after = tree6.snapshot();
+        cout<<"The snapshot before the writes has "<<before.size()<<" nodes, the one after has "<<after.size()<<endl;
+        cout<<"The node (20,15) is "<<(before.contains(std::tuple<int,int>(20,15)) ? "in" : "not in")<<" the first and "
+            <<(after.contains(std::tuple<int,int>(20,15)) ? "in" : "not in")<<" the second"<<endl;
+        cout<<"The nearest node to (0,0) after the writes is "<<after.nearest(std::tuple<int,int>(0,0))->second<<endl;
+    }
+
+    //test the log-structured tree, writes go to a small buffer that is merged into static levels
+    cout<<"Then we insert 100 nodes into a log-structured tree with a buffer of 8:"<<endl;
+    LogStructuredKDTree<std::tuple<int,int>,int,8> tree7;
+    for (int i = 0; i < 100; i++) {
+        tree7.insert(std::tuple<int,int>(i, i % 7), i);
+    }
+    tree7.erase(std::tuple<int,int>(50,1));
+    tree7.insert(std::tuple<int,int>(60,4), -60);
+    cout<<"The tree has "<<tree7.size()<<" nodes in "<<tree7.levelCount()<<" levels"<<endl;
+    cout<<"The node (60,4) is "<<*tree7.find(std::tuple<int,int>(60,4))<<", the node (50,1) is "
+        <<(tree7.contains(std::tuple<int,int>(50,1)) ? "in" : "not in")<<" the tree"<<endl;
+    cout<<"The nearest node to (50,1) is "<<tree7.nearest(std::tuple<int,int>(50,1))->second<<endl;
+    cout<<"There are "<<tree7.rangeCount(std::tuple<int,int>(40,0), std::tuple<int,int>(59,6))
+        <<" nodes in [40,59]x[0,6]"<<endl;
+
+    //test the image file, the mapped tree reads the values in place
+    cout<<"Then we save the balanced tree to a file and map it back:"<<endl;
+    std::string image = (std::filesystem::temp_directory_path() / "tree5.kdt").string();
+    tree5.save(image);
+    {
+        auto tree8 = MappedKDTree<std::tuple<int,int>,int>::open(image);
+        cout<<"The mapped tree has "<<tree8.size()<<" nodes, the node (500,0) is "
+            <<tree8.find(std::tuple<int,int>(500,0)).value()<<endl;
+        cout<<"There are "<<tree8.rangeCount(std::tuple<int,int>(100,0), std::tuple<int,int>(199,4))
+            <<" nodes in [100,199]x[0,4]"<<endl;
+    }
+    std::remove(image.c_str());
+
+    //test the tree of float vectors, the dimension is chosen at runtime
+    cout<<"Then we build a tree of 900 points with 16 coordinates each:"<<endl;
+    {
+        size_t dimension = 16;
+        std::vector<float> points;
+        std::vector<int> ids;
+        for (int i = 0; i < 900; i++) {
+            for (size_t j = 0; j < dimension; j++) {
+                points.push_back((float) ((i * (j + 3)) % 997));
+            }
+            ids.push_back(i);
+        }
+        VectorKDTree<int> tree9(dimension, points, ids);
+        std::vector<float> query(points.begin() + 420 * dimension, points.begin() + 421 * dimension);
+        cout<<"The tree has "<<tree9.size()<<" points and "<<tree9.height()<<" levels"<<endl;
+        cout<<"The nearest point to point 420 is "<<tree9.nearest(query.data())->second
+            <<", within 4 leaves it is "<<tree9.nearest(query.data(), 0, 4)->second<<endl;
+    }
+
+    //test a degenerate tree, it is a chain of 20000 nodes but nothing in it recurses
+    cout<<"Then we insert 20000 sorted nodes into a tree without balancing:"<<endl;
+    {
+        KDTree<std::tuple<int,int>,int> tree10;
+        for (int i = 0; i < 20000; i++) {
+            tree10.insert(std::tuple<int,int>(i, i), i);
+        }
+        cout<<"The height of the tree is "<<tree10.height()<<", the last two nodes are";
+        auto it = tree10.end();
+        for (int i = 0; i < 2; i++) {
+            --it;
+            cout<<" "<<it->second;
+        }
+        cout<<endl;
+        tree10.erase(std::tuple<int,int>(0,0));
+        KDTree<std::tuple<int,int>,int> tree11(tree10);
+        cout<<"The copy has "<<tree11.size()<<" nodes, the nearest node to (0,0) is "
+            <<tree11.nearest(std::tuple<int,int>(0,0))->second<<endl;
+
+        //count what the queries of the chain visit
+        KDTreeStats stats;
+        tree11.setStats(&stats);
+        tree11.find(std::tuple<int,int>(19999,19999));
+        tree11.nearest(std::tuple<int,int>(19999,19999));
+        cout<<"Two queries at the bottom of the chain visit "<<stats.nodesVisited<<" nodes, the copy is "
+            <<tree11.dumpStats()<<endl;
+    }
+
     return 0;
 }
\ No newline at end of file
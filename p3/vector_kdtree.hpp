@@ -0,0 +1,375 @@
+#ifndef VE281P3_VECTOR_KDTREE_HPP
+#define VE281P3_VECTOR_KDTREE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Distance kernels over rows of float coordinates
+ * With AVX2 8 coordinates are handled at a time; otherwise a plain loop is used
+ */
+namespace VectorKernels {
+    /**
+     * Time Complexity: O(dimension)
+     * @return squared L2 distance of a and b
+     */
+    inline float squaredDistance(const float *a, const float *b, size_t dimension) {
+        size_t i = 0;
+        float sum = 0;
+#if defined(__AVX2__)
+        __m256 acc = _mm256_setzero_ps();
+        for (; i + 8 <= dimension; i += 8) {
+            __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+        }
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        half = _mm_hadd_ps(half, half);
+        half = _mm_hadd_ps(half, half);
+        sum = _mm_cvtss_f32(half);
+#endif
+        for (; i < dimension; i++) {
+            float diff = a[i] - b[i];
+            sum += diff * diff;
+        }
+        return sum;
+    }
+}
+
+/**
+ * A read-only KDTree of float vectors whose dimension is chosen at runtime, for high dimensional
+ * data such as embeddings, where a tuple key and the per-dimension templates of KDTree do not work
+ * Internal nodes hold a split (dimension, value) and are stored implicitly in BFS order like BucketKDTree;
+ * every point is in a leaf of at most LeafSize points, node (depth d, position p) covers the points
+ * [p n / 2^d, (p + 1) n / 2^d), and the points of a leaf are consecutive rows of one array
+ * A node splits on the dimension where its points have the highest variance (not round-robin),
+ * the points left of a split are not greater and the points right of it are not less on that dimension
+ * The nearest searches are best-first: leaves are scanned in the order of their distance lower bound,
+ * with an optional slack epsilon and budget of leaves to trade accuracy for latency
+ * Only the L2 metric is supported, distances are computed by VectorKernels
+ * The time complexity of functions are based on n and d
+ * n is the size of the KDTree
+ * d is the dimension
+ * @typedef Value       value type
+ */
+template<typename ValueType, size_t LeafSize = 32>
+class VectorKDTree {
+public:
+    typedef ValueType Value;
+    static_assert(LeafSize > 0, "LeafSize must be positive");
+
+    /**
+     * A key-value reference to a point, first points to its dimension coordinates
+     */
+    struct Reference {
+        const float *first;
+        Value &second;
+    };
+
+    /**
+     * A forward iterator of the points in leaf order (not sorted)
+     */
+    class Iterator {
+    private:
+        VectorKDTree *tree;
+        size_t index;
+
+        struct Pointer {
+            Reference reference;
+
+            Reference *operator->() { return &reference; }
+        };
+
+        Iterator(VectorKDTree *tree, size_t index) : tree(tree), index(index) {}
+
+    public:
+        friend class VectorKDTree;
+
+        Iterator() = delete;
+
+        Iterator &operator++() {
+            ++index;
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator temp = *this;
+            ++index;
+            return temp;
+        }
+
+        bool operator==(const Iterator &that) const { return index == that.index; }
+
+        bool operator!=(const Iterator &that) const { return index != that.index; }
+
+        Reference operator*() const { return {key(), tree->values[index]}; }
+
+        Pointer operator->() const { return {**this}; }
+
+        const float *key() const { return tree->points.data() + index * tree->dim; }
+
+        Value &value() const { return tree->values[index]; }
+    };
+
+protected:
+    struct Split {
+        uint32_t dimension;
+        float value;
+    };
+
+    /**
+     * A subtree waiting in the best-first search, bound is a lower bound of its squared distance to the query
+     */
+    struct Branch {
+        double bound;
+        size_t node;
+        size_t level;
+        size_t position;
+
+        bool operator>(const Branch &that) const { return bound > that.bound; }
+    };
+
+    size_t dim = 0;
+    std::vector<float> points;      // coordinates, a row of dim floats per point, in leaf order
+    std::vector<Value> values;      // values, in the same order
+    std::vector<Split> splits;      // split of the internal nodes, in BFS order
+    size_t treeSize = 0;
+    size_t depth = 0;               // number of internal levels, there are 2^depth leaves
+
+    static size_t leftChild(size_t i) { return 2 * i + 1; }
+
+    static size_t rightChild(size_t i) { return 2 * i + 2; }
+
+    /**
+     * @return the first point of node (level, position), see the class comment
+     */
+    size_t rangeBegin(size_t level, size_t position) const {
+        return (size_t) (((unsigned __int128) position * treeSize) >> level);
+    }
+
+    /**
+     * The dimension where the points [first, last) of order have the highest variance
+     * Time Complexity: O(d (last - first))
+     */
+    static uint32_t widestDimension(const std::vector<float> &source, size_t dimension,
+                                    const size_t *first, const size_t *last) {
+        std::vector<double> sum(dimension, 0), squareSum(dimension, 0);
+        for (const size_t *it = first; it != last; ++it) {
+            const float *row = source.data() + *it * dimension;
+            for (size_t j = 0; j < dimension; j++) {
+                sum[j] += row[j];
+                squareSum[j] += (double) row[j] * row[j];
+            }
+        }
+        uint32_t widest = 0;
+        double widestSpread = -1;
+        for (size_t j = 0; j < dimension; j++) {
+            // n times the variance
+            double spread = squareSum[j] - sum[j] * sum[j] / (double) (last - first);
+            if (spread > widestSpread) {
+                widest = (uint32_t) j;
+                widestSpread = spread;
+            }
+        }
+        return widest;
+    }
+
+    /**
+     * Partition the points of node (level, position) in order, see the class comment
+     * Time Complexity: O(dn log n)
+     */
+    void buildRange(const std::vector<float> &source, std::vector<size_t> &order,
+                    size_t node, size_t level, size_t position) {
+        if (level == depth) {
+            return;
+        }
+        size_t *first = order.data() + rangeBegin(level, position);
+        size_t *last = order.data() + rangeBegin(level, position + 1);
+        size_t *median = order.data() + rangeBegin(level + 1, 2 * position + 1);
+        uint32_t dimension = widestDimension(source, dim, first, last);
+        const float *column = source.data() + dimension;
+        size_t stride = dim;
+        std::nth_element(first, median, last, [column, stride](size_t a, size_t b) {
+            return column[a * stride] < column[b * stride];
+        });
+        splits[node] = {dimension, column[*median * stride]};
+        buildRange(source, order, leftChild(node), level + 1, 2 * position);
+        buildRange(source, order, rightChild(node), level + 1, 2 * position + 1);
+    }
+
+    /**
+     * Best-first search for the points near query
+     * A subtree is skipped if its lower bound times (1 + epsilon)^2 is above the bound of the collector,
+     * and the search stops after maxLeaves leaves
+     * With epsilon = 0 and no leaf budget the result is exact
+     * The collector has bound() and add(squared distance, index)
+     */
+    template<typename Collector>
+    void nearestSearch(const float *query, double epsilon, size_t maxLeaves, Collector &collector) const {
+        if (treeSize == 0 || maxLeaves == 0) {
+            return;
+        }
+        double slack = (1 + epsilon) * (1 + epsilon);
+        std::vector<Branch> queue{{0, 0, 0, 0}};
+        size_t leaves = 0;
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<>());
+            Branch branch = queue.back();
+            queue.pop_back();
+            if (branch.bound * slack > collector.bound()) {
+                break;      // every branch left is as far
+            }
+            // go down to the nearest leaf, putting the far sides aside
+            while (branch.level < depth) {
+                const Split &split = splits[branch.node];
+                double diff = (double) query[split.dimension] - split.value;
+                Branch nearSide = {branch.bound, leftChild(branch.node), branch.level + 1, 2 * branch.position};
+                Branch farSide = {std::max(branch.bound, diff * diff), rightChild(branch.node),
+                                  branch.level + 1, 2 * branch.position + 1};
+                if (diff >= 0) {
+                    std::swap(nearSide.node, farSide.node);
+                    std::swap(nearSide.position, farSide.position);
+                }
+                if (farSide.bound * slack <= collector.bound()) {
+                    queue.push_back(farSide);
+                    std::push_heap(queue.begin(), queue.end(), std::greater<>());
+                }
+                branch = nearSide;
+            }
+            for (size_t i = rangeBegin(depth, branch.position), end = rangeBegin(depth, branch.position + 1);
+                 i < end; i++) {
+                collector.add(VectorKernels::squaredDistance(query, points.data() + i * dim, dim), i);
+            }
+            if (++leaves == maxLeaves) {
+                break;
+            }
+        }
+    }
+
+    struct NearestHeap {
+        size_t k;
+        std::vector<std::pair<double, size_t>> items;
+
+        explicit NearestHeap(size_t k) : k(k) { items.reserve(k); }
+
+        double bound() const {
+            return items.size() < k ? std::numeric_limits<double>::infinity() : items.front().first;
+        }
+
+        void add(double distance, size_t index) {
+            if (items.size() < k) {
+                items.emplace_back(distance, index);
+                std::push_heap(items.begin(), items.end());
+            } else if (distance < items.front().first) {
+                std::pop_heap(items.begin(), items.end());
+                items.back() = {distance, index};
+                std::push_heap(items.begin(), items.end());
+            }
+        }
+    };
+
+public:
+    /**
+     * No limit on the number of leaves scanned by a search
+     */
+    static inline constexpr size_t ALL_LEAVES = std::numeric_limits<size_t>::max();
+
+    VectorKDTree() = default;
+
+    /**
+     * Build the tree from points and their values
+     * Equal points are all kept
+     * Time complexity: O(dn log n)
+     * @param dimension d, the number of coordinates of a point
+     * @param source the coordinates of point i are source[i * dimension .. (i + 1) * dimension)
+     * @param v v[i] is the value of point i, we pass by value here because v is moved into the tree
+     * @throw std::range_error if dimension is 0 or the sizes of source and v do not match
+     */
+    VectorKDTree(size_t dimension, const std::vector<float> &source, std::vector<Value> v) : dim(dimension) {
+        if (dimension == 0 || dimension > std::numeric_limits<uint32_t>::max()) {
+            throw std::range_error("VectorKDTree dimension must be positive");
+        }
+        if (source.size() != v.size() * dimension) {
+            throw std::range_error("VectorKDTree needs dimension coordinates for every value");
+        }
+        treeSize = v.size();
+        while (((treeSize + ((size_t) 1 << depth) - 1) >> depth) > LeafSize) {   // the largest leaf is too large
+            depth++;
+        }
+        splits.resize(((size_t) 1 << depth) - 1);
+        std::vector<size_t> order(treeSize);
+        std::iota(order.begin(), order.end(), (size_t) 0);
+        buildRange(source, order, 0, 0, 0);
+
+        points.resize(treeSize * dim);
+        values.reserve(treeSize);
+        for (size_t i = 0; i < treeSize; i++) {
+            std::copy_n(source.data() + order[i] * dim, dim, points.data() + i * dim);
+            values.push_back(std::move(v[order[i]]));
+        }
+    }
+
+    Iterator begin() { return Iterator(this, 0); }
+
+    Iterator end() { return Iterator(this, treeSize); }
+
+    /**
+     * Find the count nearest points to query in L2 distance
+     * The i-th result is at most (1 + epsilon) times as far as the exact i-th nearest point,
+     * as long as the search is not cut short by maxLeaves
+     * Time Complexity: O(d LeafSize maxLeaves + log n maxLeaves), about O(d log n) for low d and epsilon = 0,
+     * up to O(dn) in high dimensions without a budget
+     * @param query dimension coordinates
+     * @param epsilon slack of the distance bound, 0 for the exact result
+     * @param maxLeaves the number of leaves scanned at most, ALL_LEAVES for no limit
+     * @return iterators of the min(count, size()) nearest points found, nearest first
+     */
+    std::vector<Iterator> kNearest(const float *query, size_t count, double epsilon = 0,
+                                   size_t maxLeaves = ALL_LEAVES) {
+        if (count == 0) {
+            return {};
+        }
+        NearestHeap heap(count);
+        nearestSearch(query, epsilon, maxLeaves, heap);
+        std::sort(heap.items.begin(), heap.items.end());
+        std::vector<Iterator> result;
+        result.reserve(heap.items.size());
+        for (auto &item : heap.items) {
+            result.push_back(Iterator(this, item.second));
+        }
+        return result;
+    }
+
+    /**
+     * Same as kNearest(query, 1, epsilon, maxLeaves)
+     * @return iterator of the nearest point found, or end() if the tree is empty
+     */
+    Iterator nearest(const float *query, double epsilon = 0, size_t maxLeaves = ALL_LEAVES) {
+        NearestHeap heap(1);
+        nearestSearch(query, epsilon, maxLeaves, heap);
+        return heap.items.empty() ? end() : Iterator(this, heap.items.front().second);
+    }
+
+    size_t size() const { return treeSize; }
+
+    /**
+     * @return d, the number of coordinates of a point
+     */
+    size_t dimension() const { return dim; }
+
+    /**
+     * @return the number of internal levels, the leaves hold at most LeafSize points
+     */
+    size_t height() const { return depth; }
+};
+
+#endif //VE281P3_VECTOR_KDTREE_HPP
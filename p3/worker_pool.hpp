@@ -0,0 +1,167 @@
+#ifndef VE281P3_WORKER_POOL_HPP
+#define VE281P3_WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * A process-wide pool of worker threads for the parallel builds and batches of the KDTrees
+ * No thread is started until a caller asks for workers with reserve, and the workers then
+ * stay until the process exits, so a batch does not pay for starting threads
+ * A task is claimed exactly once: by a worker, or by the thread that waits for it if no worker
+ * has taken it yet, so a task that waits for the tasks it submitted never deadlocks the pool
+ */
+class WorkerPool {
+    static constexpr size_t MAX_WORKERS = 256;
+
+    struct Task {
+        std::function<void()> function;
+        std::atomic<bool> claimed{false};
+        std::mutex mutex;
+        std::condition_variable finishedSignal;
+        bool finished = false;
+        std::exception_ptr error;
+
+        explicit Task(std::function<void()> function) : function(std::move(function)) {}
+
+        bool claim() { return !claimed.exchange(true); }
+
+        void run() {
+            try {
+                function();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            finishedSignal.notify_all();
+        }
+    };
+
+    std::mutex mutex;
+    std::condition_variable readySignal;
+    std::deque<std::shared_ptr<Task>> queue;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    WorkerPool() = default;
+
+    void work() {
+        while (true) {
+            std::shared_ptr<Task> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                readySignal.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            if (task->claim()) {
+                task->run();
+            }
+        }
+    }
+
+public:
+    /**
+     * A submitted task
+     */
+    class Handle {
+        std::shared_ptr<Task> task;
+        bool waited = false;
+
+    public:
+        explicit Handle(std::shared_ptr<Task> task) : task(std::move(task)) {}
+
+        Handle(Handle &&) = default;
+
+        Handle &operator=(Handle &&) = delete;
+
+        // like the future of std::async, a handle that was not waited for waits when it is destroyed
+        ~Handle() {
+            if (task != nullptr && !waited) {
+                try {
+                    wait();
+                } catch (...) {
+                }
+            }
+        }
+
+        /**
+         * Run the task in this thread if no worker has claimed it, otherwise wait for the worker
+         * @throw whatever the task threw
+         */
+        void wait() {
+            waited = true;
+            if (task->claim()) {
+                task->run();
+            } else {
+                std::unique_lock<std::mutex> lock(task->mutex);
+                task->finishedSignal.wait(lock, [this]() { return task->finished; });
+            }
+            if (task->error) {
+                std::rethrow_exception(task->error);
+            }
+        }
+    };
+
+    WorkerPool(const WorkerPool &) = delete;
+
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        readySignal.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    /**
+     * @return the pool of the process, created on first use
+     */
+    static WorkerPool &instance() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    /**
+     * Start workers until there are at least count of them (at most MAX_WORKERS)
+     * Time Complexity: O(1) if there are enough workers already
+     */
+    void reserve(size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (workers.size() < count && workers.size() < MAX_WORKERS) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    /**
+     * Queue a task for the workers
+     * Time Complexity: O(1)
+     */
+    Handle submit(std::function<void()> function) {
+        auto task = std::make_shared<Task>(std::move(function));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(task);
+        }
+        readySignal.notify_one();
+        return Handle(std::move(task));
+    }
+};
+
+#endif //VE281P3_WORKER_POOL_HPP